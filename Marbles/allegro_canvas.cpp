@@ -0,0 +1,60 @@
+#include "allegro_canvas.hpp"
+
+#include <cstddef>
+
+static_assert(sizeof(Color) == sizeof(ALLEGRO_COLOR), "colors are handed to Allegro as they are");
+
+AllegroCanvas::AllegroCanvas() {
+    ALLEGRO_VERTEX_ELEMENT elements[] = {
+        { ALLEGRO_PRIM_POSITION, ALLEGRO_PRIM_FLOAT_2, offsetof(Vertex, x) },
+        { ALLEGRO_PRIM_COLOR_ATTR, 0, offsetof(Vertex, color) },
+        { 0, 0, 0 },
+    };
+    _decl = al_create_vertex_decl(elements, sizeof(Vertex));
+}
+
+AllegroCanvas::~AllegroCanvas() {
+    if (_layer)
+        al_destroy_bitmap(_layer);
+    al_destroy_vertex_decl(_decl);
+}
+
+int AllegroCanvas::width() const {
+    return al_get_bitmap_width(al_get_target_bitmap());
+}
+
+int AllegroCanvas::height() const {
+    return al_get_bitmap_height(al_get_target_bitmap());
+}
+
+void AllegroCanvas::drawTriangles(const Vertex *vertices, const int *indices, size_t count) {
+    al_draw_indexed_prim(vertices, _decl, nullptr, indices, (int)count, ALLEGRO_PRIM_TRIANGLE_LIST);
+}
+
+void AllegroCanvas::drawLines(const Vertex *vertices, const int *indices, size_t count) {
+    al_draw_indexed_prim(vertices, _decl, nullptr, indices, (int)count, ALLEGRO_PRIM_LINE_LIST);
+}
+
+void AllegroCanvas::beginLayer() {
+    _target = al_get_target_bitmap();
+    int width = al_get_bitmap_width(_target);
+    int height = al_get_bitmap_height(_target);
+    if (_layer && (al_get_bitmap_width(_layer) != width || al_get_bitmap_height(_layer) != height)) {
+        al_destroy_bitmap(_layer);
+        _layer = nullptr;
+    }
+    if (!_layer)
+        _layer = al_create_bitmap(width, height);
+
+    al_set_target_bitmap(_layer);
+    al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+}
+
+void AllegroCanvas::endLayer() {
+    al_set_target_bitmap(_target);
+}
+
+void AllegroCanvas::drawLayer() {
+    if (_layer)
+        al_draw_bitmap(_layer, 0, 0, 0);
+}
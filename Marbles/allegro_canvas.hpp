@@ -0,0 +1,34 @@
+#pragma once
+
+#include "canvas.hpp"
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_primitives.h>
+
+// Canvas on the target bitmap of the calling thread, with the layer in a
+// bitmap of its own.
+class AllegroCanvas : public Canvas {
+public:
+    AllegroCanvas();
+    ~AllegroCanvas() override;
+
+    AllegroCanvas(const AllegroCanvas &) = delete;
+    AllegroCanvas &operator=(const AllegroCanvas &) = delete;
+
+    int width() const override;
+    int height() const override;
+
+    void drawTriangles(const Vertex *vertices, const int *indices, size_t count) override;
+    void drawLines(const Vertex *vertices, const int *indices, size_t count) override;
+
+    void beginLayer() override;
+    void endLayer() override;
+    void drawLayer() override;
+
+private:
+    // Vertex as Allegro is to read it
+    ALLEGRO_VERTEX_DECL *_decl = nullptr;
+    ALLEGRO_BITMAP *_layer = nullptr;
+    // where drawing goes again after the layer
+    ALLEGRO_BITMAP *_target = nullptr;
+};
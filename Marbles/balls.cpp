@@ -0,0 +1,163 @@
+#include "balls.hpp"
+
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define MARBLES_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MARBLES_SSE2
+#endif
+
+static constexpr double INF = std::numeric_limits<double>::infinity();
+
+void BallArrays::push_back(const Ball &ball, double ball_limit) {
+    state.push_back(ball.state);
+    type.push_back(ball.type);
+    transition.push_back(ball.transition);
+    limit.push_back(ball_limit);
+    row.push_back(ball.row);
+    col.push_back(ball.col);
+    rotor_position.push_back((uint8_t)ball.rotor_position);
+    segment.push_back(-1);
+}
+
+void BallArrays::set(size_t i, const Ball &ball, double ball_limit) {
+    state[i] = ball.state;
+    type[i] = ball.type;
+    transition[i] = ball.transition;
+    limit[i] = ball_limit;
+    row[i] = ball.row;
+    col[i] = ball.col;
+    rotor_position[i] = (uint8_t)ball.rotor_position;
+    segment[i] = -1;
+}
+
+void BallArrays::resize(size_t count) {
+    state.resize(count);
+    type.resize(count);
+    transition.resize(count);
+    limit.resize(count);
+    row.resize(count);
+    col.resize(count);
+    rotor_position.resize(count);
+    segment.resize(count, -1);
+}
+
+void BallArrays::clear() {
+    state.clear();
+    type.clear();
+    transition.clear();
+    limit.clear();
+    row.clear();
+    col.clear();
+    rotor_position.clear();
+    segment.clear();
+}
+
+static uint64_t advance_scalar(double *transition, const double *limit, size_t count, double step) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (limit[i] != INF)
+            transition[i] += step;
+        if (transition[i] >= limit[i])
+            bits |= uint64_t(1) << i;
+    }
+    return bits;
+}
+
+static uint64_t advance_block(double *transition, const double *limit, double step) {
+    uint64_t bits = 0;
+
+#if defined(MARBLES_AVX)
+    const __m256d inf = _mm256_set1_pd(INF);
+    const __m256d steps = _mm256_set1_pd(step);
+    for (int k = 0; k < 64; k += 4) {
+        __m256d l = _mm256_loadu_pd(limit + k);
+        __m256d t = _mm256_loadu_pd(transition + k);
+        __m256d moving = _mm256_cmp_pd(l, inf, _CMP_NEQ_OQ);
+        t = _mm256_add_pd(t, _mm256_and_pd(steps, moving));
+        _mm256_storeu_pd(transition + k, t);
+        bits |= (uint64_t)_mm256_movemask_pd(_mm256_cmp_pd(t, l, _CMP_GE_OQ)) << k;
+    }
+#elif defined(MARBLES_SSE2)
+    const __m128d inf = _mm_set1_pd(INF);
+    const __m128d steps = _mm_set1_pd(step);
+    for (int k = 0; k < 64; k += 2) {
+        __m128d l = _mm_loadu_pd(limit + k);
+        __m128d t = _mm_loadu_pd(transition + k);
+        __m128d moving = _mm_cmpneq_pd(l, inf);
+        t = _mm_add_pd(t, _mm_and_pd(steps, moving));
+        _mm_storeu_pd(transition + k, t);
+        bits |= (uint64_t)_mm_movemask_pd(_mm_cmpge_pd(t, l)) << k;
+    }
+#else
+    bits = advance_scalar(transition, limit, 64, step);
+#endif
+
+    return bits;
+}
+
+void advance_balls(double *transition, const double *limit, size_t count, double step, uint64_t *crossed) {
+    size_t blocks = count / 64;
+    for (size_t b = 0; b < blocks; ++b) {
+        crossed[b] = advance_block(transition + b * 64, limit + b * 64, step);
+    }
+
+    size_t rest = count % 64;
+    if (rest > 0) {
+        crossed[blocks] = advance_scalar(transition + blocks * 64, limit + blocks * 64, rest, step);
+    }
+}
+
+static uint64_t inexact_scalar(const double *transition, const double *limit, size_t count, double step) {
+    uint64_t bits = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (limit[i] != INF && (transition[i] + step) - step != transition[i])
+            bits |= uint64_t(1) << i;
+    }
+    return bits;
+}
+
+static uint64_t inexact_block(const double *transition, const double *limit, double step) {
+    uint64_t bits = 0;
+
+#if defined(MARBLES_AVX)
+    const __m256d inf = _mm256_set1_pd(INF);
+    const __m256d steps = _mm256_set1_pd(step);
+    for (int k = 0; k < 64; k += 4) {
+        __m256d l = _mm256_loadu_pd(limit + k);
+        __m256d t = _mm256_loadu_pd(transition + k);
+        __m256d back = _mm256_sub_pd(_mm256_add_pd(t, steps), steps);
+        __m256d inexact = _mm256_and_pd(_mm256_cmp_pd(l, inf, _CMP_NEQ_OQ), _mm256_cmp_pd(back, t, _CMP_NEQ_OQ));
+        bits |= (uint64_t)_mm256_movemask_pd(inexact) << k;
+    }
+#elif defined(MARBLES_SSE2)
+    const __m128d inf = _mm_set1_pd(INF);
+    const __m128d steps = _mm_set1_pd(step);
+    for (int k = 0; k < 64; k += 2) {
+        __m128d l = _mm_loadu_pd(limit + k);
+        __m128d t = _mm_loadu_pd(transition + k);
+        __m128d back = _mm_sub_pd(_mm_add_pd(t, steps), steps);
+        __m128d inexact = _mm_and_pd(_mm_cmpneq_pd(l, inf), _mm_cmpneq_pd(back, t));
+        bits |= (uint64_t)_mm_movemask_pd(inexact) << k;
+    }
+#else
+    bits = inexact_scalar(transition, limit, 64, step);
+#endif
+
+    return bits;
+}
+
+void inexact_steps(const double *transition, const double *limit, size_t count, double step, uint64_t *inexact) {
+    size_t blocks = count / 64;
+    for (size_t b = 0; b < blocks; ++b) {
+        inexact[b] = inexact_block(transition + b * 64, limit + b * 64, step);
+    }
+
+    size_t rest = count % 64;
+    if (rest > 0) {
+        inexact[blocks] = inexact_scalar(transition + blocks * 64, limit + blocks * 64, rest, step);
+    }
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+enum class BallType : uint8_t {
+    Red,
+    Green,
+    Blue,
+    Yellow,
+};
+
+enum class BallState : uint8_t {
+    None = 0,
+    EnteringFromNorth,
+    EnteringFromEast,
+    EnteringFromSouth,
+    EnteringFromWest,
+    ExitingTowardsNorth,
+    ExitingTowardsEast,
+    ExitingTowardsSouth,
+    ExitingTowardsWest,
+    InsideRotor,
+};
+
+struct Ball {
+    BallState state = BallState::None;
+    BallType type;
+    double transition;
+    int row;
+    int col;
+    int rotor_position;
+};
+
+// Structure-of-arrays storage for all balls of a model.
+struct BallArrays {
+    std::vector<BallState> state;
+    std::vector<BallType> type;
+    std::vector<double> transition;
+    // value of transition at which the ball changes its state next,
+    // infinity for balls that don't move
+    std::vector<double> limit;
+    std::vector<int> row;
+    std::vector<int> col;
+    std::vector<uint8_t> rotor_position;
+    // track segment the ball travels along, -1 if row, col and state are
+    // up to date. on a segment, transition is the distance along it.
+    std::vector<int> segment;
+
+    size_t size() const { return state.size(); }
+    bool empty() const { return state.empty(); }
+
+    Ball operator[](size_t i) const {
+        return Ball{ state[i], type[i], transition[i], row[i], col[i], rotor_position[i] };
+    }
+
+    void push_back(const Ball &ball, double ball_limit);
+    void set(size_t i, const Ball &ball, double ball_limit);
+    // balls added are zero and not on a segment
+    void resize(size_t count);
+    void clear();
+};
+
+// Adds step to the transition of every ball with a finite limit and sets bit
+// i of crossed for every ball i that has reached its limit afterwards. crossed
+// has to hold (count + 63) / 64 words.
+void advance_balls(double *transition, const double *limit, size_t count, double step, uint64_t *crossed);
+
+// Sets bit i of inexact for every ball i that advance_balls would move by step
+// and whose transition doesn't come back exactly when step is subtracted
+// again. inexact has to hold (count + 63) / 64 words.
+void inexact_steps(const double *transition, const double *limit, size_t count, double step, uint64_t *inexact);
+
+// index of the lowest set bit, bits must not be zero
+inline int count_trailing_zeros(uint64_t bits) {
+#if defined(_MSC_VER) && defined(_WIN64)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return (int)index;
+#elif defined(_MSC_VER)
+    unsigned long index;
+    if (_BitScanForward(&index, (unsigned long)bits))
+        return (int)index;
+    _BitScanForward(&index, (unsigned long)(bits >> 32));
+    return (int)index + 32;
+#else
+    return __builtin_ctzll(bits);
+#endif
+}
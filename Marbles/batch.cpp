@@ -0,0 +1,118 @@
+#include "batch.hpp"
+
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+static constexpr double FRAME = 1000.0 / 60.0;
+
+// nothing happens between commands. over long stretches it pays off to look
+// for a board that settled into a loop, while short ones are cheaper to
+// simulate than to sample for a period.
+static void wait(Model &model, double time) {
+    static constexpr double LONG_WAIT = 10 * 60 * 1000.0;
+
+    if (time - model.now() >= LONG_WAIT)
+        model.fastForward(time);
+    else
+        model.advanceTo(time);
+}
+
+void run_scenario(Model &model, const Scenario &scenario, ScenarioResult &result,
+    const std::shared_ptr<const Snapshot> &start)
+{
+    if (start)
+        model.restore(start);
+    else
+        setup_scenario(model, scenario);
+
+    for (const auto &command : scenario.commands) {
+        if (command.time > scenario.duration)
+            break;
+        wait(model, command.time);
+        apply_command(model, command);
+    }
+    wait(model, scenario.duration);
+
+    result.time = model.now();
+    result.ticks = (long long)std::ceil(result.time / FRAME);
+
+    result.balls.clear();
+    for (const Ball &ball : model.balls()) {
+        result.balls.push_back(ball);
+    }
+
+    result.rotors.clear();
+    for (int r = 0; r < model.rows(); ++r) {
+        for (int c = 0; c < model.cols(); ++c) {
+            const PackedTile &tile = model.packedTiles()[c + (size_t)r * model.cols()];
+            if (tile.type() == TileType::Rotor)
+                result.rotors.push_back(RotorResult{ r, c, tile.position(), tile.state() });
+        }
+    }
+}
+
+void run_batch(const std::vector<Scenario> &scenarios, size_t repeat, ThreadPool &pool,
+    const std::function<void(const ScenarioResult &)> &on_result)
+{
+    std::vector<std::unique_ptr<Model>> models(pool.size());
+    std::vector<ScenarioResult> results(pool.size());
+    std::mutex output;
+
+    auto model_of = [&](const Scenario &scenario) -> Model & {
+        int worker = ThreadPool::worker();
+        if (!models[worker])
+            models[worker].reset(new Model(scenario.rows, scenario.cols));
+        return *models[worker];
+    };
+
+    std::vector<std::shared_ptr<const Snapshot>> starts;
+    if (repeat > 1) {
+        starts.resize(scenarios.size());
+        pool.run(scenarios.size(), [&](size_t k) {
+            Model &model = model_of(scenarios[k]);
+            setup_scenario(model, scenarios[k]);
+            starts[k] = Snapshot::capture(model);
+        });
+    }
+
+    pool.run(scenarios.size() * repeat, [&](size_t k) {
+        const Scenario &scenario = scenarios[k % scenarios.size()];
+        Model &model = model_of(scenario);
+
+        ScenarioResult &result = results[ThreadPool::worker()];
+        result.index = k;
+        run_scenario(model, scenario, result, starts.empty() ? nullptr : starts[k % scenarios.size()]);
+
+        std::lock_guard<std::mutex> lock(output);
+        on_result(result);
+    });
+}
+
+void write_result(FILE *out, const Scenario &scenario, const ScenarioResult &result) {
+    static const char *const TYPES[] = { "red", "green", "blue", "yellow" };
+    static const char DIRECTIONS[] = { 'N', 'E', 'S', 'W' };
+
+    std::fprintf(out, "result %s %zu time %.3f ticks %lld\n",
+        scenario.name.c_str(), result.index, result.time, result.ticks);
+
+    for (const auto &ball : result.balls) {
+        int state = (int)ball.state;
+        if (ball.state == BallState::InsideRotor) {
+            std::fprintf(out, "ball %d %d %s inside %d\n", ball.row, ball.col, TYPES[(int)ball.type], ball.rotor_position);
+        }
+        else if (state >= (int)BallState::EnteringFromNorth && state <= (int)BallState::EnteringFromWest) {
+            std::fprintf(out, "ball %d %d %s entering %c %.6f\n", ball.row, ball.col, TYPES[(int)ball.type],
+                DIRECTIONS[state - (int)BallState::EnteringFromNorth], ball.transition);
+        }
+        else if (state >= (int)BallState::ExitingTowardsNorth && state <= (int)BallState::ExitingTowardsWest) {
+            std::fprintf(out, "ball %d %d %s exiting %c %.6f\n", ball.row, ball.col, TYPES[(int)ball.type],
+                DIRECTIONS[state - (int)BallState::ExitingTowardsNorth], ball.transition);
+        }
+    }
+
+    for (const auto &rotor : result.rotors) {
+        std::fprintf(out, "rotor %d %d %d%s\n", rotor.row, rotor.col, rotor.position,
+            rotor.state == RotorState::Resting ? "" : " turning");
+    }
+}
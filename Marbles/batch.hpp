@@ -0,0 +1,45 @@
+#pragma once
+
+#include "scenario.hpp"
+#include "snapshot.hpp"
+#include "thread_pool.hpp"
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <vector>
+
+struct RotorResult {
+    int row;
+    int col;
+    int position;
+    RotorState state;
+};
+
+// State of a scenario after running it to its end.
+struct ScenarioResult {
+    // index of the run in the batch
+    size_t index = 0;
+    // simulated milliseconds and the number of 60 Hz frames they cover
+    double time = 0.0;
+    long long ticks = 0;
+    std::vector<Ball> balls;
+    std::vector<RotorResult> rotors;
+};
+
+// runs the scenario's commands at their times and simulates up to its end,
+// fast forwarding from command to command. the board and balls are restored
+// from start if given, which has to be a snapshot of the scenario's setup.
+void run_scenario(Model &model, const Scenario &scenario, ScenarioResult &result,
+    const std::shared_ptr<const Snapshot> &start = nullptr);
+
+// runs all scenarios repeat times on the pool, the results are indexed by run
+// and run k is of scenario k % scenarios.size(). every thread reuses one
+// model for all the runs it picks up, and repeated runs fork from a snapshot
+// of their scenario's setup. on_result is called from the thread that did the
+// run as soon as it is done, but never from two threads at once.
+void run_batch(const std::vector<Scenario> &scenarios, size_t repeat, ThreadPool &pool,
+    const std::function<void(const ScenarioResult &)> &on_result);
+
+// writes the result in the ball line format of the scenario files
+void write_result(FILE *out, const Scenario &scenario, const ScenarioResult &result);
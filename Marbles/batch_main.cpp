@@ -0,0 +1,72 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static void usage(const char *name) {
+    std::fprintf(stderr,
+        "usage: %s [--threads N] [--repeat N] [--quiet] FILE...\n"
+        "  --threads N  number of threads (default: all cores)\n"
+        "  --repeat N   run every scenario N times (default 1)\n"
+        "  --quiet      only print the summary\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    int threads = (int)std::thread::hardware_concurrency();
+    int repeat = 1;
+    bool quiet = false;
+    std::vector<Scenario> scenarios;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--repeat") == 0 && i + 1 < argc) {
+            repeat = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--quiet") == 0) {
+            quiet = true;
+        }
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            std::string error;
+            if (!load_scenarios(argv[i], scenarios, error)) {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+        }
+    }
+
+    if (scenarios.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    size_t runs = scenarios.size() * (size_t)std::max(repeat, 0);
+
+    ThreadPool pool(threads > 0 ? threads : 1);
+    long long ticks = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    run_batch(scenarios, (size_t)std::max(repeat, 0), pool, [&](const ScenarioResult &result) {
+        ticks += result.ticks;
+        if (!quiet) {
+            write_result(stdout, scenarios[result.index % scenarios.size()], result);
+            std::fflush(stdout);
+        }
+    });
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::fprintf(stderr, "%zu scenarios, %lld ticks in %.3f s on %d threads: %.1f scenarios/s\n",
+        runs, ticks, seconds, pool.size(), runs / seconds);
+    return 0;
+}
@@ -0,0 +1,189 @@
+#include "model.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+struct BoardSize {
+    int rows;
+    int cols;
+};
+
+static constexpr BoardSize SIZES[] = {
+    { 5, 8 },
+    { 64, 64 },
+    { 256, 256 },
+    { 1024, 1024 },
+    { 4096, 4096 },
+};
+
+// peak resident set size of the process in bytes
+static size_t peak_rss() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return (size_t)usage.ru_maxrss;
+#else
+    return (size_t)usage.ru_maxrss * 1024;
+#endif
+#endif
+}
+
+static uint32_t next_random(uint32_t &state) {
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// rotors on every even row and column, connected by straight track. every
+// rotor starts with three balls and every horizontal track piece with one
+// ball heading east, so the balls keep bouncing between full rotors.
+static void generate(Model &model) {
+    int type = 0;
+    for (int r = 0; r < model.rows(); ++r) {
+        for (int c = 0; c < model.cols(); ++c) {
+            if (r % 2 == 0 && c % 2 == 0) {
+                model.setTile(r, c, TileType::Rotor);
+
+                for (int i = 0; i < 3; ++i) {
+                    model.addBall(Ball{ BallState::InsideRotor, (BallType)(type++ % 4), 0, r, c, i });
+                }
+            }
+            else if (r % 2 == 0 && c + 1 < model.cols()) {
+                model.setTile(r, c, TileType::Horizontal);
+                model.addBall(Ball{ BallState::ExitingTowardsEast, (BallType)(type++ % 4), 0, r, c, 0 });
+            }
+            else if (c % 2 == 0 && r + 1 < model.rows()) {
+                model.setTile(r, c, TileType::Vertical);
+            }
+        }
+    }
+}
+
+struct Options {
+    double seconds = 1.0;
+    int min_ticks = 3;
+    // simulated milliseconds per tick
+    double tick = 1000.0 / 60.0;
+    // drive the model with advanceTo instead of progress
+    bool events = false;
+    int threads = 1;
+};
+
+static void run(const BoardSize &size, const Options &options) {
+    using clock = std::chrono::steady_clock;
+
+    Model model(size.rows, size.cols);
+    model.setThreads(options.threads);
+    generate(model);
+
+    int rotors_per_row = (size.cols + 1) / 2;
+    int rotor_count = rotors_per_row * ((size.rows + 1) / 2);
+    int turns_per_tick = rotor_count / 64 + 1;
+    uint32_t random = 0x9e3779b9u;
+
+    clock::duration elapsed{};
+    long long ticks = 0;
+    while (ticks < options.min_ticks || std::chrono::duration<double>(elapsed).count() < options.seconds) {
+        // keep some rotors moving, input is not part of the measurement
+        for (int i = 0; i < turns_per_tick; ++i) {
+            int rotor = (int)(next_random(random) % (uint32_t)rotor_count);
+            int row = rotor / rotors_per_row * 2;
+            int col = rotor % rotors_per_row * 2;
+            if (next_random(random) & 1)
+                model.turnClockwise(row, col);
+            else
+                model.turnCounterClockwise(row, col);
+        }
+
+        auto start = clock::now();
+        if (options.events)
+            model.advanceTo(model.now() + options.tick);
+        else
+            model.progress(options.tick);
+        elapsed += clock::now() - start;
+        ++ticks;
+    }
+
+    double total = std::chrono::duration<double>(elapsed).count();
+    double balls = (double)model.balls().size();
+    std::printf("%5dx%-5d %10zu %10zu %8lld %12.1f %14.2f %12.1f\n",
+        size.cols, size.rows,
+        (size_t)size.rows * size.cols, model.balls().size(),
+        ticks, ticks / total,
+        balls > 0 ? total * 1e9 / (ticks * balls) : 0.0,
+        peak_rss() / (1024.0 * 1024.0));
+    std::fflush(stdout);
+}
+
+static void usage(const char *name) {
+    std::fprintf(stderr,
+        "usage: %s [--max-size N] [--seconds S] [--min-ticks N] [--tick MS] [--events]\n"
+        "       [--threads N]\n"
+        "  --max-size N   largest board edge to run (default 4096)\n"
+        "  --seconds S    measured time per board size (default 1.0)\n"
+        "  --min-ticks N  minimum number of ticks per board size (default 3)\n"
+        "  --tick MS      simulated milliseconds per tick (default 16.67)\n"
+        "  --events       simulate with advanceTo instead of progress\n"
+        "  --threads N    number of simulation threads (default 1)\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    int max_size = 4096;
+    Options options;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--max-size") == 0 && i + 1 < argc) {
+            max_size = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            options.seconds = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--min-ticks") == 0 && i + 1 < argc) {
+            options.min_ticks = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--tick") == 0 && i + 1 < argc) {
+            options.tick = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--events") == 0) {
+            options.events = true;
+        }
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::printf("%-11s %10s %10s %8s %12s %14s %12s\n",
+        "board", "tiles", "balls", "ticks", "ticks/s", "ns/ball-update", "peak RSS MB");
+
+    for (const auto &size : SIZES) {
+        if (size.rows > max_size || size.cols > max_size)
+            continue;
+        run(size, options);
+    }
+
+    return 0;
+}
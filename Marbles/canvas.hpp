@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// colors with components from 0 to 1, laid out like ALLEGRO_COLOR
+struct Color {
+    float r;
+    float g;
+    float b;
+    float a;
+};
+
+inline Color rgb(uint8_t r, uint8_t g, uint8_t b) {
+    return Color{ r / 255.0f, g / 255.0f, b / 255.0f, 1.0f };
+}
+
+struct Vertex {
+    float x;
+    float y;
+    Color color;
+};
+
+// What View draws onto: a target of some size in pixels, plus a layer of the
+// same size that keeps what was drawn into it until it is drawn into again.
+// Primitives are given as lists of vertices with indices into them, and all
+// vertices of a primitive are expected to have the same color.
+class Canvas {
+public:
+    virtual ~Canvas() = default;
+
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+
+    // three indices per triangle
+    virtual void drawTriangles(const Vertex *vertices, const int *indices, size_t count) = 0;
+    // two indices per line, lines are a pixel wide
+    virtual void drawLines(const Vertex *vertices, const int *indices, size_t count) = 0;
+
+    // clears the layer and draws into it until endLayer, the layer keeps
+    // its contents while the size of the target stays the same
+    virtual void beginLayer() = 0;
+    virtual void endLayer() = 0;
+    // draws the layer over the target
+    virtual void drawLayer() = 0;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "model.hpp"
+
+#include <cstdint>
+
+// Player input that can be scripted, i.e. everything main.cpp does with a
+// click on a rotor.
+enum class Action : uint8_t {
+    TurnClockwise,
+    TurnCounterClockwise,
+    EjectNorth,
+    EjectEast,
+    EjectSouth,
+    EjectWest,
+};
+
+struct Command {
+    // simulated time in milliseconds
+    double time;
+    Action action;
+    int row;
+    int col;
+};
+
+inline void apply_command(Model &model, const Command &command) {
+    switch (command.action) {
+    case Action::TurnClockwise:
+        model.turnClockwise(command.row, command.col);
+        break;
+    case Action::TurnCounterClockwise:
+        model.turnCounterClockwise(command.row, command.col);
+        break;
+    case Action::EjectNorth:
+        model.ejectNorth(command.row, command.col);
+        break;
+    case Action::EjectEast:
+        model.ejectEast(command.row, command.col);
+        break;
+    case Action::EjectSouth:
+        model.ejectSouth(command.row, command.col);
+        break;
+    case Action::EjectWest:
+        model.ejectWest(command.row, command.col);
+        break;
+    }
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <cstdint>
+
+// splitmix64, spreads consecutive values over all 64 bits. Zobrist keys are
+// derived from it on the fly rather than looked up in tables of random
+// numbers, which would need an entry for every tile of the board.
+inline uint64_t mix_hash(uint64_t x) {
+    uint64_t z = x + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
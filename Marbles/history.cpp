@@ -0,0 +1,112 @@
+#include "history.hpp"
+
+#include <cstring>
+
+static uint32_t read_size(const uint8_t *bytes) {
+    uint32_t size;
+    std::memcpy(&size, bytes, sizeof(size));
+    return size;
+}
+
+History::History(size_t capacity) :
+    _ring(capacity)
+{
+}
+
+void History::commit() {
+    size_t size = _pending.size() + 2 * sizeof(uint32_t);
+    if (size > _ring.size() || _pending.size() > UINT32_MAX) {
+        clear();
+        return;
+    }
+
+    for (;;) {
+        if (_count == 0) {
+            _head = 0;
+            _tail = 0;
+            _wrapped = false;
+        }
+
+        if (_wrapped) {
+            if (_tail - _head >= size)
+                break;
+        }
+        else {
+            if (_ring.size() - _head >= size)
+                break;
+
+            // wrap around if there is room before the oldest entry
+            if (_tail >= size) {
+                _wrap = _head;
+                _head = 0;
+                _wrapped = true;
+                break;
+            }
+        }
+        dropOldest();
+    }
+
+    uint32_t records = (uint32_t)_pending.size();
+    std::memcpy(&_ring[_head], &records, sizeof(records));
+    if (records > 0)
+        std::memcpy(&_ring[_head + sizeof(records)], _pending.data(), records);
+    std::memcpy(&_ring[_head + sizeof(records) + records], &records, sizeof(records));
+
+    _head += size;
+    ++_count;
+    _pending.clear();
+}
+
+size_t History::newestEnd() const {
+    return _wrapped && _head == 0 ? _wrap : _head;
+}
+
+bool History::newest(const uint8_t *&begin, const uint8_t *&end) const {
+    if (!_pending.empty()) {
+        begin = _pending.data();
+        end = begin + _pending.size();
+        return true;
+    }
+    if (_count == 0)
+        return false;
+
+    size_t last = newestEnd() - sizeof(uint32_t);
+    end = _ring.data() + last;
+    begin = end - read_size(&_ring[last]);
+    return true;
+}
+
+void History::dropNewest() {
+    if (!_pending.empty()) {
+        _pending.clear();
+        return;
+    }
+    if (_count == 0)
+        return;
+
+    if (_wrapped && _head == 0) {
+        _head = _wrap;
+        _wrapped = false;
+    }
+    _head -= read_size(&_ring[_head - sizeof(uint32_t)]) + 2 * sizeof(uint32_t);
+    --_count;
+}
+
+void History::dropOldest() {
+    _tail += read_size(&_ring[_tail]) + 2 * sizeof(uint32_t);
+    --_count;
+
+    if (_wrapped && _tail == _wrap) {
+        _tail = 0;
+        _wrapped = false;
+    }
+}
+
+void History::clear() {
+    _pending.clear();
+    _head = 0;
+    _tail = 0;
+    _wrap = 0;
+    _wrapped = false;
+    _count = 0;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Undo records of the last ticks of a model in a ring buffer that is
+// allocated once. The records of a tick are collected in a pending entry and
+// committed to the ring when the tick is done, dropping the oldest entries
+// to make room. Entries are undone newest first, and the records of an entry
+// from its end to its start.
+class History {
+public:
+    explicit History(size_t capacity);
+
+    // the entry being recorded
+    std::vector<uint8_t> &pending() { return _pending; }
+
+    // moves the pending entry into the ring. an entry that doesn't fit into
+    // the ring at all can't be kept, and the entries before it would be of
+    // no use without it, so the history is cleared instead.
+    void commit();
+
+    // committed entries
+    size_t entries() const { return _count; }
+    bool empty() const { return _count == 0 && _pending.empty(); }
+
+    // records of the pending entry if there are any, or else of the newest
+    // committed one, false if there is none
+    bool newest(const uint8_t *&begin, const uint8_t *&end) const;
+    void dropNewest();
+
+    void clear();
+
+private:
+    // end of the newest committed entry
+    size_t newestEnd() const;
+    void dropOldest();
+
+    std::vector<uint8_t> _ring;
+    std::vector<uint8_t> _pending;
+
+    // entries are stored as their size, their records and their size again.
+    // they fill [_tail, _head), or [_tail, _wrap) and [0, _head) once the
+    // newer ones wrapped around to the start of the ring.
+    size_t _head = 0;
+    size_t _tail = 0;
+    size_t _wrap = 0;
+    bool _wrapped = false;
+    size_t _count = 0;
+};
@@ -0,0 +1,277 @@
+#include "journal.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+static constexpr char MAGIC[8] = { 'M', 'R', 'B', 'L', 'J', 'R', 'N', 'L' };
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t HEADER_SIZE = 20;
+
+static constexpr uint8_t KEYFRAME = 0x40;
+static constexpr uint8_t END = 0x41;
+
+static void put_le(uint8_t *bytes, uint64_t value, int size) {
+    for (int i = 0; i < size; ++i) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *bytes, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; ++i) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+// false if the data ends within the varint or it doesn't fit 64 bits
+static bool read_varint(const uint8_t *data, size_t size, size_t &pos, uint64_t &value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < size; shift += 7) {
+        uint8_t byte = data[pos++];
+        value |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+JournalWriter::~JournalWriter() {
+    std::string error;
+    close(error);
+}
+
+bool JournalWriter::open(const char *path, const Model &model, double tick, size_t interval, std::string &error) {
+    std::string ignored;
+    close(ignored);
+
+    _file = std::fopen(path, "wb");
+    if (!_file) {
+        error = std::string(path) + ": cannot create file";
+        return false;
+    }
+
+    _path = path;
+    _interval = interval;
+    _tick = 0;
+    _last = 0;
+
+    uint64_t bits;
+    std::memcpy(&bits, &tick, sizeof(bits));
+
+    uint8_t header[HEADER_SIZE];
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    put_le(header + 8, VERSION, 4);
+    put_le(header + 12, bits, 8);
+    std::fwrite(header, 1, sizeof(header), _file);
+
+    writeKeyframe(model);
+    return true;
+}
+
+void JournalWriter::writeRecord(uint8_t kind) {
+    std::fputc(kind, _file);
+    writeVarint(_tick - _last);
+    _last = _tick;
+}
+
+void JournalWriter::writeVarint(uint64_t value) {
+    while (value >= 0x80) {
+        std::fputc((int)(value & 0x7f) | 0x80, _file);
+        value >>= 7;
+    }
+    std::fputc((int)value, _file);
+}
+
+void JournalWriter::writeKeyframe(const Model &model) {
+    std::shared_ptr<const Snapshot> snapshot = Snapshot::capture(model);
+    writeRecord(KEYFRAME);
+    writeVarint(snapshot->size());
+    std::fwrite(snapshot->data(), 1, snapshot->size(), _file);
+    std::fflush(_file);
+}
+
+void JournalWriter::record(const Command &command) {
+    if (!_file)
+        return;
+
+    writeRecord((uint8_t)command.action);
+    writeVarint((uint32_t)command.row);
+    writeVarint((uint32_t)command.col);
+    // a session that crashes keeps its last actions
+    std::fflush(_file);
+}
+
+void JournalWriter::tick(const Model &model) {
+    if (!_file)
+        return;
+
+    ++_tick;
+    if (_interval > 0 && _tick % _interval == 0)
+        writeKeyframe(model);
+}
+
+bool JournalWriter::close(std::string &error) {
+    if (!_file)
+        return true;
+
+    writeRecord(END);
+    bool written = !std::ferror(_file);
+    if (std::fclose(_file) != 0)
+        written = false;
+    _file = nullptr;
+
+    if (!written) {
+        error = _path + ": cannot write file";
+        return false;
+    }
+    return true;
+}
+
+bool Replay::load(const char *path, std::string &error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = std::string(path) + ": cannot open file";
+        return false;
+    }
+
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    if (!parse(data.data(), data.size(), error)) {
+        error = std::string(path) + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+bool Replay::parse(const uint8_t *data, size_t size, std::string &error) {
+    if (size < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        error = "not a journal";
+        return false;
+    }
+
+    uint32_t version = (uint32_t)get_le(data + 8, 4);
+    if (version != VERSION) {
+        error = "journal version " + std::to_string(version) + " is not supported";
+        return false;
+    }
+
+    uint64_t bits = get_le(data + 12, 8);
+    double tick_time;
+    std::memcpy(&tick_time, &bits, sizeof(tick_time));
+    if (!std::isfinite(tick_time) || tick_time <= 0.0) {
+        error = "corrupt journal header";
+        return false;
+    }
+
+    std::vector<RecordedAction> actions;
+    std::vector<Keyframe> keyframes;
+    size_t tick = 0;
+    size_t length = 0;
+
+    // records that are cut short end the journal
+    size_t pos = HEADER_SIZE;
+    while (pos < size) {
+        uint8_t kind = data[pos++];
+        uint64_t delta;
+        if (!read_varint(data, size, pos, delta))
+            break;
+        if (delta > (uint64_t)(SIZE_MAX - tick)) {
+            error = "corrupt journal record";
+            return false;
+        }
+        tick += (size_t)delta;
+
+        if (kind <= (uint8_t)Action::EjectWest) {
+            uint64_t row;
+            uint64_t col;
+            if (!read_varint(data, size, pos, row) || !read_varint(data, size, pos, col))
+                break;
+
+            if (keyframes.empty() || row >= (uint64_t)keyframes.front().snapshot->rows()
+                || col >= (uint64_t)keyframes.front().snapshot->cols())
+            {
+                error = "corrupt action in journal at tick " + std::to_string(tick);
+                return false;
+            }
+            actions.push_back(RecordedAction{ tick, Command{ tick * tick_time, (Action)kind, (int)row, (int)col } });
+        }
+        else if (kind == KEYFRAME) {
+            uint64_t bytes;
+            if (!read_varint(data, size, pos, bytes) || bytes > size - pos)
+                break;
+
+            std::shared_ptr<const Snapshot> snapshot = Snapshot::fromBytes(std::vector<uint8_t>(data + pos, data + pos + bytes), error);
+            if (!snapshot) {
+                error = "keyframe at tick " + std::to_string(tick) + ": " + error;
+                return false;
+            }
+            pos += (size_t)bytes;
+
+            // the session starts with a keyframe, and actions can't change
+            // the size of the board
+            if (keyframes.empty() ? tick != 0
+                : snapshot->rows() != keyframes.front().snapshot->rows() || snapshot->cols() != keyframes.front().snapshot->cols())
+            {
+                error = "corrupt keyframe in journal at tick " + std::to_string(tick);
+                return false;
+            }
+            keyframes.push_back(Keyframe{ tick, snapshot });
+        }
+        else if (kind != END) {
+            error = "corrupt journal record";
+            return false;
+        }
+        length = tick;
+    }
+
+    if (keyframes.empty()) {
+        error = "journal has no keyframe";
+        return false;
+    }
+
+    _tick_time = tick_time;
+    _length = length;
+    _actions.swap(actions);
+    _keyframes.swap(keyframes);
+    restore(_keyframes.front());
+    return true;
+}
+
+void Replay::restore(const Keyframe &keyframe) {
+    if (_model)
+        _model->restore(keyframe.snapshot);
+    else
+        _model.reset(new Model(keyframe.snapshot));
+
+    _tick = keyframe.tick;
+    _next = std::lower_bound(_actions.begin(), _actions.end(), _tick,
+        [](const RecordedAction &action, size_t tick) { return action.tick < tick; }) - _actions.begin();
+}
+
+void Replay::seek(size_t tick) {
+    tick = std::min(tick, _length);
+
+    // the first keyframe is the one of tick 0
+    auto it = std::upper_bound(_keyframes.begin(), _keyframes.end(), tick,
+        [](size_t tick, const Keyframe &keyframe) { return tick < keyframe.tick; });
+    const Keyframe &keyframe = *(it - 1);
+
+    if (tick < _tick || keyframe.tick > _tick)
+        restore(keyframe);
+    step(tick - _tick);
+}
+
+void Replay::step(size_t ticks) {
+    for (size_t n = 0; n < ticks && _tick < _length; ++n) {
+        while (_next < _actions.size() && _actions[_next].tick == _tick) {
+            apply_command(*_model, _actions[_next].command);
+            ++_next;
+        }
+
+        _model->progress(_tick_time);
+        ++_tick;
+    }
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "command.hpp"
+#include "model.hpp"
+#include "snapshot.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// A session is recorded as a journal: the board at the start, every action
+// the player took by the tick it was taken in, and a keyframe snapshot every
+// so many ticks. A tick is one Model::progress call of a fixed number of
+// milliseconds, and the actions of a tick are applied before it is
+// simulated. Tick t of a session is the state after t ticks.
+//
+// Journals are binary and little-endian. After a header of the magic
+// "MRBLJRNL", a u32 version and the f64 milliseconds per tick, records
+// follow until the end of the file:
+//
+//   u8 kind, varint ticks since the previous record, then
+//   action     kind 0-5, the Action value, and varint row, varint col
+//   keyframe   kind 0x40, varint size and a snapshot of that many bytes
+//   end        kind 0x41, the last tick of the session
+//
+// Varints are unsigned LEB128. The first record is the keyframe of tick 0.
+// A journal cut short by a crash replays up to its last complete record.
+
+// An action and the tick it was taken in.
+struct RecordedAction {
+    size_t tick;
+    Command command;
+};
+
+class JournalWriter {
+public:
+    ~JournalWriter();
+
+    // starts a journal of a session that begins with the model as it is,
+    // keyframes are written every interval ticks
+    bool open(const char *path, const Model &model, double tick, size_t interval, std::string &error);
+    bool isOpen() const { return _file != nullptr; }
+
+    // an action taken in the current tick, the command's time is ignored
+    void record(const Command &command);
+
+    // to be called after every tick the model simulated
+    void tick(const Model &model);
+
+    // ends the journal, false if anything could not be written
+    bool close(std::string &error);
+
+private:
+    void writeRecord(uint8_t kind);
+    void writeVarint(uint64_t value);
+    void writeKeyframe(const Model &model);
+
+    FILE *_file = nullptr;
+    std::string _path;
+    size_t _interval = 0;
+    size_t _tick = 0;
+    // tick of the last record written
+    size_t _last = 0;
+};
+
+// Plays a journal back on a model of its own, as fast as it simulates.
+class Replay {
+public:
+    bool load(const char *path, std::string &error);
+    bool parse(const uint8_t *data, size_t size, std::string &error);
+
+    double tickTime() const { return _tick_time; }
+    // ticks in the session
+    size_t length() const { return _length; }
+    const std::vector<RecordedAction> &actions() const { return _actions; }
+
+    // tick the model is at
+    size_t tick() const { return _tick; }
+    Model &model() { return *_model; }
+    const Model &model() const { return *_model; }
+
+    // brings the model to the given tick, starting from the nearest keyframe
+    // at or before it unless the model is already closer
+    void seek(size_t tick);
+
+    // simulates the given number of ticks with the actions recorded for
+    // them, without going past the end of the session
+    void step(size_t ticks = 1);
+
+private:
+    struct Keyframe {
+        size_t tick;
+        std::shared_ptr<const Snapshot> snapshot;
+    };
+
+    void restore(const Keyframe &keyframe);
+
+    double _tick_time = 0.0;
+    size_t _length = 0;
+    std::vector<RecordedAction> _actions;
+    std::vector<Keyframe> _keyframes;
+
+    std::unique_ptr<Model> _model;
+    size_t _tick = 0;
+    // first action at or after the current tick
+    size_t _next = 0;
+};
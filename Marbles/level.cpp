@@ -0,0 +1,465 @@
+#include "level.hpp"
+
+#include "mapped_file.hpp"
+#include "scenario.hpp"
+#include "static_level.hpp"
+#include "transitions.hpp"
+
+#include <charconv>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static constexpr char MAGIC[8] = { 'M', 'R', 'B', 'L', 'L', 'E', 'V', 'L' };
+static constexpr uint32_t VERSION = 1;
+static constexpr size_t HEADER_SIZE = 40;
+static constexpr size_t BALL_SIZE = 24;
+static constexpr uint32_t CHUNK = 64;
+
+static constexpr const char *TYPES[] = { "red", "green", "blue", "yellow" };
+static constexpr const char *DIRECTIONS[] = { "N", "E", "S", "W" };
+
+
+static void put_le(uint8_t *bytes, uint64_t value, int size) {
+    for (int i = 0; i < size; ++i) {
+        bytes[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t *bytes, int size) {
+    uint64_t value = 0;
+    for (int i = 0; i < size; ++i) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+// tiles are indexed with size_t, but a dense board takes 4 bytes for every
+// tile, so boards beyond INT_MAX tiles only fit sparse
+static bool board_fits(int64_t rows, int64_t cols, TileStorage storage) {
+    return rows > 0 && cols > 0 && (storage == TileStorage::Sparse || rows * cols <= INT_MAX);
+}
+
+// checks a ball against the board and marks the rotor position it takes
+static bool check_ball(const Ball &ball, TileGrid &tiles, std::string &error) {
+    if (ball.row < 0 || ball.row >= tiles.rows() || ball.col < 0 || ball.col >= tiles.cols()) {
+        error = "ball outside of the board";
+        return false;
+    }
+
+    if (ball.state == BallState::InsideRotor) {
+        if (static_cast<const TileGrid &>(tiles).at(ball.row, ball.col).type() != TileType::Rotor) {
+            error = "ball inside a rotor that is not there";
+            return false;
+        }
+        PackedTile &tile = tiles.at(ball.row, ball.col);
+        if (ball.rotor_position < 0 || ball.rotor_position > 3 || tile.taken(ball.rotor_position)) {
+            error = "rotor position taken twice";
+            return false;
+        }
+        tile.setTaken(ball.rotor_position, true);
+        return true;
+    }
+
+    if (ball.state < BallState::EnteringFromNorth || ball.state > BallState::ExitingTowardsWest) {
+        error = "unknown ball state";
+        return false;
+    }
+    if (!(ball.transition >= 0.0 && ball.transition < 0.5)) {
+        error = "transition has to be at least 0 and less than 0.5";
+        return false;
+    }
+    return true;
+}
+
+static void set_level(Model &model, TileGrid tiles, const Ball *balls, size_t count) {
+    model.reset(std::move(tiles));
+    for (size_t i = 0; i < count; ++i) {
+        model.addBall(balls[i]);
+    }
+}
+
+// builds the tile grid and balls of a level for parse_level_text
+struct GridBuilder {
+    explicit GridBuilder(TileStorage storage) : storage(storage) { }
+
+    TileStorage storage;
+    TileGrid tiles;
+    std::vector<Ball> balls;
+
+    LevelError board(int rows, int cols) {
+        if (!board_fits(rows, cols, storage))
+            return LevelError::LargeBoard;
+        tiles.assign(rows, cols, storage);
+        return LevelError::None;
+    }
+
+    // reading doesn't allocate chunks of sparse grids
+    TileType type(int row, int col) const { return tiles.at(row, col).type(); }
+    PackedTile &tile(int row, int col) { return tiles.at(row, col); }
+
+    bool ball(const Ball &ball) {
+        balls.push_back(ball);
+        return true;
+    }
+
+    // any number from_chars reads, such as the ones save_level_text writes
+    static bool transition(const char *text, size_t size, double &value) {
+        std::from_chars_result result = std::from_chars(text, text + size, value);
+        return result.ec == std::errc() && result.ptr == text + size;
+    }
+};
+
+static std::string level_error_message(const LevelResult &result) {
+    std::string token(result.token ? result.token : "", result.token_size);
+    switch (result.error) {
+    case LevelError::None:
+        break;
+    case LevelError::NoBoard:
+        return "expected: board <rows> <cols>";
+    case LevelError::SecondBoard:
+        return "the level already has a board";
+    case LevelError::BadBoard:
+        return "expected: board <rows> <cols>";
+    case LevelError::LargeBoard:
+        return "the board is too large";
+    case LevelError::BoardEndsEarly:
+        return "the board ends early";
+    case LevelError::LongRow:
+        return "board row is longer than the board";
+    case LevelError::UnknownTile:
+        return "unknown tile '" + token + "'";
+    case LevelError::NoRotor:
+        return "expected: rotor <row> <col> <position> of a rotor";
+    case LevelError::RotorPosition:
+        return "rotor position has to be 0 to 3";
+    case LevelError::BadBall:
+        return "expected: ball <row> <col> <type> <state> <direction or position>";
+    case LevelError::UnknownDirection:
+        return "unknown direction";
+    case LevelError::BadTransition:
+        return "transition has to be at least 0 and less than 0.5";
+    case LevelError::BallOutside:
+        return "ball outside of the board";
+    case LevelError::NoRotorForBall:
+        return "ball inside a rotor that is not there";
+    case LevelError::PositionTaken:
+        return "rotor position taken twice";
+    case LevelError::UnknownKeyword:
+        return "unknown keyword '" + token + "'";
+    }
+    return std::string();
+}
+
+bool parse_level(const char *text, size_t size, Model &model, std::string &error) {
+    LevelScanner reader(text, size);
+    GridBuilder builder{ model.storage() };
+
+    LevelResult result = parse_level_text(reader, builder);
+    if (result.error != LevelError::None) {
+        error = "line " + std::to_string(result.line) + ": " + level_error_message(result);
+        return false;
+    }
+
+    set_level(model, std::move(builder.tiles), builder.balls.data(), builder.balls.size());
+    return true;
+}
+
+bool read_level(const uint8_t *data, size_t size, Model &model, std::string &error) {
+    if (size < HEADER_SIZE || std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0) {
+        error = "not a level";
+        return false;
+    }
+
+    uint32_t version = (uint32_t)get_le(data + 8, 4);
+    if (version != VERSION) {
+        error = "level version " + std::to_string(version) + " is not supported";
+        return false;
+    }
+
+    uint32_t chunk = (uint32_t)get_le(data + 12, 4);
+    int rows = (int32_t)get_le(data + 16, 4);
+    int cols = (int32_t)get_le(data + 20, 4);
+    uint64_t ball_count = get_le(data + 24, 8);
+    uint64_t balls_at = get_le(data + 32, 8);
+    if (chunk == 0 || chunk > 4096 || !board_fits(rows, cols, model.storage())) {
+        error = "corrupt level header";
+        return false;
+    }
+
+    size_t chunk_rows = (rows + chunk - 1) / chunk;
+    size_t chunk_cols = (cols + chunk - 1) / chunk;
+    size_t chunk_size = (size_t)chunk * chunk;
+    if (chunk_rows * chunk_cols > (size - HEADER_SIZE) / 8
+        || balls_at > size || ball_count > (size - balls_at) / BALL_SIZE)
+    {
+        error = "level is cut short";
+        return false;
+    }
+
+    TileGrid tiles;
+    tiles.assign(rows, cols, model.storage());
+    const uint8_t *directory = data + HEADER_SIZE;
+    for (size_t y = 0; y < chunk_rows; ++y) {
+        for (size_t x = 0; x < chunk_cols; ++x) {
+            uint64_t offset = get_le(directory + (x + y * chunk_cols) * 8, 8);
+            if (offset == 0)
+                continue;
+            if (offset > size || chunk_size > size - offset) {
+                error = "level is cut short";
+                return false;
+            }
+
+            // checked once per chunk, so that the loops stay free of branches
+            const uint8_t *source = data + offset;
+            size_t height = std::min<size_t>(chunk, rows - y * chunk);
+            size_t width = std::min<size_t>(chunk, cols - x * chunk);
+            bool corrupt = false;
+            for (size_t r = 0; r < height; ++r) {
+                int row = (int)(y * chunk + r);
+                const uint8_t *codes = source + r * chunk;
+
+                // runs of tiles up to the next chunk of the grid are
+                // contiguous, runs of empty tiles aren't written at all
+                for (size_t c = 0; c < width;) {
+                    int col = (int)(x * chunk + c);
+                    size_t count = std::min<size_t>(width - c, TileGrid::CHUNK_SIZE - (col & (TileGrid::CHUNK_SIZE - 1)));
+                    uint8_t any = 0;
+                    for (size_t k = 0; k < count; ++k) {
+                        any |= codes[c + k];
+                    }
+                    if (any != 0) {
+                        PackedTile *target = &tiles.at(row, col);
+                        for (size_t k = 0; k < count; ++k) {
+                            corrupt |= (codes[c + k] & 0xf) > (uint8_t)TileType::Rotor || codes[c + k] > 0x3f;
+                            target[k].bits = codes[c + k];
+                        }
+                    }
+                    c += count;
+                }
+            }
+            if (corrupt) {
+                error = "corrupt tile in level";
+                return false;
+            }
+        }
+    }
+
+    std::vector<Ball> balls((size_t)ball_count);
+    for (size_t i = 0; i < balls.size(); ++i) {
+        const uint8_t *source = data + balls_at + i * BALL_SIZE;
+        uint64_t bits = get_le(source + 8, 8);
+
+        Ball &ball = balls[i];
+        ball.row = (int32_t)get_le(source, 4);
+        ball.col = (int32_t)get_le(source + 4, 4);
+        std::memcpy(&ball.transition, &bits, sizeof(bits));
+        ball.state = (BallState)source[16];
+        ball.type = (BallType)source[17];
+        ball.rotor_position = source[18];
+
+        std::string message = "unknown ball type";
+        if (ball.type > BallType::Yellow || !check_ball(ball, tiles, message)) {
+            error = "ball " + std::to_string(i) + ": " + message;
+            return false;
+        }
+    }
+
+    set_level(model, std::move(tiles), balls.data(), balls.size());
+    return true;
+}
+
+void load_level(const LevelTable &level, Model &model) {
+    TileGrid tiles;
+    if (model.storage() == TileStorage::Dense) {
+        tiles.assign(level.rows, level.cols, std::vector<PackedTile>(level.tiles, level.tiles + (size_t)level.rows * level.cols));
+    }
+    else {
+        tiles.assign(level.rows, level.cols, TileStorage::Sparse);
+        for (int r = 0; r < level.rows; ++r) {
+            for (int c = 0; c < level.cols; ++c) {
+                const PackedTile &tile = level.tiles[c + (size_t)r * level.cols];
+                if (tile.bits != 0)
+                    tiles.at(r, c) = tile;
+            }
+        }
+    }
+    set_level(model, std::move(tiles), level.balls, level.ball_count);
+}
+
+bool load_level(const char *path, Model &model, std::string &error) {
+    MappedFile file;
+    if (!file.open(path, error))
+        return false;
+
+    bool loaded = file.size() >= sizeof(MAGIC) && std::memcmp(file.data(), MAGIC, sizeof(MAGIC)) == 0
+        ? read_level(file.data(), file.size(), model, error)
+        : parse_level((const char *)file.data(), file.size(), model, error);
+
+    if (!loaded)
+        error = std::string(path) + ": " + error;
+    return loaded;
+}
+
+// a tile as stored in chunks
+static uint8_t tile_code(const PackedTile &tile) {
+    if (tile.type() == TileType::Rotor)
+        return (uint8_t)(tile.bits & 0x3f);
+    return (uint8_t)tile.type();
+}
+
+static std::vector<Ball> level_balls(const Model &model) {
+    std::vector<Ball> balls;
+    for (size_t i = 0; i < model.ballCount(); ++i) {
+        Ball ball = model.ball(i);
+        if (ball.row >= 0 && ball.row < model.rows() && ball.col >= 0 && ball.col < model.cols())
+            balls.push_back(ball);
+    }
+    return balls;
+}
+
+static bool close_file(FILE *file, const char *path, std::string &error) {
+    bool written = !std::ferror(file);
+    if (std::fclose(file) != 0)
+        written = false;
+
+    if (!written) {
+        error = std::string(path) + ": cannot write file";
+        return false;
+    }
+    return true;
+}
+
+bool save_level(const char *path, const Model &model, std::string &error) {
+    FILE *file = std::fopen(path, "wb");
+    if (!file) {
+        error = std::string(path) + ": cannot create file";
+        return false;
+    }
+
+    const TileGrid &tiles = model.packedTiles();
+    int rows = model.rows();
+    int cols = model.cols();
+    size_t chunk_rows = (rows + CHUNK - 1) / CHUNK;
+    size_t chunk_cols = (cols + CHUNK - 1) / CHUNK;
+    size_t chunk_size = (size_t)CHUNK * CHUNK;
+
+    // only the tiles there are are visited, which skips the unallocated
+    // chunks of sparse boards
+    std::vector<bool> used(chunk_rows * chunk_cols);
+    tiles.forEachTile([&](int row, int col, const PackedTile &tile) {
+        if (tile.type() != TileType::Empty)
+            used[col / CHUNK + row / CHUNK * chunk_cols] = true;
+    });
+
+    // chunks are laid out in the order of the directory, empty ones are left out
+    std::vector<uint8_t> directory(chunk_rows * chunk_cols * 8);
+    uint64_t offset = HEADER_SIZE + directory.size();
+    for (size_t y = 0; y < chunk_rows; ++y) {
+        for (size_t x = 0; x < chunk_cols; ++x) {
+            if (used[x + y * chunk_cols]) {
+                put_le(&directory[(x + y * chunk_cols) * 8], offset, 8);
+                offset += chunk_size;
+            }
+        }
+    }
+
+    std::vector<Ball> balls = level_balls(model);
+    uint8_t header[HEADER_SIZE];
+    std::memcpy(header, MAGIC, sizeof(MAGIC));
+    put_le(header + 8, VERSION, 4);
+    put_le(header + 12, CHUNK, 4);
+    put_le(header + 16, (uint32_t)rows, 4);
+    put_le(header + 20, (uint32_t)cols, 4);
+    put_le(header + 24, balls.size(), 8);
+    put_le(header + 32, offset, 8);
+    std::fwrite(header, 1, sizeof(header), file);
+    std::fwrite(directory.data(), 1, directory.size(), file);
+
+    std::vector<uint8_t> chunk(chunk_size);
+    for (size_t y = 0; y < chunk_rows; ++y) {
+        for (size_t x = 0; x < chunk_cols; ++x) {
+            if (get_le(&directory[(x + y * chunk_cols) * 8], 8) == 0)
+                continue;
+
+            std::fill(chunk.begin(), chunk.end(), 0);
+            for (size_t r = 0; r < CHUNK && y * CHUNK + r < (size_t)rows; ++r) {
+                for (size_t c = 0; c < CHUNK && x * CHUNK + c < (size_t)cols; ++c) {
+                    chunk[r * CHUNK + c] = tile_code(tiles.at((int)(y * CHUNK + r), (int)(x * CHUNK + c)));
+                }
+            }
+            std::fwrite(chunk.data(), 1, chunk.size(), file);
+        }
+    }
+
+    for (const auto &ball : balls) {
+        uint64_t bits;
+        std::memcpy(&bits, &ball.transition, sizeof(bits));
+
+        uint8_t record[BALL_SIZE] = {};
+        put_le(record, (uint32_t)ball.row, 4);
+        put_le(record + 4, (uint32_t)ball.col, 4);
+        put_le(record + 8, bits, 8);
+        record[16] = (uint8_t)ball.state;
+        record[17] = (uint8_t)ball.type;
+        record[18] = (uint8_t)ball.rotor_position;
+        std::fwrite(record, 1, sizeof(record), file);
+    }
+
+    return close_file(file, path, error);
+}
+
+bool save_level_text(const char *path, const Model &model, std::string &error) {
+    FILE *file = std::fopen(path, "w");
+    if (!file) {
+        error = std::string(path) + ": cannot create file";
+        return false;
+    }
+
+    const TileGrid &tiles = model.packedTiles();
+    int rows = model.rows();
+    int cols = model.cols();
+
+    std::fprintf(file, "board %d %d\n", rows, cols);
+    std::vector<char> line((size_t)cols + 1);
+    for (int r = 0; r < rows; ++r) {
+        // rows end with their last tile
+        size_t length = 0;
+        for (int c = 0; c < cols; ++c) {
+            TileType type = tiles.at(r, c).type();
+            line[c] = tile_symbol(type);
+            if (type != TileType::Empty)
+                length = c + 1;
+        }
+        line[length] = '\n';
+        std::fwrite(line.data(), 1, length + 1, file);
+    }
+
+    for (int r = 0; r < rows; ++r) {
+        for (int c = 0; c < cols; ++c) {
+            const PackedTile &tile = tiles.at(r, c);
+            if (tile.type() == TileType::Rotor && tile.position() != 0)
+                std::fprintf(file, "rotor %d %d %d\n", r, c, tile.position());
+        }
+    }
+
+    for (const auto &ball : level_balls(model)) {
+        int state = (int)ball.state;
+        std::fprintf(file, "ball %d %d %s ", ball.row, ball.col, TYPES[(int)ball.type]);
+        if (ball.state == BallState::InsideRotor) {
+            std::fprintf(file, "inside %d\n", ball.rotor_position);
+            continue;
+        }
+
+        bool entering = state <= (int)BallState::EnteringFromWest;
+        int direction = state - (int)(entering ? BallState::EnteringFromNorth : BallState::ExitingTowardsNorth);
+        std::fprintf(file, "%s %s", entering ? "entering" : "exiting", DIRECTIONS[direction]);
+        if (ball.transition != 0.0)
+            std::fprintf(file, " %.17g", ball.transition);
+        std::fputc('\n', file);
+    }
+
+    return close_file(file, path, error);
+}
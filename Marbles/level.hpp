@@ -0,0 +1,70 @@
+#pragma once
+
+#include "model.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// A level is a board of any size, the positions of its rotors and the balls
+// it starts with. Levels are written by hand as text:
+//
+//   # two loops and a rotor
+//   board 3 8
+//   r-7  o-o
+//   L-J  | |
+//        o-o
+//   rotor 0 5 1
+//   ball 0 0 green exiting E
+//   ball 0 5 red inside 0
+//
+// The board lines use the symbols of the scenario format, rows that end
+// early are empty from there on. "rotor <row> <col> <position>" turns a rotor
+// of the board, rotors start out in position 0. Ball lines are the ones of
+// scenarios.
+//
+// Large boards are stored in a binary form that is read in place from the
+// mapped file. All numbers are little-endian:
+//
+//   header     magic "MRBLLEVL", u32 version, u32 chunk size, i32 rows,
+//              i32 cols, u64 balls, u64 offset of the balls from the start
+//              of the file
+//   directory  u64 offset from the start of the file per chunk, row by row
+//              of chunks, 0 for chunks without any tiles
+//   chunks     chunk size * chunk size u8 tiles, row by row, with the type
+//              in bits 0-3 and the rotor position in bits 4-5. tiles beyond
+//              the edge of the board are empty.
+//   balls      i32 row, i32 col, f64 transition, u8 state, u8 type, u8 rotor
+//              position and 5 zero bytes per ball
+//
+// Empty chunks cost 8 bytes, so mostly empty worlds stay small on disk.
+
+// loads a level in either form into the model, returns false and a message
+// if it can't, in which case the model is left as it was
+bool load_level(const char *path, Model &model, std::string &error);
+
+// the text form, errors come with their line number
+bool parse_level(const char *text, size_t size, Model &model, std::string &error);
+
+// the binary form
+bool read_level(const uint8_t *data, size_t size, Model &model, std::string &error);
+
+// A level that is parsed already, such as the ones of static_level.hpp. Tiles
+// hold their type and rotor position, balls are known to fit the board.
+struct LevelTable {
+    int rows;
+    int cols;
+    // rows * cols tiles, row by row
+    const PackedTile *tiles;
+    const Ball *balls;
+    size_t ball_count;
+};
+
+// copies the level into the model, dense boards with a single copy of the
+// tiles
+void load_level(const LevelTable &level, Model &model);
+
+// write the board, rotor positions and balls of the model as a level. balls
+// that left the board are left out, turning rotors are saved at rest.
+bool save_level(const char *path, const Model &model, std::string &error);
+bool save_level_text(const char *path, const Model &model, std::string &error);
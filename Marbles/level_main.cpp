@@ -0,0 +1,66 @@
+#include "level.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+static void usage(const char *name) {
+    std::fprintf(stderr,
+        "usage: %s [--text] [--sparse] LEVEL [OUT]\n"
+        "  --text    write OUT in the text form rather than the binary one\n"
+        "  --sparse  keep the board in chunks that are only allocated where\n"
+        "            there are tiles\n"
+        "loads a level in either form, prints its size, the memory its tiles take\n"
+        "and how long loading took, and writes it to OUT if given\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    bool text = false;
+    TileStorage storage = TileStorage::Dense;
+    const char *paths[2] = {};
+    int count = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--text") == 0) {
+            text = true;
+        }
+        else if (std::strcmp(argv[i], "--sparse") == 0) {
+            storage = TileStorage::Sparse;
+        }
+        else if (argv[i][0] == '-' || count == 2) {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            paths[count++] = argv[i];
+        }
+    }
+
+    if (count == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    Model model(1, 1, storage);
+    std::string error;
+    auto start = std::chrono::steady_clock::now();
+    if (!load_level(paths[0], model, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::printf("%d x %d tiles, %zu balls, %.1f MB of tiles, loaded in %.3f s\n", model.rows(), model.cols(),
+        model.ballCount(), model.packedTiles().bytes() / 1e6, seconds);
+
+    if (paths[1]) {
+        bool saved = text ? save_level_text(paths[1], model, error) : save_level(paths[1], model, error);
+        if (!saved) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -1,121 +1,176 @@
+#include "allegro_canvas.hpp"
+#include "journal.hpp"
+#include "level.hpp"
 #include "model.hpp"
+#include "profile.hpp"
+#include "simulation.hpp"
+#include "static_level.hpp"
 #include "view.hpp"
 
 #include <allegro5/allegro5.h>
 #include <allegro5/allegro_font.h>
 #include <allegro5/allegro_primitives.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
 static constexpr double GRID_OFFSET_X = 40;
 static constexpr double GRID_OFFSET_Y = 75;
 static constexpr double TILE_SIZE = 90;
-
-static constexpr int ROWS = 5;
-static constexpr int COLS = 8;
-
-void map1(Model &model) {
-    model.tile(0, 0) = Tile{ TileType::CornerSouthEast };
-    model.tile(1, 0) = Tile{ TileType::CornerNorthEast };
-    model.tile(0, 1) = Tile{ TileType::Horizontal };
-    model.tile(1, 1) = Tile{ TileType::Horizontal };
-    model.tile(0, 2) = Tile{ TileType::CornerSouthWest };
-    model.tile(1, 2) = Tile{ TileType::CornerNorthWest };
-
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsEast, BallType::Green, 0, 0, 0 });
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsSouth, BallType::Red, 0, 0, 2 });
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsWest, BallType::Yellow, 0, 1, 2 });
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsNorth, BallType::Blue, 0, 1, 0 });
-
-    model.tile(2, 0) = Tile{ TileType::CornerSouthEast };
-    model.tile(2, 1) = Tile{ TileType::CornerSouthWest };
-    model.tile(3, 0) = Tile{ TileType::Vertical };
-    model.tile(3, 1) = Tile{ TileType::Vertical };
-    model.tile(4, 0) = Tile{ TileType::CornerNorthEast };
-    model.tile(4, 1) = Tile{ TileType::CornerNorthWest };
-
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsSouth, BallType::Green, 0, 2, 0 });
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsWest, BallType::Red, 0, 2, 1 });
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsNorth, BallType::Yellow, 0, 4, 1 });
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsEast, BallType::Blue, 0, 4, 0 });
-
-    model.tile(2, 5) = Tile{ TileType::Crossing };
-    model.tile(1, 5) = Tile{ TileType::CornerSouthEast };
-    model.tile(1, 6) = Tile{ TileType::CornerSouthWest };
-    model.tile(2, 6) = Tile{ TileType::CornerNorthWest };
-    model.tile(2, 4) = Tile{ TileType::CornerSouthEast };
-    model.tile(3, 4) = Tile{ TileType::CornerNorthEast };
-    model.tile(3, 5) = Tile{ TileType::CornerNorthWest };
-
-    model.balls().emplace_back(Ball{ BallState::ExitingTowardsSouth, BallType::Red, 0, 2, 5 });
-
-    model.tile(1, 3) = Tile{ TileType::Rotor };
-    model.tile(1, 3).rotor.state = RotorState::Resting;
-    model.tile(1, 3).rotor.position = 0;
-
-    model.tile(2, 3) = Tile{ TileType::Rotor };
-    model.tile(2, 3).rotor.state = RotorState::Resting;
-    model.tile(2, 3).rotor.position = 0;
-
-    model.tile(3, 3) = Tile{ TileType::Rotor };
-    model.tile(3, 3).rotor.state = RotorState::Resting;
-    model.tile(3, 3).rotor.position = 0;
-
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Red, 0, 1, 3, 0 });
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Green, 0, 1, 3, 1 });
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Blue, 0, 1, 3, 2 });
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Yellow, 0, 1, 3, 3 });
-}
-
-void map(Model &model, const char *descr) {
-    for (int r = 0; r < ROWS; ++r) {
-        for (int c = 0; c < COLS; ++c) {
-            char symbol = descr[c + r * COLS];
-            switch (symbol) {
-            case 'o':
-                model.tile(r, c).type = TileType::Rotor;
-                model.tile(r, c).rotor.state = RotorState::Resting;
-                model.tile(r, c).rotor.position = 0;
-                break;
-            case '-':
-                model.tile(r, c).type = TileType::Horizontal;
-                break;
-            case '|':
-                model.tile(r, c).type = TileType::Vertical;
-                break;
-            default:
-                model.tile(r, c).type = TileType::Empty;
-                break;
-            }
+// pixels the arrow keys move the board by
+static constexpr double PAN_STEP = 40;
+// zoom of a notch of the mouse wheel or a press of + or -
+static constexpr double ZOOM_STEP = 1.25;
+
+static constexpr double TICK = 1000.0 / 60.0;
+// frames per second where the display doesn't say
+static constexpr int DEFAULT_REFRESH_RATE = 60;
+// a keyframe every 10 seconds
+static constexpr size_t KEYFRAME_TICKS = 600;
+// minutes of rewinding on small boards
+static constexpr size_t HISTORY_BYTES = 4 << 20;
+// seconds between updates of the timings the overlay shows
+static constexpr double OVERLAY_PERIOD = 1.0;
+
+// the board of the game unless it is given a level
+static constexpr char DEFAULT_LEVEL[] =
+    "board 5 8\n"
+    "o-o  o-o\n"
+    "| |  | |\n"
+    "o-o  o-o\n"
+    "| |  | |\n"
+    "o-o  o-o\n"
+    "ball 0 0 red inside 0\n"
+    "ball 0 0 green inside 1\n"
+    "ball 0 0 blue inside 2\n"
+    "ball 0 0 yellow inside 3\n";
+
+MARBLES_LEVEL(DEFAULT_TABLE, DEFAULT_LEVEL);
+
+// what the profiler measured since the totals before, per second
+static std::vector<std::string> profile_rates(std::vector<Profiler::Total> &before, uint64_t *counts_before, double seconds) {
+    std::vector<std::string> lines;
+    std::vector<Profiler::Total> totals = Profiler::totals();
+    for (const Profiler::Total &total : totals) {
+        double microseconds = total.microseconds;
+        for (const Profiler::Total &old : before) {
+            if (std::strcmp(old.name, total.name) == 0)
+                microseconds -= old.microseconds;
         }
+        char line[128];
+        std::snprintf(line, sizeof(line), "%-16s %7.2f ms/s", total.name, microseconds / 1000.0 / seconds);
+        lines.push_back(line);
+    }
+    before = totals;
+
+    for (int c = 0; c < (int)Counter::Count; ++c) {
+        uint64_t count = Profiler::counterTotal((Counter)c);
+        char line[128];
+        std::snprintf(line, sizeof(line), "%-16s %9.0f /s", counter_name((Counter)c), (count - counts_before[c]) / seconds);
+        lines.push_back(line);
+        counts_before[c] = count;
     }
+    return lines;
 }
 
-void map2(Model &model) {
-    const char *descr =
-        "o-o  o-o"
-        "| |  | |"
-        "o-o  o-o"
-        "| |  | |"
-        "o-o  o-o"
-        ;
-    map(model, descr);
-
-
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Red, 0, 0, 0, 0 });
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Green, 0, 0, 0, 1 });
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Blue, 0, 0, 0, 2 });
-    model.balls().emplace_back(Ball{ BallState::InsideRotor, BallType::Yellow, 0, 0, 0, 3 });
+// the frame times as a histogram in the top left corner, and the lines of
+// profile_rates below it
+static void draw_overlay(const ALLEGRO_FONT *font, const FrameHistogram &histogram, const std::vector<std::string> &lines) {
+    static constexpr float X = 10;
+    static constexpr float Y = 10;
+    static constexpr float BAR_WIDTH = 12;
+    static constexpr float BARS_HEIGHT = 60;
+
+    float line_height = (float)al_get_font_line_height(font) + 2;
+    float width = FrameHistogram::BUCKETS * BAR_WIDTH + 16;
+    for (const std::string &line : lines) {
+        width = std::max(width, line.size() * 8.0f + 16);
+    }
+    float height = 3 * line_height + BARS_HEIGHT + lines.size() * line_height + 16;
+    al_draw_filled_rectangle(X, Y, X + width, Y + height, al_map_rgba(0, 0, 0, 192));
+
+    ALLEGRO_COLOR text = al_map_rgb(0xdd, 0xdd, 0xdd);
+    float y = Y + 8;
+    al_draw_textf(font, text, X + 8, y, ALLEGRO_ALIGN_LEFT, "frame %.1f ms, worst %.1f ms",
+        histogram.average(), histogram.worst());
+    y += line_height;
+
+    // bars as high as the share of the frames in their bucket
+    float base = y + BARS_HEIGHT;
+    for (int k = 0; k < FrameHistogram::BUCKETS; ++k) {
+        if (histogram.frames() == 0)
+            break;
+        float bar = BARS_HEIGHT * histogram.count(k) / histogram.frames();
+        float left = X + 8 + k * BAR_WIDTH;
+        ALLEGRO_COLOR color = k * FrameHistogram::BUCKET_MS < 1000.0 / DEFAULT_REFRESH_RATE
+            ? al_map_rgb(0x40, 0xc0, 0x40) : al_map_rgb(0xe0, 0x50, 0x40);
+        al_draw_filled_rectangle(left, base - bar, left + BAR_WIDTH - 2, base, color);
+    }
+    y = base + 4;
+    al_draw_textf(font, text, X + 8, y, ALLEGRO_ALIGN_LEFT, "0");
+    al_draw_textf(font, text, X + 8 + FrameHistogram::BUCKETS * BAR_WIDTH, y, ALLEGRO_ALIGN_RIGHT, "%.0f+ ms",
+        (FrameHistogram::BUCKETS - 1) * FrameHistogram::BUCKET_MS);
+    y += 2 * line_height;
+
+    for (const std::string &line : lines) {
+        al_draw_text(font, text, X + 8, y, ALLEGRO_ALIGN_LEFT, line.c_str());
+        y += line_height;
+    }
 }
 
-int main()
+int main(int argc, char **argv)
 {
+    const char *journal_path = nullptr;
+    const char *level_path = nullptr;
+    const char *trace_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            journal_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else if (argv[i][0] != '-' && !level_path) {
+            level_path = argv[i];
+        }
+        else {
+            std::fprintf(stderr, "usage: %s [--record JOURNAL] [--trace FILE] [LEVEL]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (trace_path && !Profiler::ENABLED)
+        std::fprintf(stderr, "--trace needs a build with MARBLES_PROFILE\n");
+    PROFILE_THREAD("main");
+
+    Model model(1, 1);
+    std::string error;
+    if (!level_path) {
+        load_level(DEFAULT_TABLE.table(), model);
+    }
+    else if (!load_level(level_path, model, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
     al_init();
     al_install_keyboard();
     al_install_mouse();
     al_init_primitives_addon();
+    al_init_font_addon();
 
-    ALLEGRO_TIMER *timer = al_create_timer(1.0 / 60.0);
     ALLEGRO_EVENT_QUEUE *queue = al_create_event_queue();
     ALLEGRO_DISPLAY *disp = al_create_display(800, 600);
+    // a frame per refresh of the display, the simulation keeps its own time
+    int refresh_rate = al_get_display_refresh_rate(disp);
+    if (refresh_rate <= 0)
+        refresh_rate = DEFAULT_REFRESH_RATE;
+    ALLEGRO_TIMER *timer = al_create_timer(1.0 / refresh_rate);
     ALLEGRO_FONT *font = al_create_builtin_font();
 
     al_register_event_source(queue, al_get_keyboard_event_source());
@@ -126,10 +181,36 @@ int main()
     bool redraw = true;
     ALLEGRO_EVENT event;
 
-    Model model(ROWS, COLS);
-    map2(model);
+    JournalWriter journal;
+    if (journal_path && !journal.open(journal_path, model, TICK, KEYFRAME_TICKS, error))
+        std::fprintf(stderr, "%s\n", error.c_str());
+
+    // a journal only goes forward, so sessions that are recorded can't be
+    // rewound
+    if (!journal.isOpen())
+        model.setHistory(HISTORY_BYTES);
+
+    // from here on the model belongs to the simulation thread, the board is
+    // drawn and clicked on as of the frames it publishes
+    Simulation simulation(model, TICK, journal);
+    FramePair frames;
+    simulation.start();
 
+    // has to go before the primitives addon does
+    std::unique_ptr<AllegroCanvas> canvas(new AllegroCanvas);
     View view(GRID_OFFSET_X, GRID_OFFSET_Y, TILE_SIZE);
+    // the board follows the mouse while the middle button is held
+    bool panning = false;
+
+    // F3 shows how long frames take, and where the time goes in builds that
+    // profile
+    bool overlay = false;
+    FrameHistogram histogram;
+    double last_flip = al_get_time();
+    std::vector<std::string> rates;
+    std::vector<Profiler::Total> totals_before;
+    uint64_t counts_before[(int)Counter::Count] = {};
+    double rates_time = last_flip;
 
     al_start_timer(timer);
     while (1)
@@ -138,7 +219,7 @@ int main()
 
         if (event.type == ALLEGRO_EVENT_TIMER)
         {
-            model.progress(1000.0 / 60.0);
+            frames.update(simulation);
             redraw = true;
         }
         else if (event.type == ALLEGRO_EVENT_DISPLAY_CLOSE)
@@ -149,59 +230,147 @@ int main()
             if (event.keyboard.keycode == ALLEGRO_KEY_ENTER) {
                 break;
             }
+            // time runs backwards while backspace is held
+            if (event.keyboard.keycode == ALLEGRO_KEY_BACKSPACE) {
+                simulation.setRewinding(true);
+            }
+
+            double center_x = al_get_display_width(disp) / 2.0;
+            double center_y = al_get_display_height(disp) / 2.0;
+            switch (event.keyboard.keycode) {
+            case ALLEGRO_KEY_LEFT:
+                view.pan(PAN_STEP, 0);
+                break;
+            case ALLEGRO_KEY_RIGHT:
+                view.pan(-PAN_STEP, 0);
+                break;
+            case ALLEGRO_KEY_UP:
+                view.pan(0, PAN_STEP);
+                break;
+            case ALLEGRO_KEY_DOWN:
+                view.pan(0, -PAN_STEP);
+                break;
+            case ALLEGRO_KEY_EQUALS:
+                view.zoom(ZOOM_STEP, center_x, center_y);
+                break;
+            case ALLEGRO_KEY_MINUS:
+                view.zoom(1.0 / ZOOM_STEP, center_x, center_y);
+                break;
+            case ALLEGRO_KEY_HOME:
+                view.setCamera(GRID_OFFSET_X, GRID_OFFSET_Y, TILE_SIZE);
+                break;
+            case ALLEGRO_KEY_F3:
+                overlay = !overlay;
+                break;
+            }
+            redraw = true;
+        }
+        else if (event.type == ALLEGRO_EVENT_KEY_UP) {
+            if (event.keyboard.keycode == ALLEGRO_KEY_BACKSPACE) {
+                simulation.setRewinding(false);
+            }
+        }
+        else if (event.type == ALLEGRO_EVENT_MOUSE_AXES) {
+            if (event.mouse.dz != 0)
+                view.zoom(std::pow(ZOOM_STEP, event.mouse.dz), event.mouse.x, event.mouse.y);
+            if (panning)
+                view.pan(event.mouse.dx, event.mouse.dy);
+            if (event.mouse.dz != 0 || panning)
+                redraw = true;
+        }
+        else if (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_UP) {
+            if (event.mouse.button == 3)
+                panning = false;
         }
         else if (event.type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN) {
             int button = event.mouse.button;
-            int x = event.mouse.x;
-            int y = event.mouse.y;
+            if (button == 3)
+                panning = true;
 
-            int col = (int)(((double)x - GRID_OFFSET_X) / TILE_SIZE);
-            int row = (int)(((double)y - GRID_OFFSET_Y) / TILE_SIZE);
+            double col_f, row_f;
+            view.toBoard(event.mouse.x, event.mouse.y, col_f, row_f);
+            int col = (int)std::floor(col_f);
+            int row = (int)std::floor(row_f);
 
-            if (row >= 0 && row < ROWS && col >= 0 && col < COLS) {
-                if (model.tile(row, col).type == TileType::Rotor) {
+            const Model &shown = frames.current();
+            if (row >= 0 && row < shown.rows() && col >= 0 && col < shown.cols()) {
+                if (shown.tile(row, col).type == TileType::Rotor) {
                     // coordinates relative to tile center, from -1 to 1
-                    double rel_x = ((double)x - GRID_OFFSET_X - col * TILE_SIZE) / TILE_SIZE * 2 - 1;
-                    double rel_y = ((double)y - GRID_OFFSET_Y - row * TILE_SIZE) / TILE_SIZE * 2 - 1;
+                    double rel_x = (col_f - col) * 2 - 1;
+                    double rel_y = (row_f - row) * 2 - 1;
+
+                    Command command{ shown.now(), Action::TurnClockwise, row, col };
+                    bool act = true;
 
                     if (rel_x * rel_x + rel_y * rel_y <= 0.3 * 0.3) {
                         if (button == 1)
-                            model.turnCounterClockwise(row, col);
+                            command.action = Action::TurnCounterClockwise;
                         else if (button == 2)
-                            model.turnClockwise(row, col);
+                            command.action = Action::TurnClockwise;
+                        else
+                            act = false;
+                    }
+                    else if (button != 1 && button != 2) {
+                        act = false;
                     }
                     else if (rel_x * rel_x + (rel_y + 0.5) * (rel_y + 0.5) <= 0.3 * 0.3) {
-                        if (button == 1 || button == 2)
-                            model.ejectNorth(row, col);
+                        command.action = Action::EjectNorth;
                     }
                     else if ((rel_x - 0.5) * (rel_x - 0.5) + rel_y * rel_y <= 0.3 * 0.3) {
-                        if (button == 1 || button == 2)
-                            model.ejectEast(row, col);
+                        command.action = Action::EjectEast;
                     }
                     else if (rel_x * rel_x + (rel_y - 0.5) * (rel_y - 0.5) <= 0.3 * 0.3) {
-                        if (button == 1 || button == 2)
-                            model.ejectSouth(row, col);
+                        command.action = Action::EjectSouth;
                     }
                     else if ((rel_x + 0.5) * (rel_x + 0.5) + rel_y * rel_y <= 0.3 * 0.3) {
-                        if (button == 1 || button == 2)
-                            model.ejectWest(row, col);
+                        command.action = Action::EjectWest;
+                    }
+                    else {
+                        act = false;
                     }
+
+                    // the simulation records every action in the journal,
+                    // so that the session can be replayed
+                    if (act)
+                        simulation.send(command);
                 }
             }
         }
 
         if (redraw && al_is_event_queue_empty(queue))
         {
-            al_clear_to_color(al_map_rgb(0, 0, 0));
-            
-            view.draw(model);
+            {
+                PROFILE_SCOPE("draw");
+                al_clear_to_color(al_map_rgb(0, 0, 0));
+
+                view.draw(*canvas, frames.previous(), frames.current(), frames.alpha(Simulation::clock(), TICK), frames.board());
+                if (overlay)
+                    draw_overlay(font, histogram, rates);
+            }
+            {
+                PROFILE_SCOPE("flip");
+                al_flip_display();
+            }
 
-            al_flip_display();
+            double now = al_get_time();
+            histogram.add((now - last_flip) * 1000.0);
+            last_flip = now;
+            if (Profiler::ENABLED && now - rates_time >= OVERLAY_PERIOD) {
+                rates = profile_rates(totals_before, counts_before, now - rates_time);
+                rates_time = now;
+            }
 
             redraw = false;
         }
     }
 
+    simulation.stop();
+    if (!journal.close(error))
+        std::fprintf(stderr, "%s\n", error.c_str());
+    if (trace_path && Profiler::ENABLED && !Profiler::writeTrace(trace_path, error))
+        std::fprintf(stderr, "%s\n", error.c_str());
+
+    canvas.reset();
     al_shutdown_primitives_addon();
 
     al_destroy_font(font);
@@ -0,0 +1,104 @@
+#include "mapped_file.hpp"
+
+#include <fstream>
+#include <iterator>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_WIN32)
+
+static void *map_file(const char *path, size_t &size) {
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr;
+
+    void *view = nullptr;
+    LARGE_INTEGER length;
+    if (GetFileSizeEx(file, &length) && length.QuadPart > 0 && (uint64_t)length.QuadPart <= SIZE_MAX) {
+        // the view keeps the mapping alive after its handle is closed
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+        }
+        size = (size_t)length.QuadPart;
+    }
+    CloseHandle(file);
+    return view;
+}
+
+static void unmap_file(void *view, size_t) {
+    UnmapViewOfFile(view);
+}
+
+#else
+
+static void *map_file(const char *path, size_t &size) {
+    int file = ::open(path, O_RDONLY);
+    if (file < 0)
+        return nullptr;
+
+    void *view = nullptr;
+    struct stat info;
+    if (fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        size = (size_t)info.st_size;
+        view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (view == MAP_FAILED)
+            view = nullptr;
+    }
+    ::close(file);
+    return view;
+}
+
+static void unmap_file(void *view, size_t size) {
+    munmap(view, size);
+}
+
+#endif
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const char *path, std::string &error) {
+    close();
+
+    size_t size = 0;
+    if (void *view = map_file(path, size)) {
+        _mapping = view;
+        _data = (const uint8_t *)view;
+        _size = size;
+        return true;
+    }
+
+    // empty files, pipes and the like
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = std::string(path) + ": cannot open file";
+        return false;
+    }
+
+    _bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    _data = _bytes.data();
+    _size = _bytes.size();
+    return true;
+}
+
+void MappedFile::close() {
+    if (_mapping)
+        unmap_file(_mapping, _size);
+
+    _mapping = nullptr;
+    _bytes.clear();
+    _data = nullptr;
+    _size = 0;
+}
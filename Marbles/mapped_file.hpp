@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Contents of a file, mapped into memory where the system allows it and read
+// into memory otherwise.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool open(const char *path, std::string &error);
+    void close();
+
+    const uint8_t *data() const { return _data; }
+    size_t size() const { return _size; }
+
+private:
+    const uint8_t *_data = nullptr;
+    size_t _size = 0;
+    std::vector<uint8_t> _bytes;
+    // mapped view of _size bytes, if any
+    void *_mapping = nullptr;
+};
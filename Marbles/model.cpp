@@ -1,346 +1,1176 @@
 #include "model.hpp"
 
-Model::Model(int rows, int cols) :
+#include "hash.hpp"
+#include "profile.hpp"
+#include "snapshot.hpp"
+#include "transitions.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// empty tiles don't add to the hash, so that an empty board hashes to 0
+static uint64_t tile_key(size_t index, const PackedTile &tile) {
+    if (tile.type() == TileType::Empty)
+        return 0;
+
+    uint64_t features = (uint64_t)tile.type();
+    if (tile.type() == TileType::Rotor)
+        features |= (uint64_t)tile.position() << 4 | (uint64_t)tile.state() << 6;
+    return mix_hash((uint64_t)index << 8 | features);
+}
+
+static uint64_t ball_key(const Ball &ball) {
+    uint64_t features = (uint64_t)ball.type | (uint64_t)ball.state << 2;
+    if (ball.state == BallState::InsideRotor)
+        features |= (uint64_t)ball.rotor_position << 6;
+
+    uint64_t where = (uint64_t)(uint32_t)ball.row << 32 | (uint32_t)ball.col;
+    return mix_hash(mix_hash(where) ^ features);
+}
+
+// a ball on plain track counts by the first node of its segment, which is
+// the same no matter where the ball got onto the segment. the top bit keeps
+// these keys apart from those of balls on tiles.
+static uint64_t segment_ball_key(const Segment &segment, BallType type) {
+    const TrackNode &start = segment.nodes.front();
+    uint64_t where = (uint64_t)start.index << 2 | (uint64_t)start.direction;
+    return mix_hash(mix_hash(where | 1ull << 63) ^ (uint64_t)type);
+}
+
+// undo records end with their kind, so that the records of a history entry
+// can be read from its end
+enum class Undo : uint8_t {
+    // _now, _hash and _limits_dirty from before the entry
+    State,
+    // index and every field of a ball
+    Ball,
+    // index and bits of a tile
+    Tile,
+    // index and transition of every turning rotor, and their count
+    Turning,
+    // index and transition of a ball that the step of the next Advance
+    // record can't be taken back from exactly
+    Transition,
+    // step by which all balls that were not at rest moved
+    Advance,
+};
+
+template <typename T>
+static void put(std::vector<uint8_t> &log, T value) {
+    size_t size = log.size();
+    log.resize(size + sizeof(T));
+    std::memcpy(&log[size], &value, sizeof(T));
+}
+
+template <typename T>
+static T take(const uint8_t *&end) {
+    T value;
+    end -= sizeof(T);
+    std::memcpy(&value, end, sizeof(T));
+    return value;
+}
+
+const PackedTile TileGrid::EMPTY{};
+
+size_t TileGrid::bytes() const {
+    if (!_sparse)
+        return _owned.capacity() * sizeof(PackedTile);
+
+    return _directory.capacity() * sizeof(uint32_t) + _chunks.capacity() * sizeof(PackedTile *)
+        + _slabs.size() * SLAB_CHUNKS * CHUNK_SIZE * CHUNK_SIZE * sizeof(PackedTile);
+}
+
+void TileGrid::assign(int rows, int cols, TileStorage storage) {
+    _rows = rows;
+    _cols = cols;
+    _sparse = storage == TileStorage::Sparse;
+    _shared.reset();
+
+    if (!_sparse) {
+        _owned.assign(size(), PackedTile{});
+        _data = _owned.data();
+        return;
+    }
+
+    // a dense board before this one isn't needed anymore
+    std::vector<PackedTile>().swap(_owned);
+    _data = nullptr;
+
+    _chunk_cols = (cols + CHUNK_SIZE - 1) >> CHUNK_BITS;
+    _directory.assign((size_t)((rows + CHUNK_SIZE - 1) >> CHUNK_BITS) * _chunk_cols, 0);
+    _used = 0;
+}
+
+void TileGrid::assign(int rows, int cols, std::vector<PackedTile> tiles) {
+    _rows = rows;
+    _cols = cols;
+    _sparse = false;
+    _shared.reset();
+    _owned = std::move(tiles);
+    _data = _owned.data();
+}
+
+void TileGrid::clear() {
+    if (_sparse) {
+        std::fill(_directory.begin(), _directory.end(), 0);
+        _used = 0;
+    }
+    else {
+        assign(_rows, _cols, TileStorage::Dense);
+    }
+}
+
+void TileGrid::share(std::shared_ptr<const void> owner, int rows, int cols, const PackedTile *tiles) {
+    _rows = rows;
+    _cols = cols;
+    _sparse = false;
+    _shared = std::move(owner);
+    _data = tiles;
+}
+
+void TileGrid::own() {
+    if (!_shared)
+        return;
+
+    _owned.assign(_data, _data + size());
+    _shared.reset();
+    _data = _owned.data();
+}
+
+uint32_t TileGrid::allocateChunk() {
+    static constexpr size_t TILES = CHUNK_SIZE * CHUNK_SIZE;
+
+    if (_used == _chunks.size()) {
+        _slabs.emplace_back(new PackedTile[SLAB_CHUNKS * TILES]);
+        for (size_t k = 0; k < SLAB_CHUNKS; ++k) {
+            _chunks.push_back(_slabs.back().get() + k * TILES);
+        }
+    }
+
+    // chunks of an earlier board are handed out again
+    PackedTile *chunk = _chunks[_used];
+    std::fill(chunk, chunk + TILES, PackedTile{});
+    return (uint32_t)++_used;
+}
+
+Model::Model(int rows, int cols, TileStorage storage) :
     _rows(rows), _cols(cols)
 {
-    _tiles.resize(rows * cols);
+    _tiles.assign(rows, cols, storage);
     clear();
+    setThreads(1);
+}
+
+Model::Model(std::shared_ptr<const Snapshot> snapshot) :
+    _rows(0), _cols(0)
+{
+    setThreads(1);
+    restore(std::move(snapshot));
 }
 
 void Model::clear() {
-    for (auto &tile : _tiles) {
-        tile = Tile{ TileType::Empty };
+    attachRestored();
+    _track.invalidateAll();
+    if (!_balls.empty())
+        _limits_dirty = true;
+
+    _hash -= tileHash();
+    _tiles.clear();
+    _turning.clear();
+    ++_board_revision;
+    forgetHistory();
+}
+
+void Model::reset(int rows, int cols) {
+    _rows = rows;
+    _cols = cols;
+    _tiles.assign(rows, cols, _tiles.storage());
+    _balls.clear();
+    _turning.clear();
+
+    _track.invalidateAll();
+    _track.dropStale();
+    _limits_dirty = false;
+    _restored_balls = false;
+    _now = 0.0;
+    _hash = 0;
+    ++_board_revision;
+
+    splitBands();
+    forgetHistory();
+}
+
+void Model::reset(TileGrid tiles) {
+    reset(0, 0);
+    _rows = tiles.rows();
+    _cols = tiles.cols();
+    _tiles = std::move(tiles);
+
+    _tiles.forEachTile([this](int row, int col, const PackedTile &tile) {
+        TileType type = tile.type();
+        if (type == TileType::Empty)
+            return;
+
+        // rotors keep their positions, other tiles nothing but their type
+        uint32_t keep = type == TileType::Rotor ? 0x3f : 0xf;
+        if (tile.bits & ~keep)
+            at(row, col).bits &= keep;
+        if (type == TileType::Rotor)
+            updateConnected(row, col);
+
+        _hash += tile_key(col + (size_t)row * _cols, tile);
+    });
+
+    splitBands();
+}
+
+void Model::setStorage(TileStorage storage) {
+    if (storage == _tiles.storage())
+        return;
+
+    TileGrid tiles;
+    tiles.assign(_rows, _cols, storage);
+    _tiles.forEachTile([&tiles](int row, int col, const PackedTile &tile) {
+        if (tile.bits != 0)
+            tiles.at(row, col) = tile;
+    });
+    _tiles = std::move(tiles);
+}
+
+void Model::restore(std::shared_ptr<const Snapshot> snapshot) {
+    _rows = snapshot->rows();
+    _cols = snapshot->cols();
+
+    // the model takes the storage of the board the snapshot was taken of
+    if (snapshot->storage() == TileStorage::Sparse) {
+        _tiles.assign(_rows, _cols, TileStorage::Sparse);
+        snapshot->copyTiles(_tiles);
+    }
+    else if (const PackedTile *tiles = snapshot->tiles()) {
+        _tiles.share(snapshot, _rows, _cols, tiles);
+    }
+    else {
+        _tiles.assign(_rows, _cols, TileStorage::Dense);
+        snapshot->copyTiles(&_tiles[0]);
+    }
+
+    _turning.resize(snapshot->turningCount());
+    for (size_t i = 0; i < _turning.size(); ++i) {
+        _turning[i] = snapshot->turning(i);
+    }
+
+    snapshot->copyBalls(_balls);
+    for (size_t i = 0; i < _balls.size(); ++i) {
+        _balls.limit[i] = limitOf(_balls[i]);
     }
+
+    // balls get onto their track segments with the first step, until then
+    // their part of the hash is the one the snapshot kept
+    _hash = snapshot->tileHash() + snapshot->ballHash();
+    _restored_ball_hash = snapshot->ballHash();
+    _restored_balls = !_balls.empty();
+    _track.invalidateAll();
+    _track.dropStale();
+    _limits_dirty = false;
+    _now = snapshot->now();
+    ++_board_revision;
+
+    splitBands();
+    forgetHistory();
 }
 
-void Model::turnClockwise(int row, int col) {
-    if (tile(row, col).type == TileType::Rotor && tile(row, col).rotor.state == RotorState::Resting) {
-        tile(row, col).rotor.state = RotorState::TurningClockwise;
-        tile(row, col).rotor.transition = 0.0;
+Tile Model::tile(int row, int col) const {
+    const PackedTile &packed = at(row, col);
+
+    Tile tile{};
+    tile.type = packed.type();
+    if (tile.type == TileType::Rotor) {
+        tile.rotor.state = packed.state();
+        tile.rotor.position = packed.position();
+        tile.rotor.transition = 0.0;
+        if (tile.rotor.state != RotorState::Resting)
+            tile.rotor.transition = _turning[slotOf(col + (size_t)row * _cols)].transition;
+
+        for (int i = 0; i < 4; ++i) {
+            tile.rotor.taken[i] = packed.taken(i);
+            tile.rotor.connected[i] = packed.connected(i);
+        }
     }
+    return tile;
 }
 
-void Model::turnCounterClockwise(int row, int col) {
-    if (tile(row, col).type == TileType::Rotor && tile(row, col).rotor.state == RotorState::Resting) {
-        tile(row, col).rotor.state = RotorState::TurningCounterClockwise;
-        tile(row, col).rotor.transition = 0.0;
+void Model::setTile(int row, int col, TileType type, int rotor_position) {
+    attachRestored();
+    _track.invalidate(*this, row, col);
+    _hash -= tileKey(col + (size_t)row * _cols);
+
+    PackedTile &tile = at(row, col);
+    bool was_rotor = tile.type() == TileType::Rotor;
+
+    if (was_rotor && tile.state() != RotorState::Resting)
+        stopTurning(col + (size_t)row * _cols);
+
+    // balls inside a replaced rotor stay where they are
+    if (!was_rotor || type != TileType::Rotor)
+        tile = PackedTile{};
+
+    tile.setType(type);
+    if (type == TileType::Rotor) {
+        tile.setState(RotorState::Resting);
+        tile.setPosition(rotor_position % 4);
+    }
+
+    // balls on this tile may now stop or start moving
+    if (!_balls.empty())
+        _limits_dirty = true;
+
+    updateConnected(row, col);
+    if (row > 0)
+        updateConnected(row - 1, col);
+    if (col < _cols - 1)
+        updateConnected(row, col + 1);
+    if (row < _rows - 1)
+        updateConnected(row + 1, col);
+    if (col > 0)
+        updateConnected(row, col - 1);
+
+    _hash += tileKey(col + (size_t)row * _cols);
+    ++_board_revision;
+    forgetHistory();
+}
+
+Ball Model::ball(size_t i) const {
+    int segment = _balls.segment[i];
+    if (segment < 0)
+        return _balls[i];
+
+    return _track.position(*this, segment, _balls.transition[i], _balls.type[i]);
+}
+
+int64_t Model::ballTile(size_t i) const {
+    int segment = _balls.segment[i];
+    if (segment < 0) {
+        int row = _balls.row[i];
+        int col = _balls.col[i];
+        if (_balls.state[i] == BallState::None || row < 0 || row >= _rows || col < 0 || col >= _cols)
+            return -1;
+        return col + (size_t)row * _cols;
+    }
+
+    // the node TrackGraph::position puts the ball on
+    const std::vector<TrackNode> &nodes = _track.segment(segment).nodes;
+    int k = std::min(std::max((int)_balls.transition[i], 0), (int)nodes.size() - 1);
+    return (int64_t)nodes[k].index;
+}
+
+void Model::addBall(const Ball &ball) {
+    attachRestored();
+    _balls.push_back(ball, limitOf(ball));
+    attach(_balls.size() - 1);
+    _hash += ballKey(_balls.size() - 1);
+
+    if (ball.state == BallState::InsideRotor && _tiles.at(ball.row, ball.col).type() == TileType::Rotor) {
+        at(ball.row, ball.col).setTaken(ball.rotor_position, true);
     }
+    forgetHistory();
+}
+
+void Model::updateConnected(int row, int col) {
+    // neighbours are only read, so that sparse grids don't allocate for them
+    const TileGrid &tiles = _tiles;
+    if (tiles.at(row, col).type() != TileType::Rotor)
+        return;
+
+    PackedTile &tile = at(row, col);
+
+    // north
+    tile.setConnected(0, row > 0 && tiles.at(row - 1, col).type() != TileType::Empty);
+
+    // east
+    tile.setConnected(1, col < _cols - 1 && tiles.at(row, col + 1).type() != TileType::Empty);
+
+    // south
+    tile.setConnected(2, row < _rows - 1 && tiles.at(row + 1, col).type() != TileType::Empty);
+
+    // west
+    tile.setConnected(3, col > 0 && tiles.at(row, col - 1).type() != TileType::Empty);
+}
+
+void Model::startTurning(int row, int col, RotorState state) {
+    if (_tiles.at(row, col).type() != TileType::Rotor)
+        return;
+
+    PackedTile &tile = at(row, col);
+    if (tile.state() == RotorState::Resting) {
+        if (_history) {
+            std::vector<uint8_t> &log = undoLog();
+            logTile(log, col + (size_t)row * _cols);
+            logTurning(log);
+        }
+        _hash -= tileKey(col + (size_t)row * _cols);
+        tile.setState(state);
+        _hash += tileKey(col + (size_t)row * _cols);
+        tile.setSlot(_turning.size());
+        _turning.push_back(TurningRotor{ col + (size_t)row * _cols, 0.0 });
+    }
+}
+
+size_t Model::slotOf(size_t index) const {
+    size_t slot = _tiles[index].slot();
+    if (slot != PackedTile::NO_SLOT)
+        return slot;
+
+    // only rotors beyond the first 65535 turning ones end up here
+    for (slot = PackedTile::NO_SLOT; slot < _turning.size(); ++slot) {
+        if (_turning[slot].index == index)
+            break;
+    }
+    return slot;
+}
+
+void Model::removeTurning(size_t slot) {
+    if (_history && slot + 1 < _turning.size())
+        logTile(undoLog(), _turning.back().index);
+    _turning[slot] = _turning.back();
+    _turning.pop_back();
+    if (slot < _turning.size())
+        _tiles[_turning[slot].index].setSlot(slot);
+}
+
+void Model::stopTurning(size_t index) {
+    removeTurning(slotOf(index));
+    _tiles[index].setState(RotorState::Resting);
+}
+
+void Model::turnClockwise(int row, int col) {
+    startTurning(row, col, RotorState::TurningClockwise);
+}
+
+void Model::turnCounterClockwise(int row, int col) {
+    startTurning(row, col, RotorState::TurningCounterClockwise);
 }
 
 void Model::eject(int row, int col, int direction) {
-    if (tile(row, col).type == TileType::Rotor && tile(row, col).rotor.state == RotorState::Resting && tile(row, col).rotor.connected[direction]) {
-        int position = (direction - tile(row, col).rotor.position + 4) % 4;
-
-        for (auto &ball : _balls) {
-            if (ball.row == row && ball.col == col && ball.state == BallState::InsideRotor && ball.rotor_position == position) {
-                
-                static constexpr BallState exiting_states[4] = {
-                    BallState::ExitingTowardsNorth,
-                    BallState::ExitingTowardsEast,
-                    BallState::ExitingTowardsSouth,
-                    BallState::ExitingTowardsWest,
-                };
-                
-                ball.state = exiting_states[direction];
-                ball.transition = 0.25;
+    if (_tiles.at(row, col).type() != TileType::Rotor)
+        return;
+
+    attachRestored();
+
+    PackedTile &tile = at(row, col);
+    if (tile.state() == RotorState::Resting && tile.connected(direction)) {
+        int position = (direction - tile.position() + 4) % 4;
+
+        for (size_t i = 0; i < _balls.size(); ++i) {
+            if (_balls.row[i] == row && _balls.col[i] == col && _balls.state[i] == BallState::InsideRotor && _balls.rotor_position[i] == position) {
+                if (_history) {
+                    std::vector<uint8_t> &log = undoLog();
+                    logBall(log, i);
+                    logTile(log, col + (size_t)row * _cols);
+                }
+                _hash -= ballKey(i);
+                _balls.state[i] = exiting_towards(direction);
+                _hash += ballKey(i);
+                _balls.transition[i] = 0.25;
+                _balls.limit[i] = TRANSITIONS(TileType::Rotor, _balls.state[i]).threshold;
+                tile.setTaken(position, false);
             }
         }
     }
 }
 
-static void progress_rotor(Tile &tile, double milliseconds) {
-    if (tile.rotor.state == RotorState::TurningClockwise)
-    {
-        tile.rotor.transition += milliseconds / 1000.0 * 60.0 / 5.0;
-        if (tile.rotor.transition >= 1.0) {
-            tile.rotor.state = RotorState::Resting;
-            tile.rotor.position += 1;
-            tile.rotor.position %= 4;
+// fraction of a quarter turn a rotor makes in the given time
+static double rotor_turn(double milliseconds) {
+    return milliseconds / 1000.0 * 60.0 / 5.0;
+}
+
+static void rest_rotor(PackedTile &tile) {
+    if (tile.state() == RotorState::TurningClockwise)
+        tile.setPosition((tile.position() + 1) % 4);
+    else if (tile.state() == RotorState::TurningCounterClockwise)
+        tile.setPosition((tile.position() + 3) % 4);
+    tile.setState(RotorState::Resting);
+}
+
+// applies the transition of the ball's state on the given tile if the ball
+// got far enough
+static void apply_transition(Ball &ball, PackedTile &tile) {
+    const Transition &transition = TRANSITIONS(tile.type(), ball.state);
+    if (ball.transition < transition.threshold)
+        return;
+
+    if (transition.rotor) {
+        int direction = (int)ball.state - (int)BallState::EnteringFromNorth;
+        int position = (direction - tile.position() + 4) % 4;
+
+        if (tile.state() == RotorState::Resting && !tile.taken(position)) {
+            tile.setTaken(position, true);
+            ball.state = BallState::InsideRotor;
+            ball.rotor_position = position;
+            ball.transition = 0;
+            PROFILE_COUNT(RotorCaptures, 1);
         }
+        else {
+            ball.state = transition.next;
+            PROFILE_COUNT(Bounces, 1);
+        }
+        return;
     }
-    else if (tile.rotor.state == RotorState::TurningCounterClockwise)
-    {
-        tile.rotor.transition += milliseconds / 1000.0 * 60.0 / 5.0;
-        if (tile.rotor.transition >= 1.0) {
-            tile.rotor.state = RotorState::Resting;
-            tile.rotor.position += 3;
-            tile.rotor.position %= 4;
+
+    PROFILE_COUNT(TileTransitions, 1);
+    ball.transition -= transition.threshold;
+    ball.state = transition.next;
+    ball.row += transition.drow;
+    ball.col += transition.dcol;
+}
+
+// a ball that stops, on an empty tile or off the board, stops where it got
+// there rather than as far beyond as the step happened to take it
+static void stop_overshoot(Ball &ball, double limit) {
+    if (limit == std::numeric_limits<double>::infinity())
+        ball.transition = 0.0;
+}
+
+double Model::limitOf(const Ball &ball) const {
+    // balls that left the board stay where they are
+    if (ball.row < 0 || ball.row >= _rows || ball.col < 0 || ball.col >= _cols)
+        return std::numeric_limits<double>::infinity();
+
+    return TRANSITIONS(at(ball.row, ball.col).type(), ball.state).threshold;
+}
+
+// moves a ball that is on plain track onto its track segment
+void Model::attach(size_t i) {
+    BallState state = _balls.state[i];
+    int row = _balls.row[i];
+    int col = _balls.col[i];
+    if (row < 0 || row >= _rows || col < 0 || col >= _cols)
+        return;
+
+    TrackNode node{ col + (size_t)row * _cols, -1 };
+    double distance = _balls.transition[i];
+
+    if (state >= BallState::EnteringFromNorth && state <= BallState::EnteringFromWest) {
+        node.direction = (int)state - (int)BallState::EnteringFromNorth;
+    }
+    else if (state >= BallState::ExitingTowardsNorth && state <= BallState::ExitingTowardsWest) {
+        // the ball is half way across the tile, find where it came from
+        const TileSpec &spec = TILE_SPECS[(int)packedTiles()[node.index].type()];
+        int towards = (int)state - (int)BallState::ExitingTowardsNorth;
+        int count = 0;
+        for (int d = 0; d < 4; ++d) {
+            if (spec.exits[d] == towards) {
+                node.direction = d;
+                ++count;
+            }
+        }
+        if (count != 1)
+            return;
+        distance += 0.5;
+    }
+    else {
+        return;
+    }
+
+    int offset;
+    int segment = _track.find(*this, node, offset);
+    if (segment < 0)
+        return;
+
+    _balls.segment[i] = segment;
+    _balls.transition[i] = offset + distance;
+    _balls.limit[i] = _track.segment(segment).length();
+}
+
+// puts the balls of a restored model onto their track segments. the hash
+// has their keys from the snapshot already, which are the ones they get
+// unless the snapshot was taken right after an edit, before the balls on the
+// edited track moved on to their new segments.
+void Model::attachRestored() {
+    if (!_restored_balls)
+        return;
+
+    uint64_t keys = 0;
+    for (size_t i = 0; i < _balls.size(); ++i) {
+        if (_balls.segment[i] < 0)
+            attach(i);
+        keys += ballKey(i);
+    }
+    _hash += keys - _restored_ball_hash;
+    _restored_balls = false;
+}
+
+// brings the balls up to date after tiles changed
+void Model::refreshBalls() {
+    attachRestored();
+    for (size_t i = 0; i < _balls.size(); ++i) {
+        int segment = _balls.segment[i];
+        if (segment >= 0 && !_track.segment(segment).stale)
+            continue;
+
+        Ball ball = this->ball(i);
+        _hash -= ballKey(i);
+        _balls.set(i, ball, limitOf(ball));
+        attach(i);
+        _hash += ballKey(i);
+    }
+
+    _track.dropStale();
+    _limits_dirty = false;
+}
+
+// moves a ball that reached its limit on to its next state, the part of its
+// transition beyond the limit carries over unless the ball stops
+void Model::crossBall(size_t i, Band &band) {
+    if (_history)
+        logBall(band.undo, i);
+
+    int segment = _balls.segment[i];
+    if (segment >= 0) {
+        std::unique_lock<std::mutex> lock;
+        if (_track_lock)
+            lock = std::unique_lock<std::mutex>(*_track_lock);
+
+        const Segment &track = _track.segment(segment);
+        if (track.cycle) {
+            _balls.transition[i] = std::fmod(_balls.transition[i], track.length());
+            return;
         }
+
+        // the ball leaves plain track, maybe onto the next segment
+        PROFILE_COUNT(TileTransitions, 1);
+        Ball ball = _track.exit(*this, segment, _balls.transition[i] - track.length(), _balls.type[i]);
+        double limit = limitOf(ball);
+        stop_overshoot(ball, limit);
+        band.hash -= ballKey(i);
+        _balls.set(i, ball, limit);
+        attach(i);
+        band.hash += ballKey(i);
+        return;
     }
+
+    Ball ball = _balls[i];
+    size_t index = ball.col + (size_t)ball.row * _cols;
+    const PackedTile &current = _tiles.at(ball.row, ball.col);
+    if (current.type() == TileType::Rotor) {
+        if (_history)
+            logTile(band.undo, index);
+        apply_transition(ball, at(ball.row, ball.col));
+    }
+    else {
+        // only rotors change, the others aren't written so that bands
+        // running in parallel never allocate chunks of a sparse grid
+        PackedTile tile = current;
+        apply_transition(ball, tile);
+    }
+    double limit = limitOf(ball);
+    stop_overshoot(ball, limit);
+    band.hash -= ballKey(i);
+    _balls.set(i, ball, limit);
+
+    std::unique_lock<std::mutex> lock;
+    if (_track_lock)
+        lock = std::unique_lock<std::mutex>(*_track_lock);
+    attach(i);
+    band.hash += ballKey(i);
+}
+
+// the rotor stays in the turning list until the end of the step, so that
+// bands running in parallel don't need to share it
+void Model::finishRotor(size_t index, Band &band) {
+    if (_history)
+        logTile(band.undo, index);
+
+    band.hash -= tileKey(index);
+    rest_rotor(_tiles[index]);
+    band.hash += tileKey(index);
 }
 
-static void progress_ball(Ball &ball, Tile &tile, double milliseconds) {
-    // tiles per millisecond
-    double velocity = 1e-3;
-    ball.transition += milliseconds * velocity;
+uint64_t Model::tileKey(size_t index) const {
+    return tile_key(index, _tiles[index]);
+}
+
+uint64_t Model::ballKey(size_t i) const {
+    int segment = _balls.segment[i];
+    if (segment >= 0)
+        return segment_ball_key(_track.segment(segment), _balls.type[i]);
+    return ball_key(_balls[i]);
+}
+
+uint64_t Model::tileHash() const {
+    if (_restored_balls)
+        return _hash - _restored_ball_hash;
+
+    uint64_t hash = _hash;
+    for (size_t i = 0; i < _balls.size(); ++i) {
+        hash -= ballKey(i);
+    }
+    return hash;
+}
+
+uint64_t Model::computeHash() const {
+    uint64_t hash = 0;
+    _tiles.forEachTile([&](int row, int col, const PackedTile &tile) {
+        hash += tile_key(col + (size_t)row * _cols, tile);
+    });
+    if (_restored_balls)
+        return hash + _restored_ball_hash;
+
+    for (size_t i = 0; i < _balls.size(); ++i) {
+        hash += ballKey(i);
+    }
+    return hash;
+}
+
+bool Model::idle() const {
+    if (!_turning.empty())
+        return false;
+
+    for (double limit : _balls.limit) {
+        if (limit != std::numeric_limits<double>::infinity())
+            return false;
+    }
+    return true;
+}
+
+uint64_t Model::fingerprint() const {
+    static constexpr double QUANTUM = 1e6;
+
+    uint64_t fingerprint = _hash;
+    for (size_t i = 0; i < _balls.size(); ++i) {
+        uint64_t where = (uint64_t)std::llround(_balls.transition[i] * QUANTUM) ^ (uint64_t)_balls.segment[i] << 40;
+        fingerprint += mix_hash(mix_hash(i) ^ where);
+    }
+    for (const auto &rotor : _turning) {
+        fingerprint += mix_hash(mix_hash(rotor.index) ^ (uint64_t)std::llround(rotor.transition * QUANTUM));
+    }
+    return fingerprint;
+}
+
+double Model::fastForward(double time, double step) {
+    // brent's algorithm, the tortoise only needs to remember its fingerprint
+    // and time, the hare is the model itself
+    uint64_t tortoise = fingerprint();
+    double tortoise_time = _now;
+    size_t power = 1;
+    size_t lambda = 0;
+
+    while (_now + step <= time) {
+        advanceTo(_now + step);
+        ++lambda;
 
-    // exiting balls don't care about the tile type
-    switch (ball.state) {
-    case BallState::ExitingTowardsSouth:
-        if (ball.transition >= 0.5) {
-            ball.transition -= 0.5;
-            ball.state = BallState::EnteringFromNorth;
-            ++ball.row;
+        uint64_t hare = fingerprint();
+        if (hare == tortoise) {
+            double period = _now - tortoise_time;
+            _now += std::floor((time - _now) / period) * period;
+            advanceTo(time);
+            return period;
         }
-        break;
 
-    case BallState::ExitingTowardsWest:
-        if (ball.transition >= 0.5) {
-            ball.transition -= 0.5;
-            ball.state = BallState::EnteringFromEast;
-            --ball.col;
+        if (lambda == power) {
+            tortoise = hare;
+            tortoise_time = _now;
+            power *= 2;
+            lambda = 0;
         }
-        break;
+    }
+
+    advanceTo(time);
+    return 0.0;
+}
+
+static bool later(const Event &a, const Event &b) {
+    if (a.time != b.time)
+        return a.time > b.time;
+    if (a.ball != b.ball)
+        return a.ball;
+    return a.index > b.index;
+}
+
+void Model::progress(double milliseconds) {
+    if (milliseconds > 0.0)
+        simulate(milliseconds, _now + milliseconds);
+}
+
+void Model::advanceTo(double time) {
+    if (time > _now)
+        simulate(time - _now, time);
+}
 
-    case BallState::ExitingTowardsNorth:
-        if (ball.transition >= 0.5) {
-            ball.transition -= 0.5;
-            ball.state = BallState::EnteringFromSouth;
-            --ball.row;
+void Model::setThreads(int threads) {
+    if (threads > 1)
+        _pool.reset(new ThreadPool(threads));
+    else
+        _pool.reset();
+
+    splitBands();
+}
+
+void Model::splitBands() {
+    // more bands than threads, so that threads that are done with a sparse
+    // band can pick up another one
+    int bands = _pool ? std::max(1, std::min(_rows, threads() * 4)) : 1;
+    _band_rows = std::max(1, (_rows + bands - 1) / bands);
+    _bands.clear();
+    _bands.resize(std::max(1, (_rows + _band_rows - 1) / _band_rows));
+}
+
+size_t Model::bandOf(int row) const {
+    if (row < 0)
+        return 0;
+    return std::min((size_t)(row / _band_rows), _bands.size() - 1);
+}
+
+// moves all rotors and balls by the given time, in chunks of balls when
+// running on several threads
+void Model::advanceAll(double milliseconds) {
+    {
+        PROFILE_SCOPE("advance rotors");
+        for (auto &rotor : _turning) {
+            rotor.transition += rotor_turn(milliseconds);
         }
-        break;
+    }
 
-    case BallState::ExitingTowardsEast:
-        if (ball.transition >= 0.5) {
-            ball.transition -= 0.5;
-            ball.state = BallState::EnteringFromWest;
-            ++ball.col;
+    PROFILE_SCOPE("advance balls");
+    size_t count = _balls.size();
+    PROFILE_COUNT(BallsAdvanced, count);
+    // _crossed is free until advanceAll fills it
+    double step = milliseconds * BALL_VELOCITY;
+    _crossed.resize((count + 63) / 64);
+
+    if (!_pool) {
+        advance_balls(_balls.transition.data(), _balls.limit.data(), count, step, _crossed.data());
+        return;
+    }
+
+    // a multiple of 64, so that chunks don't share words of _crossed
+    static constexpr size_t CHUNK = 64 * 1024;
+    _pool->run((count + CHUNK - 1) / CHUNK, [&](size_t k) {
+        size_t first = k * CHUNK;
+        size_t n = std::min(CHUNK, count - first);
+        advance_balls(_balls.transition.data() + first, _balls.limit.data() + first, n, step, _crossed.data() + first / 64);
+    });
+}
+
+// handles the events of a band that happen before the given end time
+void Model::runBand(size_t b, double end, double time) {
+    PROFILE_SCOPE("band events");
+    Band &band = _bands[b];
+    while (!band.events.empty() && band.events.front().time < end) {
+        std::pop_heap(band.events.begin(), band.events.end(), later);
+        Event event = band.events.back();
+        band.events.pop_back();
+
+        if (!event.ball) {
+            finishRotor(event.index, band);
+            continue;
         }
-        break;
-    }
-
-    switch (tile.type) {
-        case TileType::Rotor:
-            if (ball.transition >= 0.25) {
-                int direction;
-                switch (ball.state) {
-                case BallState::EnteringFromNorth: direction = 0; break;
-                case BallState::EnteringFromEast: direction = 1; break;
-                case BallState::EnteringFromSouth: direction = 2; break;
-                case BallState::EnteringFromWest: direction = 3; break;
-                default: direction = -1; break;
-                }
-                if (direction >= 0) {
-                    int position = (direction - tile.rotor.position + 4) % 4;
-
-                    if (tile.rotor.state == RotorState::Resting && !tile.rotor.taken[position]) {
-                        tile.rotor.taken[position] = true;
-                        ball.state = BallState::InsideRotor;
-                        ball.rotor_position = position;
-                        ball.transition = 0;
-                    }
-                    else {
-                        switch (ball.state) {
-                        case BallState::EnteringFromNorth:
-                            ball.state = BallState::ExitingTowardsNorth;
-                            break;
-                        case BallState::EnteringFromEast:
-                            ball.state = BallState::ExitingTowardsEast;
-                            break;
-                        case BallState::EnteringFromSouth:
-                            ball.state = BallState::ExitingTowardsSouth;
-                            break;
-                        case BallState::EnteringFromWest:
-                            ball.state = BallState::ExitingTowardsWest;
-                            break;
-                        default:
-                            break;
-                        }
-                    }
-                }
-            }
-            break;
 
-        case TileType::CornerNorthEast:
-            if (ball.transition >= 0.5) {
-                ball.transition -= 0.5;
-                switch (ball.state) {
-                case BallState::EnteringFromNorth:
-                    ball.state = BallState::ExitingTowardsEast;
-                    break;
-                case BallState::EnteringFromEast:
-                    ball.state = BallState::ExitingTowardsNorth;
-                    break;
-                default:
-                    break;
-                }
-            }
-            break;
+        // a ball can pass several thresholds, each one is its own event
+        size_t i = event.index;
+        crossBall(i, band);
+        if (_balls.transition[i] >= _balls.limit[i]) {
+            double next = time - (_balls.transition[i] - _balls.limit[i]) / BALL_VELOCITY;
+            Event again{ std::max(next, event.time), true, i };
 
-        case TileType::CornerNorthWest:
-            if (ball.transition >= 0.5) {
-                ball.transition -= 0.5;
-                switch (ball.state) {
-                case BallState::EnteringFromNorth:
-                    ball.state = BallState::ExitingTowardsWest;
-                    break;
-                case BallState::EnteringFromWest:
-                    ball.state = BallState::ExitingTowardsNorth;
-                    break;
-                default:
-                    break;
-                }
+            if (bandOf(_balls.row[i]) == b) {
+                band.events.push_back(again);
+                std::push_heap(band.events.begin(), band.events.end(), later);
             }
-            break;
-
-        case TileType::CornerSouthEast:
-            if (ball.transition >= 0.5) {
-                ball.transition -= 0.5;
-                switch (ball.state) {
-                case BallState::EnteringFromSouth:
-                    ball.state = BallState::ExitingTowardsEast;
-                    break;
-                case BallState::EnteringFromEast:
-                    ball.state = BallState::ExitingTowardsSouth;
-                    break;
-                default:
-                    break;
-                }
+            else {
+                band.handoff.push_back(again);
             }
-            break;
+        }
+    }
+}
 
-        case TileType::CornerSouthWest:
-            if (ball.transition >= 0.5) {
-                ball.transition -= 0.5;
-                switch (ball.state) {
-                case BallState::EnteringFromSouth:
-                    ball.state = BallState::ExitingTowardsWest;
-                    break;
-                case BallState::EnteringFromWest:
-                    ball.state = BallState::ExitingTowardsSouth;
-                    break;
-                default:
-                    break;
-                }
-            }
-            break;
+// simulates the given number of milliseconds, ending at the given time
+void Model::simulate(double milliseconds, double time) {
+    PROFILE_SCOPE("simulate");
+    PROFILE_PHASES(phase);
+    // the balls of a restored model stay where they are, so this is no
+    // change the history has to know about
+    attachRestored();
+    if (_limits_dirty || _track.hasStale()) {
+        PROFILE_SCOPE("refresh balls");
+        refreshBalls();
+        // the tiles changed since the last tick, which can't be undone
+        if (_history)
+            _history->clear();
+    }
 
-        case TileType::Horizontal:
-            if (ball.transition >= 0.5) {
-                ball.transition -= 0.5;
-                switch (ball.state) {
-                case BallState::EnteringFromEast:
-                    ball.state = BallState::ExitingTowardsWest;
-                    break;
-                case BallState::EnteringFromWest:
-                    ball.state = BallState::ExitingTowardsEast;
-                    break;
-                default:
-                    break;
-                }
-            }
-            break;
+    PROFILE_PHASE(phase, "advance");
+    if (_history)
+        logAdvance(milliseconds);
 
-        case TileType::Vertical:
-            if (ball.transition >= 0.5) {
-                ball.transition -= 0.5;
-                switch (ball.state) {
-                case BallState::EnteringFromNorth:
-                    ball.state = BallState::ExitingTowardsSouth;
-                    break;
-                case BallState::EnteringFromSouth:
-                    ball.state = BallState::ExitingTowardsNorth;
-                    break;
-                default:
-                    break;
-                }
-            }
-            break;
+    // rotors and balls are moved all the way first, the ones that passed a
+    // threshold on the way know when they did from how far they overshot it
+    advanceAll(milliseconds);
 
-        case TileType::Crossing:
-            if (ball.transition >= 0.5) {
-                ball.transition -= 0.5;
-                switch (ball.state) {
-                case BallState::EnteringFromNorth:
-                    ball.state = BallState::ExitingTowardsSouth;
-                    break;
-                case BallState::EnteringFromEast:
-                    ball.state = BallState::ExitingTowardsWest;
-                    break;
-                case BallState::EnteringFromSouth:
-                    ball.state = BallState::ExitingTowardsNorth;
-                    break;
-                case BallState::EnteringFromWest:
-                    ball.state = BallState::ExitingTowardsEast;
-                    break;
-                default:
-                    break;
-                }
-            }
-            break;
+    PROFILE_PHASE(phase, "schedule events");
+    for (auto &band : _bands) {
+        band.events.clear();
+    }
 
-        default:
-            break;
+    for (auto &rotor : _turning) {
+        if (rotor.transition >= 1.0) {
+            Event event{ time - (rotor.transition - 1.0) / rotor_turn(1.0), false, (size_t)rotor.index };
+            _bands[bandOf((int)(rotor.index / _cols))].events.push_back(event);
+        }
     }
-}
 
-static void recompute_taken(Model &model) {
-    // set all taken values of all rotors to false
-    for (int r = 0; r < model.rows(); ++r) {
-        for (int c = 0; c < model.cols(); ++c) {
-            Tile &tile = model.tile(r, c);
-            if (tile.type == TileType::Rotor) {
-                for (int i = 0; i < 4; ++i) {
-                    tile.rotor.taken[i] = false;
+    for (size_t w = 0; w < _crossed.size(); ++w) {
+        uint64_t bits = _crossed[w];
+        while (bits) {
+            size_t i = w * 64 + count_trailing_zeros(bits);
+            bits &= bits - 1;
+
+            Event event{ time - (_balls.transition[i] - _balls.limit[i]) / BALL_VELOCITY, true, i };
+            _bands[bandOf(_balls.row[i])].events.push_back(event);
+        }
+    }
+
+    bool events = false;
+    for (auto &band : _bands) {
+        std::make_heap(band.events.begin(), band.events.end(), later);
+        events = events || !band.events.empty();
+    }
+
+    PROFILE_PHASE(phase, "run events");
+
+    // events write to the tiles, from several threads at once, so tiles
+    // borrowed from a snapshot are copied beforehand
+    if (events)
+        _tiles.own();
+
+    if (!_pool) {
+        runBand(0, std::numeric_limits<double>::infinity(), time);
+        collectUndo();
+    }
+    else {
+        // the events of a ball are at least 250 ms apart, the time a ball
+        // needs for the 0.25 into a rotor. a ball that moves to another band
+        // within a shorter window therefore has nothing left to do in it, and
+        // every band sees its events in the same order as a single thread.
+        static constexpr double WINDOW = 200.0;
+
+        std::mutex track_lock;
+        _track_lock = &track_lock;
+
+        for (;;) {
+            double first = std::numeric_limits<double>::infinity();
+            for (const auto &band : _bands) {
+                if (!band.events.empty())
+                    first = std::min(first, band.events.front().time);
+            }
+            if (first == std::numeric_limits<double>::infinity())
+                break;
+
+            double end = first + WINDOW;
+            if (end > time)
+                end = std::numeric_limits<double>::infinity();
+
+            _pool->run(_bands.size(), [&](size_t b) { runBand(b, end, time); });
+            collectUndo();
+
+            for (auto &band : _bands) {
+                for (const auto &event : band.handoff) {
+                    Band &target = _bands[bandOf(_balls.row[event.index])];
+                    target.events.push_back(event);
+                    std::push_heap(target.events.begin(), target.events.end(), later);
                 }
+                band.handoff.clear();
             }
         }
+
+        _track_lock = nullptr;
     }
 
-    // if a ball is in the InsideRotor state, set the taken value to true
-    for (auto &ball : model.balls()) {
-        if (ball.state == BallState::InsideRotor) {
-            Tile &tile = model.tile(ball.row, ball.col);
-            if (tile.type == TileType::Rotor) {
-                tile.rotor.taken[ball.rotor_position] = true;
-            }
+    for (auto &band : _bands) {
+        _hash += band.hash;
+        band.hash = 0;
+    }
+
+    // rotors that came to rest are swapped out of the list
+    PROFILE_PHASE(phase, "finish");
+    for (size_t i = 0; i < _turning.size();) {
+        if (_tiles[_turning[i].index].state() == RotorState::Resting) {
+            removeTurning(i);
+        }
+        else {
+            ++i;
         }
     }
+
+    _now = time;
+    if (_history)
+        _history->commit();
+    PROFILE_SAMPLE();
 }
 
+void Model::setHistory(size_t bytes) {
+    if (bytes > 0)
+        _history.reset(new History(bytes));
+    else
+        _history.reset();
+}
+
+void Model::forgetHistory() {
+    if (_history)
+        _history->clear();
+}
 
-static void recompute_connected(Model &model) {
-    for (int r = 0; r < model.rows(); ++r) {
-        for (int c = 0; c < model.cols(); ++c) {
-            Tile &tile = model.tile(r, c);
-            if (tile.type == TileType::Rotor) {
-                // north
-                tile.rotor.connected[0] = r > 0 && model.tile(r - 1, c).type != TileType::Empty;
+// the pending entry of the history, which starts with the state to go back to
+std::vector<uint8_t> &Model::undoLog() {
+    std::vector<uint8_t> &log = _history->pending();
+    if (log.empty()) {
+        put(log, _now);
+        put(log, _hash);
+        put(log, (uint8_t)_limits_dirty);
+        put(log, Undo::State);
+    }
+    return log;
+}
 
-                // east
-                tile.rotor.connected[1] = c < model.cols() - 1 && model.tile(r, c + 1).type != TileType::Empty;
+void Model::logBall(std::vector<uint8_t> &log, size_t i) const {
+    put(log, (uint32_t)i);
+    put(log, _balls.state[i]);
+    put(log, _balls.type[i]);
+    put(log, _balls.rotor_position[i]);
+    put(log, _balls.transition[i]);
+    put(log, _balls.limit[i]);
+    put(log, _balls.row[i]);
+    put(log, _balls.col[i]);
+    put(log, _balls.segment[i]);
+    put(log, Undo::Ball);
+}
 
-                // south
-                tile.rotor.connected[2] = r < model.rows() - 1 && model.tile(r + 1, c).type != TileType::Empty;
+void Model::logTile(std::vector<uint8_t> &log, size_t index) const {
+    put(log, (uint64_t)index);
+    put(log, _tiles[index].bits);
+    put(log, Undo::Tile);
+}
 
-                // west
-                tile.rotor.connected[3] = c > 0 && model.tile(r, c - 1).type != TileType::Empty;
-            }
+void Model::logTurning(std::vector<uint8_t> &log) const {
+    for (const auto &rotor : _turning) {
+        put(log, (uint64_t)rotor.index);
+        put(log, rotor.transition);
+    }
+    put(log, (uint32_t)_turning.size());
+    put(log, Undo::Turning);
+}
+
+// balls that move are taken back by the step they made, which gives their
+// old transition back exactly unless rounding lost some of its bits. only
+// those few need their old transition kept.
+void Model::logAdvance(double milliseconds) {
+    std::vector<uint8_t> &log = undoLog();
+    logTurning(log);
+
+    // _crossed is free until advanceAll fills it
+    double step = milliseconds * BALL_VELOCITY;
+    _crossed.resize((_balls.size() + 63) / 64);
+    inexact_steps(_balls.transition.data(), _balls.limit.data(), _balls.size(), step, _crossed.data());
+
+    for (size_t w = 0; w < _crossed.size(); ++w) {
+        uint64_t bits = _crossed[w];
+        while (bits) {
+            size_t i = w * 64 + count_trailing_zeros(bits);
+            bits &= bits - 1;
+
+            put(log, (uint32_t)i);
+            put(log, _balls.transition[i]);
+            put(log, Undo::Transition);
         }
     }
+    put(log, step);
+    put(log, Undo::Advance);
 }
 
-void Model::progress(double milliseconds) {
-    // TODO get rid of this inefficient nonsense
-    recompute_taken(*this);
-    recompute_connected(*this);
-
-    for (int r = 0; r < _rows; ++r) {
-        for (int c = 0; c < _cols; ++c) {
-            switch (tile(r, c).type) {
-            case TileType::Rotor:
-                progress_rotor(tile(r, c), milliseconds);
-                break;
-            default:
-                break;
+// moves the undo records of the bands to the history in band order. the
+// events of different bands touch different balls and tiles within a window,
+// so their order doesn't matter, only that windows are undone last first.
+void Model::collectUndo() {
+    if (!_history)
+        return;
+
+    std::vector<uint8_t> &log = undoLog();
+    for (auto &band : _bands) {
+        log.insert(log.end(), band.undo.begin(), band.undo.end());
+        band.undo.clear();
+    }
+}
+
+void Model::undo(const uint8_t *begin, const uint8_t *end) {
+    while (end > begin) {
+        switch (take<Undo>(end)) {
+        case Undo::State:
+            _limits_dirty = take<uint8_t>(end) != 0;
+            _hash = take<uint64_t>(end);
+            _now = take<double>(end);
+            break;
+        case Undo::Ball: {
+            int segment = take<int>(end);
+            int col = take<int>(end);
+            int row = take<int>(end);
+            double limit = take<double>(end);
+            double transition = take<double>(end);
+            uint8_t rotor_position = take<uint8_t>(end);
+            BallType type = take<BallType>(end);
+            BallState state = take<BallState>(end);
+
+            size_t i = take<uint32_t>(end);
+            _balls.set(i, Ball{ state, type, transition, row, col, rotor_position }, limit);
+            _balls.segment[i] = segment;
+            break;
+        }
+        case Undo::Tile: {
+            uint32_t bits = take<uint32_t>(end);
+            _tiles[take<uint64_t>(end)].bits = bits;
+            break;
+        }
+        case Undo::Turning:
+            _turning.resize(take<uint32_t>(end));
+            for (size_t k = _turning.size(); k-- > 0;) {
+                _turning[k].transition = take<double>(end);
+                _turning[k].index = take<uint64_t>(end);
             }
+            break;
+        case Undo::Transition: {
+            double transition = take<double>(end);
+            _balls.transition[take<uint32_t>(end)] = transition;
+            break;
+        }
+        case Undo::Advance: {
+            double step = take<double>(end);
+            for (size_t i = 0; i < _balls.size(); ++i) {
+                if (_balls.limit[i] != std::numeric_limits<double>::infinity())
+                    _balls.transition[i] -= step;
+            }
+            break;
+        }
         }
     }
+}
 
-    for (auto &ball : _balls) {
-        // current tile
-        Tile tile = _tiles[ball.col + ball.row * _cols];
+bool Model::stepBack() {
+    const uint8_t *begin;
+    const uint8_t *end;
+    if (!_history || !_history->newest(begin, end))
+        return false;
+
+    // undone tiles may still be borrowed from a snapshot
+    _tiles.own();
+    undo(begin, end);
+    _history->dropNewest();
+    return true;
+}
 
-        progress_ball(ball, tile, milliseconds);
+size_t Model::rewind(size_t steps) {
+    size_t n = 0;
+    while (n < steps && stepBack()) {
+        ++n;
     }
+    return n;
 }
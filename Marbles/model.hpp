@@ -1,37 +1,18 @@
 #pragma once
 
+#include "balls.hpp"
+#include "history.hpp"
+#include "thread_pool.hpp"
+#include "track.hpp"
+
+#include <algorithm>
+#include <cstddef>
 #include <cstdint>
+#include <iterator>
+#include <memory>
+#include <mutex>
 #include <vector>
 
-enum class BallType : uint8_t {
-    Red,
-    Green,
-    Blue,
-    Yellow,
-};
-
-enum class BallState : uint8_t {
-    None = 0,
-    EnteringFromNorth,
-    EnteringFromEast,
-    EnteringFromSouth,
-    EnteringFromWest,
-    ExitingTowardsNorth,
-    ExitingTowardsEast,
-    ExitingTowardsSouth,
-    ExitingTowardsWest,
-    InsideRotor,
-};
-
-struct Ball {
-    BallState state = BallState::None;
-    BallType type;
-    double transition;
-    int row;
-    int col;
-    int rotor_position;
-};
-
 enum class TileType : uint8_t {
     Empty,
     CornerNorthEast,
@@ -50,6 +31,7 @@ enum class RotorState : uint8_t {
     TurningCounterClockwise,
 };
 
+// Tile as returned by Model::tile
 struct Tile {
     TileType type;
     union {
@@ -63,12 +45,279 @@ struct Tile {
     };
 };
 
+// Tile as stored by the model, packed into 32 bits. Bits 0-3 hold the type,
+// 4-5 the rotor position, 6-7 the rotor state, 8-11 the taken and 12-15 the
+// connected flags. While a rotor turns, bits 16-31 hold its index in the list
+// of turning rotors, which keeps the transition.
+struct PackedTile {
+    static constexpr uint32_t NO_SLOT = 0xffff;
+
+    uint32_t bits = 0;
+
+    constexpr TileType type() const { return (TileType)(bits & 0xf); }
+    constexpr int position() const { return (bits >> 4) & 0x3; }
+    constexpr RotorState state() const { return (RotorState)((bits >> 6) & 0x3); }
+    constexpr bool taken(int i) const { return (bits >> (8 + i)) & 1; }
+    constexpr bool connected(int i) const { return (bits >> (12 + i)) & 1; }
+    constexpr uint32_t slot() const { return bits >> 16; }
+
+    constexpr void setType(TileType type) { bits = (bits & ~0xfu) | (uint32_t)type; }
+    constexpr void setPosition(int position) { bits = (bits & ~0x30u) | ((uint32_t)position << 4); }
+    constexpr void setState(RotorState state) { bits = (bits & ~0xc0u) | ((uint32_t)state << 6); }
+    constexpr void setTaken(int i, bool taken) { setBit(8 + i, taken); }
+    constexpr void setConnected(int i, bool connected) { setBit(12 + i, connected); }
+    constexpr void setSlot(size_t slot) { bits = (bits & 0xffffu) | ((uint32_t)(slot < NO_SLOT ? slot : NO_SLOT) << 16); }
+
+private:
+    constexpr void setBit(int bit, bool value) { bits = (bits & ~(1u << bit)) | ((uint32_t)value << bit); }
+};
+
+static_assert(sizeof(PackedTile) == 4, "tiles are meant to be packed into 32 bits");
+
+enum class TileStorage : uint8_t {
+    // one array of rows * cols tiles
+    Dense,
+    // chunks of CHUNK_SIZE * CHUNK_SIZE tiles that are only allocated once
+    // they hold anything but empty tiles, for large and mostly empty worlds
+    Sparse,
+};
+
+// Tiles of a model. Dense grids can borrow their tiles from a snapshot that
+// any number of models share, in which case the grid copies them the first
+// time they are accessed for writing.
+//
+// Sparse grids read empty tiles from chunks that aren't there and allocate
+// them on the first access for writing, which callers that only read should
+// therefore avoid. Chunks come from slabs that are kept for the next board.
+//
+// Either way the tiles of a row are contiguous up to the next multiple of
+// CHUNK_SIZE.
+class TileGrid {
+public:
+    static constexpr int CHUNK_BITS = 5;
+    static constexpr int CHUNK_SIZE = 1 << CHUNK_BITS;
+
+    int rows() const { return _rows; }
+    int cols() const { return _cols; }
+    size_t size() const { return (size_t)_rows * _cols; }
+    TileStorage storage() const { return _sparse ? TileStorage::Sparse : TileStorage::Dense; }
+    bool shared() const { return _shared != nullptr; }
+
+    // bytes taken by the tiles, including the chunk directory
+    size_t bytes() const;
+
+    const PackedTile &at(int row, int col) const {
+        if (!_sparse)
+            return _data[col + (size_t)row * _cols];
+
+        uint32_t chunk = _directory[(col >> CHUNK_BITS) + (size_t)(row >> CHUNK_BITS) * _chunk_cols];
+        if (chunk == 0)
+            return EMPTY;
+        return _chunks[chunk - 1][offsetOf(row, col)];
+    }
+
+    PackedTile &at(int row, int col) {
+        if (!_sparse) {
+            if (_shared)
+                own();
+            return _owned[col + (size_t)row * _cols];
+        }
+
+        uint32_t &chunk = _directory[(col >> CHUNK_BITS) + (size_t)(row >> CHUNK_BITS) * _chunk_cols];
+        if (chunk == 0)
+            chunk = allocateChunk();
+        return _chunks[chunk - 1][offsetOf(row, col)];
+    }
+
+    // by index, col + row * cols
+    const PackedTile &operator[](size_t i) const {
+        if (!_sparse)
+            return _data[i];
+        return at((int)(i / _cols), (int)(i % _cols));
+    }
+    PackedTile &operator[](size_t i) {
+        if (!_sparse) {
+            if (_shared)
+                own();
+            return _owned[i];
+        }
+        return at((int)(i / _cols), (int)(i % _cols));
+    }
+
+    // an empty board
+    void assign(int rows, int cols, TileStorage storage);
+    // a dense board made of the given tiles, row by row
+    void assign(int rows, int cols, std::vector<PackedTile> tiles);
+
+    // makes every tile empty
+    void clear();
+
+    // borrows the tiles of a dense board, owner keeps them alive
+    void share(std::shared_ptr<const void> owner, int rows, int cols, const PackedTile *tiles);
+
+    // copies borrowed tiles, not safe to call from several threads
+    void own();
+
+    // calls visit(row, col, tile) for every tile that may be anything but
+    // empty: all tiles of a dense grid, the allocated chunks of a sparse one
+    template <typename Visit>
+    void forEachTile(Visit visit) const {
+        if (!_sparse) {
+            for (int row = 0; row < _rows; ++row) {
+                const PackedTile *line = _data + (size_t)row * _cols;
+                for (int col = 0; col < _cols; ++col) {
+                    visit(row, col, line[col]);
+                }
+            }
+            return;
+        }
+
+        for (size_t k = 0; k < _directory.size(); ++k) {
+            if (_directory[k] == 0)
+                continue;
+
+            const PackedTile *chunk = _chunks[_directory[k] - 1];
+            int top = (int)(k / _chunk_cols) << CHUNK_BITS;
+            int left = (int)(k % _chunk_cols) << CHUNK_BITS;
+            int bottom = std::min(_rows, top + CHUNK_SIZE);
+            int right = std::min(_cols, left + CHUNK_SIZE);
+            for (int row = top; row < bottom; ++row) {
+                for (int col = left; col < right; ++col) {
+                    visit(row, col, chunk[offsetOf(row, col)]);
+                }
+            }
+        }
+    }
+
+private:
+    static const PackedTile EMPTY;
+    // chunks are allocated this many at a time
+    static constexpr size_t SLAB_CHUNKS = 64;
+
+    static size_t offsetOf(int row, int col) {
+        return (size_t)(col & (CHUNK_SIZE - 1)) + ((size_t)(row & (CHUNK_SIZE - 1)) << CHUNK_BITS);
+    }
+
+    // returns the number of a new chunk of empty tiles
+    uint32_t allocateChunk();
+
+    int _rows = 0;
+    int _cols = 0;
+    bool _sparse = false;
+
+    // dense
+    std::vector<PackedTile> _owned;
+    std::shared_ptr<const void> _shared;
+    const PackedTile *_data = nullptr;
+
+    // sparse: per chunk, row by row of chunks, its number or 0 if it is not
+    // allocated. chunk n is _chunks[n - 1], the first _used chunks are taken.
+    int _chunk_cols = 0;
+    std::vector<uint32_t> _directory;
+    std::vector<PackedTile *> _chunks;
+    std::vector<std::unique_ptr<PackedTile[]>> _slabs;
+    size_t _used = 0;
+};
+
+struct TurningRotor {
+    size_t index;
+    double transition;
+};
+
+// A ball or a turning rotor passing a threshold during a simulation step. Rotors go
+// first when both happen at the same time, so a rotor that comes to rest can
+// capture a ball arriving at that very moment.
+struct Event {
+    double time;
+    bool ball;
+    // index of the ball, or tile index of the rotor
+    size_t index;
+};
+
+// Consecutive rows of the board whose events are handled by one thread.
+// A ball that moves on to another band is handed over at the end of the
+// current time window.
+struct Band {
+    // heap of the pending events
+    std::vector<Event> events;
+    std::vector<Event> handoff;
+    // what the events of the band added to the model's hash
+    uint64_t hash = 0;
+    // undo records of the events, moved to the history after every window
+    std::vector<uint8_t> undo;
+};
+
+// Read-only view of the balls of a model. Balls that travel along a track
+// segment are materialized when they are accessed.
+class BallView {
+public:
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Ball;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = Ball;
+
+        const_iterator(const Model *model, size_t index) : _model(model), _index(index) { }
+
+        Ball operator*() const;
+        const_iterator &operator++() { ++_index; return *this; }
+        const_iterator operator++(int) { const_iterator it = *this; ++_index; return it; }
+        bool operator==(const const_iterator &other) const { return _index == other._index; }
+        bool operator!=(const const_iterator &other) const { return _index != other._index; }
+
+    private:
+        const Model *_model;
+        size_t _index;
+    };
+
+    explicit BallView(const Model *model) : _model(model) { }
+
+    size_t size() const;
+    bool empty() const { return size() == 0; }
+    Ball operator[](size_t i) const;
+
+    const_iterator begin() const { return const_iterator(_model, 0); }
+    const_iterator end() const { return const_iterator(_model, size()); }
+
+private:
+    const Model *_model;
+};
+
+class Snapshot;
+
 class Model {
 public:
-    Model(int rows, int cols);
+    // tiles per millisecond that balls move, none moves faster
+    static constexpr double BALL_VELOCITY = 1e-3;
+
+    Model(int rows, int cols, TileStorage storage = TileStorage::Dense);
+    explicit Model(std::shared_ptr<const Snapshot> snapshot);
 
     void clear();
 
+    // empty board of the given size without any balls, keeps the storage
+    // and the memory allocated so far for the next board
+    void reset(int rows, int cols);
+
+    // board made of the given tiles without any balls. only the types and
+    // rotor positions of the tiles count, the rest is worked out in one pass
+    // over the tiles there are, which makes this far faster than setTile for
+    // loading large boards.
+    void reset(TileGrid tiles);
+
+    TileStorage storage() const { return _tiles.storage(); }
+    // moves the board to the other storage, everything else stays as it is
+    void setStorage(TileStorage storage);
+
+    // replaces a tile and keeps the connected flags of it and its neighbours
+    // up to date, rotors start out resting in the given position
+    void setTile(int row, int col, TileType type, int rotor_position = 0);
+
+    // balls inside a rotor have to be added after their rotor tile
+    void addBall(const Ball &ball);
+
     void turnClockwise(int row, int col);
     void turnCounterClockwise(int row, int col);
 
@@ -78,23 +327,158 @@ class Model {
     void ejectSouth(int row, int col) { eject(row, col, 2); }
     void ejectWest(int row, int col) { eject(row, col, 3); }
 
+    // turns the model into a copy of the snapshot, with the storage of the
+    // board it was taken of. dense tiles are read from the snapshot in place
+    // until the model changes one of them, so models restored from the same
+    // snapshot share them until then. sparse ones are copied chunk by chunk.
+    void restore(std::shared_ptr<const Snapshot> snapshot);
+
+    // both simulate every state change in the order it happens, no matter
+    // how far ahead the time is
     void progress(double milliseconds);
+    void advanceTo(double time);
+
+    // simulated time in milliseconds
+    double now() const { return _now; }
+
+    // true if no rotor turns and no ball moves, as of the last progress or
+    // advanceTo
+    bool idle() const;
+
+    // Zobrist hash of the tiles, rotor positions and states and of where the
+    // balls are and what state they are in, kept up to date with every change.
+    // Transitions are left out, and a ball on a stretch of plain track counts
+    // by the stretch, so that equal boards hash the same however they got
+    // there. Balls count by type only, so boards that only differ in the
+    // order balls were added hash the same.
+    uint64_t hash() const { return _hash; }
+
+    // the part of hash() that comes from the tiles
+    uint64_t tileHash() const;
+
+    // the same hash computed from scratch, to check hash() against. the
+    // balls of a restored model count as in the snapshot until its first step.
+    uint64_t computeHash() const;
+
+    // hash() together with how far every ball and turning rotor got, to the
+    // millionth of a tile or turn. equal fingerprints mean equal boards.
+    uint64_t fingerprint() const;
+
+    // changes whenever the size of the board or the type of a tile changes,
+    // and with them the track and the connections of rotors
+    uint64_t boardRevision() const { return _board_revision; }
+
+    // advanceTo for stretches without input. samples the fingerprint every
+    // step milliseconds and looks for a repeating board with Brent's
+    // algorithm. once the board repeats, whole periods are skipped without
+    // simulating them. returns the period, or 0 if none was found.
+    double fastForward(double time, double step = 250.0);
+
+    // keeps what every tick, i.e. progress or advanceTo call, and the
+    // actions before it changed in a ring buffer of the given number of
+    // bytes, 0 turns the history off. a tick takes a few bytes per turning
+    // rotor and per ball that crossed a threshold, balls that merely moved
+    // on cost nothing as a rule. changes to the board forget the history.
+    void setHistory(size_t bytes);
+
+    // ticks that can be undone
+    size_t historyLength() const { return _history ? _history->entries() : 0; }
+
+    // undoes the actions taken since the last tick, or the last tick if
+    // there are none. false if the history doesn't reach back any further.
+    bool stepBack();
+
+    // steps back as often as given or possible, returns how often it did
+    size_t rewind(size_t steps);
+
+    // splits the board into bands of rows that are simulated in parallel,
+    // the results are the same for any number of threads
+    void setThreads(int threads);
+    int threads() const { return _pool ? _pool->size() : 1; }
 
     int rows() const { return _rows; }
     int cols() const { return _cols; }
 
-    const std::vector<Ball> &balls() const { return _balls; }
-    std::vector<Ball> &balls() { return _balls; }
+    BallView balls() const { return BallView(this); }
+    Ball ball(size_t i) const;
+    size_t ballCount() const { return _balls.size(); }
 
-    const std::vector<Tile> &tiles() const { return _tiles; }
-    std::vector<Tile> &tiles() { return _tiles; }
+    // index of the tile ball i is on, -1 for balls that left the board.
+    // cheaper than ball(i) for balls on plain track.
+    int64_t ballTile(size_t i) const;
+    BallType ballType(size_t i) const { return _balls.type[i]; }
 
-    const Tile &tile(int row, int col) const { return _tiles[col + row * _cols]; }
-    Tile &tile(int row, int col) { return _tiles[col + row * _cols]; }
+    Tile tile(int row, int col) const;
+
+    const TileGrid &packedTiles() const { return _tiles; }
 
 private:
+    PackedTile &at(int row, int col) { return _tiles.at(row, col); }
+    const PackedTile &at(int row, int col) const { return _tiles.at(row, col); }
+
+    void updateConnected(int row, int col);
+    void startTurning(int row, int col, RotorState state);
+    void stopTurning(size_t index);
+    void removeTurning(size_t slot);
+    size_t slotOf(size_t index) const;
+
+    double limitOf(const Ball &ball) const;
+    void attach(size_t i);
+    void attachRestored();
+    void refreshBalls();
+    uint64_t tileKey(size_t index) const;
+    uint64_t ballKey(size_t i) const;
+    void crossBall(size_t i, Band &band);
+    void finishRotor(size_t index, Band &band);
+    void simulate(double milliseconds, double time);
+    void advanceAll(double milliseconds);
+    void runBand(size_t band, double end, double time);
+    size_t bandOf(int row) const;
+    void splitBands();
+
+    void forgetHistory();
+    std::vector<uint8_t> &undoLog();
+    void logBall(std::vector<uint8_t> &log, size_t i) const;
+    void logTile(std::vector<uint8_t> &log, size_t index) const;
+    void logTurning(std::vector<uint8_t> &log) const;
+    void logAdvance(double milliseconds);
+    void collectUndo();
+    void undo(const uint8_t *begin, const uint8_t *end);
+
     int _rows;
     int _cols;
-    std::vector<Tile> _tiles;
-    std::vector<Ball> _balls;
+    TileGrid _tiles;
+    BallArrays _balls;
+
+    // one bit per ball, set for the balls that passed their limit this step
+    std::vector<uint64_t> _crossed;
+    // set when tiles changed under balls that may need a different limit
+    bool _limits_dirty = false;
+    uint64_t _board_revision = 0;
+
+    TrackGraph _track;
+
+    // all rotors that are currently turning
+    std::vector<TurningRotor> _turning;
+
+    std::vector<Band> _bands;
+    int _band_rows;
+    std::unique_ptr<ThreadPool> _pool;
+    // guards the track graph while bands run in parallel
+    std::mutex *_track_lock = nullptr;
+
+    double _now = 0.0;
+    uint64_t _hash = 0;
+    // set while the balls of a restored model wait for their first step to
+    // get onto their track segments, _restored_ball_hash is their part of
+    // the hash as the snapshot had it. anything that changes the keys of
+    // balls attaches them first.
+    bool _restored_balls = false;
+    uint64_t _restored_ball_hash = 0;
+
+    std::unique_ptr<History> _history;
 };
+
+inline Ball BallView::const_iterator::operator*() const { return _model->ball(_index); }
+inline size_t BallView::size() const { return _model->ballCount(); }
+inline Ball BallView::operator[](size_t i) const { return _model->ball(i); }
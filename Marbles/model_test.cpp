@@ -0,0 +1,728 @@
+#include "journal.hpp"
+#include "level.hpp"
+#include "model.hpp"
+#include "raster.hpp"
+#include "scenario.hpp"
+#include "snapshot.hpp"
+#include "solver.hpp"
+#include "static_level.hpp"
+#include "view.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <vector>
+
+// checks of what the model and the tools built on it promise in their
+// interfaces, run by ctest from the directory of the sources
+
+static constexpr double TICK = 1000.0 / 60.0;
+
+// levels/loops.txt, which has plain track, loops, a crossing and a full rotor
+static constexpr char LOOPS_BOARD[5][9] = {
+    "r-7     ",
+    "L-Jo r7 ",
+    "r7 or+J ",
+    "|| oLJ  ",
+    "LJ      ",
+};
+static constexpr const char *LOOPS_BALLS[] = {
+    "0 0 green exiting E",
+    "0 2 red exiting S",
+    "1 2 yellow exiting W",
+    "1 0 blue exiting N",
+    "2 0 green exiting S",
+    "2 1 red exiting W",
+    "4 1 yellow exiting N",
+    "4 0 blue exiting E",
+    "2 5 red exiting S",
+    "1 3 red inside 0",
+    "1 3 green inside 1",
+    "1 3 blue inside 2",
+    "1 3 yellow inside 3",
+};
+
+// the loops again, wider than a chunk of the binary form, with a rotor turned
+// and balls part way across their tiles
+static constexpr char ROUND_TRIP_LEVEL[] =
+    "board 7 70\n"
+    "r-7\n"
+    "L-Jo r7\n"
+    "r7 or+J                                                 r------7\n"
+    "|| oLJ                                                  |      |\n"
+    "LJ                                                      L------o\n"
+    "\n"
+    "                                                                     o\n"
+    "rotor 4 63 2\n"
+    "ball 0 0 green exiting E 0.25\n"
+    "ball 0 2 red exiting S\n"
+    "ball 1 2 yellow exiting W 0.125\n"
+    "ball 2 5 red exiting S\n"
+    "ball 1 3 red inside 0\n"
+    "ball 1 3 blue inside 2\n"
+    "ball 2 60 blue entering W 0.375\n"
+    "ball 4 63 green inside 1\n"
+    "ball 6 69 yellow inside 3\n";
+
+MARBLES_LEVEL(ROUND_TRIP_TABLE, ROUND_TRIP_LEVEL);
+
+static int g_failures = 0;
+
+static void check(bool ok, const char *test, const char *what) {
+    if (!ok) {
+        std::printf("%s: %s\n", test, what);
+        ++g_failures;
+    }
+}
+
+// the loops level n times across and down
+static bool tiled_loops(int n, Model &model) {
+    std::string text = "board " + std::to_string(5 * n) + " " + std::to_string(8 * n) + "\n";
+    for (int r = 0; r < 5 * n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            text += LOOPS_BOARD[r % 5];
+        }
+        text += "\n";
+    }
+
+    for (int r = 0; r < n; ++r) {
+        for (int c = 0; c < n; ++c) {
+            for (const char *ball : LOOPS_BALLS) {
+                int row, col;
+                char rest[32];
+                std::sscanf(ball, "%d %d %31[^\n]", &row, &col, rest);
+                text += "ball " + std::to_string(row + 5 * r) + " " + std::to_string(col + 8 * c) + " " + rest + "\n";
+            }
+        }
+    }
+
+    std::string error;
+    if (!parse_level(text.data(), text.size(), model, error)) {
+        std::printf("%s\n", error.c_str());
+        return false;
+    }
+    return true;
+}
+
+// rotors on every even row and column joined by straight track, full enough
+// that balls keep bouncing off rotors that are turning or taken
+static void rotor_board(int rows, int cols, Model &model) {
+    model.reset(rows, cols);
+    int type = 0;
+    for (int r = 0; r < rows; r += 2) {
+        for (int c = 0; c < cols; ++c) {
+            if (c % 2 == 0) {
+                model.setTile(r, c, TileType::Rotor);
+                for (int i = 0; i < 3; ++i) {
+                    model.addBall(Ball{ BallState::InsideRotor, (BallType)(type++ % 4), 0, r, c, i });
+                }
+            }
+            else if (c + 1 < cols) {
+                model.setTile(r, c, TileType::Horizontal);
+                model.addBall(Ball{ BallState::ExitingTowardsEast, (BallType)(type++ % 4), 0, r, c, 0 });
+            }
+        }
+        if (r + 2 < rows) {
+            for (int c = 0; c < cols; c += 2) {
+                model.setTile(r + 1, c, TileType::Vertical);
+            }
+        }
+    }
+}
+
+// rows of straight track with a rotor in each, running off the board or onto
+// empty tiles, so that every ball ends up caught or stopped
+static void runout_board(int rows, int cols, Model &model) {
+    model.reset(rows, cols);
+    int type = 0;
+    for (int r = 0; r < rows; ++r) {
+        int length = cols - r % 3;
+        int rotor = 3 + r % 7;
+        for (int c = 0; c < length; ++c) {
+            model.setTile(r, c, c == rotor ? TileType::Rotor : TileType::Horizontal);
+        }
+        model.addBall(Ball{ BallState::InsideRotor, (BallType)(type++ % 4), 0, r, rotor, r % 4 });
+        for (int c = r % 2; c < length; c += 3) {
+            if (c != rotor) {
+                BallState state = c % 4 == 1 ? BallState::ExitingTowardsWest : BallState::ExitingTowardsEast;
+                model.addBall(Ball{ state, (BallType)(type++ % 4), 0, r, c, 0 });
+            }
+        }
+    }
+}
+
+// turns a few rotors every now and then, the same ones for the same tick
+static void play(Model &model, int tick) {
+    if (tick % 20 != 0)
+        return;
+
+    for (int r = 0; r < model.rows(); ++r) {
+        for (int c = (tick / 20 + r) % 7; c < model.cols(); c += 7) {
+            if (model.tile(r, c).type == TileType::Rotor)
+                model.turnClockwise(r, c);
+        }
+    }
+}
+
+static bool same_board(const Model &a, const Model &b) {
+    std::shared_ptr<const Snapshot> x = Snapshot::capture(a);
+    std::shared_ptr<const Snapshot> y = Snapshot::capture(b);
+    return x->size() == y->size() && std::memcmp(x->data(), y->data(), x->size()) == 0;
+}
+
+// a model restored from a snapshot hashes like the model it was taken of,
+// wherever the balls got onto their track, and goes on the same way
+static void test_restored_hash(const char *test, Model &model) {
+    std::unique_ptr<Model> fork;
+    for (int tick = 0; tick < 600; ++tick) {
+        play(model, tick);
+        model.progress(TICK);
+        if (fork) {
+            play(*fork, tick);
+            fork->progress(TICK);
+            check(fork->hash() == model.hash(), test, "restored model went its own way");
+        }
+        if (tick % 50 != 0)
+            continue;
+
+        Model restored(Snapshot::capture(model));
+        Model again(Snapshot::capture(restored));
+        check(restored.hash() == model.hash() && again.hash() == model.hash(), test, "restored model hashes differently");
+        check(same_board(again, model), test, "snapshot of a restored model differs");
+        check(model.computeHash() == model.hash(), test, "hash differs from the one computed from scratch");
+        if (tick == 100)
+            fork.reset(new Model(Snapshot::capture(model)));
+
+        // capture fills in what reading the bytes back would find
+        std::shared_ptr<const Snapshot> captured = Snapshot::capture(model);
+        std::string error;
+        std::shared_ptr<const Snapshot> read = Snapshot::fromBytes(std::vector<uint8_t>(captured->data(), captured->data() + captured->size()), error);
+        check(read && read->rows() == captured->rows() && read->cols() == captured->cols() && read->now() == captured->now()
+            && read->tileHash() == captured->tileHash() && read->ballHash() == captured->ballHash() && read->storage() == captured->storage()
+            && read->turningCount() == captured->turningCount() && read->ballCount() == captured->ballCount(),
+            test, "captured snapshot differs from the one read back");
+        if (read)
+            check(same_board(Model(read), Model(captured)), test, "captured snapshot restores differently from the one read back");
+    }
+    check(same_board(*fork, model), test, "restored model ended up on another board");
+}
+
+// a snapshot taken right after an edit has the keys of balls on the old
+// track, the restored model goes on like the edited one all the same
+static void test_restored_after_edit(const char *test) {
+    Model edited(1, 1);
+    tiled_loops(10, edited);
+    for (int r = 1; r < edited.rows(); r += 5) {
+        edited.setTile(r, 1, TileType::Empty);
+    }
+
+    Model restored(Snapshot::capture(edited));
+    check(restored.hash() == edited.hash(), test, "restored model hashes differently");
+    for (int tick = 0; tick < 60; ++tick) {
+        edited.progress(TICK);
+        restored.progress(TICK);
+    }
+    check(restored.hash() == edited.hash() && restored.computeHash() == restored.hash(), test, "restored model went its own way");
+}
+
+// editing plain track drops the segments through the edited tiles, after
+// which the model goes on like one restored from scratch, whose segments are
+// all new
+static void test_track_edits(const char *test, Model &model) {
+    static constexpr TileType CYCLE[3] = { TileType::Horizontal, TileType::Crossing, TileType::Empty };
+
+    Model edited(Snapshot::capture(model));
+    for (int round = 0; round < 6; ++round) {
+        // the straight pieces of track that join the loops of every copy
+        for (int r = 1; r < edited.rows(); r += 5) {
+            for (int c = 1; c < edited.cols(); c += 8 * (1 + round % 2)) {
+                edited.setTile(r, c, CYCLE[(round + c / 8) % 3]);
+            }
+        }
+
+        Model restored(Snapshot::capture(edited));
+        for (int tick = 0; tick < 60; ++tick) {
+            edited.progress(TICK);
+            restored.progress(TICK);
+        }
+        check(edited.computeHash() == edited.hash(), test, "hash differs from the one computed from scratch");
+        check(same_board(edited, restored), test, "edited model goes on differently from a restored one");
+    }
+}
+
+// a model gives the same snapshots on any number of threads
+static void test_threads(const char *test, Model &model) {
+    Model single(Snapshot::capture(model));
+    Model parallel(Snapshot::capture(model));
+    parallel.setThreads(4);
+
+    for (int tick = 0; tick < 600; ++tick) {
+        play(single, tick);
+        single.progress(TICK);
+        play(parallel, tick);
+        parallel.progress(TICK);
+        if (tick % 25 == 0 && !same_board(single, parallel)) {
+            check(false, test, "snapshots on 1 and 4 threads differ");
+            return;
+        }
+    }
+    check(same_board(single, parallel), test, "snapshots on 1 and 4 threads differ");
+}
+
+// rewinding gives back the snapshot of every tick before, bit for bit
+static void test_rewind(const char *test, Model &model) {
+    static constexpr int TICKS = 300;
+
+    Model played(Snapshot::capture(model));
+    played.setThreads(4);
+    played.setHistory(64 << 20);
+
+    std::vector<std::shared_ptr<const Snapshot>> snapshots{ Snapshot::capture(played) };
+    for (int tick = 0; tick < TICKS; ++tick) {
+        play(played, tick);
+        played.progress(TICK);
+        snapshots.push_back(Snapshot::capture(played));
+    }
+
+    check(played.historyLength() == TICKS, test, "history doesn't keep every tick");
+    for (int tick = TICKS - 1; tick >= 0; --tick) {
+        if (!played.stepBack()) {
+            check(false, test, "history ends early");
+            return;
+        }
+        Model expected(snapshots[tick]);
+        if (!same_board(played, expected) || played.hash() != snapshots[tick]->tileHash() + snapshots[tick]->ballHash()) {
+            check(false, test, "rewound model differs from its snapshot");
+            return;
+        }
+    }
+    check(!played.stepBack(), test, "history goes back too far");
+}
+
+// a sparse world of more tiles than fit 32 bits, with rotors and track in
+// its far corner, runs like a small board
+static void test_huge_board(const char *test) {
+    static constexpr int SIZE = 70000;
+    static constexpr int TOP = SIZE - 9;
+    static constexpr int LEFT = SIZE - 41;
+
+    Model world(1, 1, TileStorage::Sparse);
+    world.reset(SIZE, SIZE);
+    int type = 0;
+    for (int r = TOP; r < SIZE; r += 2) {
+        for (int c = LEFT; c < SIZE; ++c) {
+            if ((c - LEFT) % 8 == 0) {
+                world.setTile(r, c, TileType::Rotor);
+                world.addBall(Ball{ BallState::InsideRotor, (BallType)(type++ % 4), 0, r, c, r % 4 });
+            }
+            else {
+                world.setTile(r, c, TileType::Horizontal);
+                if (c % 3 == 0)
+                    world.addBall(Ball{ BallState::ExitingTowardsEast, (BallType)(type++ % 4), 0, r, c, 0 });
+            }
+        }
+    }
+    check(world.ballTile(0) > UINT32_MAX, test, "tile index of a ball wraps around");
+
+    Model restored(Snapshot::capture(world));
+    for (int tick = 0; tick < 600; ++tick) {
+        for (Model *model : { &world, &restored }) {
+            if (tick % 40 == 0) {
+                for (int r = TOP; r < SIZE; r += 2) {
+                    model->turnClockwise(r, LEFT + 8 * (tick / 40 % 5));
+                }
+            }
+            model->progress(TICK);
+        }
+    }
+
+    check(world.hash() != 0 && world.computeHash() == world.hash(), test, "hash differs from the one computed from scratch");
+    check(world.tile(TOP, LEFT).rotor.position != 0, test, "rotor in the far corner didn't turn");
+    check(same_board(world, restored) && restored.hash() == world.hash(), test, "restored world went its own way");
+
+    size_t moved = 0;
+    for (size_t i = 0; i < world.ballCount(); ++i) {
+        Ball ball = world.ball(i);
+        if (ball.row >= TOP && ball.row < SIZE && ball.col >= LEFT && ball.col < SIZE && ball.state != BallState::InsideRotor)
+            ++moved;
+    }
+    check(moved > 0, test, "no ball moves in the far corner");
+}
+
+// balls that stop end up the same however long the steps are that take them
+// there. the longer steps end with advanceTo, so that all runs end at the
+// same time.
+static void test_step_sizes(const char *test) {
+    Model ticks(1, 1);
+    runout_board(40, 24, ticks);
+    std::shared_ptr<const Snapshot> start = Snapshot::capture(ticks);
+    for (int tick = 0; tick < 3600; ++tick) {
+        ticks.progress(TICK);
+    }
+
+    for (double step : { 500.0, 60000.0 }) {
+        Model stepped(start);
+        while (stepped.now() + step <= ticks.now()) {
+            stepped.progress(step);
+        }
+        stepped.advanceTo(ticks.now());
+        check(same_board(stepped, ticks), test, step < 1000.0 ? "500 ms steps end differently from ticks" : "a 60 s step ends differently from ticks");
+    }
+
+    for (size_t i = 0; i < ticks.ballCount(); ++i) {
+        Ball ball = ticks.ball(i);
+        if (ball.state != BallState::InsideRotor && ball.transition != 0.0) {
+            check(false, test, "stopped ball is past the edge of its tile");
+            return;
+        }
+    }
+}
+
+// one advanceTo a minute ahead comes to the same board as a minute of
+// ticks. balls that still move are allowed to differ by rounding, and the
+// minute is a tick longer than the thresholds line up with, so that none of
+// them sits right on one where rounding could put it on either side.
+static void test_advance_to(const char *test, Model &model) {
+    Model ticks(Snapshot::capture(model));
+    Model jumped(Snapshot::capture(model));
+    play(ticks, 0);
+    play(jumped, 0);
+    for (int tick = 0; tick < 3601; ++tick) {
+        ticks.progress(TICK);
+    }
+    jumped.advanceTo(ticks.now());
+
+    check(jumped.hash() == ticks.hash() && jumped.tileHash() == ticks.tileHash(), test, "advanceTo ends on another board than ticks");
+    for (size_t i = 0; i < ticks.ballCount(); ++i) {
+        Ball a = ticks.ball(i);
+        Ball b = jumped.ball(i);
+        if (a.row != b.row || a.col != b.col || a.state != b.state || std::fabs(a.transition - b.transition) > 1e-6) {
+            check(false, test, "advanceTo moves a ball elsewhere than ticks");
+            return;
+        }
+    }
+}
+
+// snapshots of sparse boards keep only their chunks and restore into the
+// same board as a dense one
+static void test_sparse_snapshot(const char *test) {
+    Model sparse(1, 1, TileStorage::Sparse);
+    rotor_board(61, 61, sparse);
+    for (int tick = 0; tick < 100; ++tick) {
+        play(sparse, tick);
+        sparse.progress(TICK);
+    }
+    test_restored_hash(test, sparse);
+
+    std::shared_ptr<const Snapshot> snapshot = Snapshot::capture(sparse);
+    std::string error;
+    std::shared_ptr<const Snapshot> copy = Snapshot::fromBytes(std::vector<uint8_t>(snapshot->data(), snapshot->data() + snapshot->size()), error);
+    check(copy != nullptr, test, "snapshot doesn't read back");
+    if (!copy)
+        return;
+
+    Model restored(copy);
+    Model dense(copy);
+    dense.setStorage(TileStorage::Dense);
+    check(restored.storage() == TileStorage::Sparse, test, "restored model isn't sparse");
+    check(restored.hash() == sparse.hash() && dense.hash() == sparse.hash(), test, "restored model hashes differently");
+    for (int r = 0; r < sparse.rows(); ++r) {
+        for (int c = 0; c < sparse.cols(); ++c) {
+            if (restored.packedTiles().at(r, c).bits != sparse.packedTiles().at(r, c).bits
+                || dense.packedTiles().at(r, c).bits != sparse.packedTiles().at(r, c).bits)
+            {
+                check(false, test, "restored tile differs");
+                return;
+            }
+        }
+    }
+
+    // a few tiles in a large world take a few chunks and the directory, 4
+    // bytes for every chunk rather than every tile
+    Model world(1, 1, TileStorage::Sparse);
+    world.reset(20000, 20000);
+    world.setTile(0, 0, TileType::Rotor);
+    world.setTile(19999, 19998, TileType::Horizontal);
+    world.setTile(19999, 19999, TileType::Rotor);
+    world.addBall(Ball{ BallState::InsideRotor, BallType::Red, 0, 19999, 19999, 3 });
+    snapshot = Snapshot::capture(world);
+    check(snapshot->size() < (4 << 20), test, "snapshot of a sparse world is dense");
+    Model again(snapshot);
+    check(same_board(again, world) && again.hash() == world.hash(), test, "sparse world restores differently");
+}
+
+// same board, rotor positions and balls, whatever the storage
+static bool same_level(const Model &a, const Model &b) {
+    if (a.rows() != b.rows() || a.cols() != b.cols() || a.hash() != b.hash() || a.ballCount() != b.ballCount())
+        return false;
+
+    for (int r = 0; r < a.rows(); ++r) {
+        for (int c = 0; c < a.cols(); ++c) {
+            if (a.packedTiles().at(r, c).bits != b.packedTiles().at(r, c).bits)
+                return false;
+        }
+    }
+    for (size_t i = 0; i < a.ballCount(); ++i) {
+        Ball x = a.ball(i);
+        Ball y = b.ball(i);
+        if (x.state != y.state || x.type != y.type || x.transition != y.transition || x.row != y.row || x.col != y.col
+            || (x.state == BallState::InsideRotor && x.rotor_position != y.rotor_position))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<uint8_t> read_file(const std::string &path) {
+    std::vector<uint8_t> bytes;
+    FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return bytes;
+    uint8_t buffer[4096];
+    size_t count;
+    while ((count = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        bytes.insert(bytes.end(), buffer, buffer + count);
+    }
+    std::fclose(file);
+    return bytes;
+}
+
+// a level reads the same from its text, at compile time, and back from both
+// of the forms it is saved in, into dense and sparse models alike
+static void test_level_round_trip(const char *test) {
+    std::string error;
+    Model text(1, 1);
+    if (!parse_level(ROUND_TRIP_LEVEL, sizeof(ROUND_TRIP_LEVEL) - 1, text, error)) {
+        check(false, test, error.c_str());
+        return;
+    }
+    check(text.tile(4, 63).rotor.position == 2, test, "rotor line didn't turn the rotor");
+
+    Model table(1, 1);
+    load_level(ROUND_TRIP_TABLE.table(), table);
+    check(same_level(table, text), test, "level parsed at compile time differs");
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path();
+    std::string binary = (dir / "marbles_test_level.bin").string();
+    std::string again = (dir / "marbles_test_level_again.bin").string();
+    std::string written = (dir / "marbles_test_level.txt").string();
+
+    Model dense(1, 1);
+    Model sparse(1, 1, TileStorage::Sparse);
+    bool loaded = save_level(binary.c_str(), text, error) && load_level(binary.c_str(), dense, error) && load_level(binary.c_str(), sparse, error);
+    check(loaded, test, error.c_str());
+    check(same_level(dense, text) && same_level(sparse, text), test, "binary level reads back differently");
+    check(save_level(again.c_str(), sparse, error) && read_file(again) == read_file(binary), test, "binary level saves differently once read back");
+
+    Model reread(1, 1);
+    loaded = save_level_text(written.c_str(), text, error) && load_level(written.c_str(), reread, error);
+    check(loaded, test, error.c_str());
+    check(same_level(reread, text), test, "text level reads back differently");
+
+    std::remove(binary.c_str());
+    std::remove(again.c_str());
+    std::remove(written.c_str());
+}
+
+// a recorded session replays with the hash it had at every tick, played
+// straight through or seeking back and forth between keyframes
+static void test_journal(const char *test, Model &model) {
+    static constexpr size_t TICKS = 600;
+
+    std::string path = (std::filesystem::temp_directory_path() / "marbles_test.jrnl").string();
+    Model played(Snapshot::capture(model));
+    JournalWriter writer;
+    std::string error;
+    if (!writer.open(path.c_str(), played, TICK, 100, error)) {
+        check(false, test, error.c_str());
+        return;
+    }
+
+    std::vector<uint64_t> hashes{ played.hash() };
+    for (size_t tick = 0; tick < TICKS; ++tick) {
+        if (tick % 20 == 0) {
+            for (int r = 0; r < played.rows(); ++r) {
+                for (int c = (int)(tick / 20 + r) % 7; c < played.cols(); c += 7) {
+                    if (played.tile(r, c).type != TileType::Rotor)
+                        continue;
+                    Command command{ played.now(), tick % 60 == 0 ? Action::EjectEast : Action::TurnClockwise, r, c };
+                    apply_command(played, command);
+                    writer.record(command);
+                }
+            }
+        }
+        played.progress(TICK);
+        writer.tick(played);
+        hashes.push_back(played.hash());
+    }
+    check(writer.close(error), test, error.c_str());
+
+    Replay replay;
+    if (!replay.load(path.c_str(), error)) {
+        check(false, test, error.c_str());
+        return;
+    }
+    check(replay.length() == TICKS, test, "replay has another length than the session");
+
+    bool same = replay.model().hash() == hashes[0];
+    while (same && replay.tick() < TICKS) {
+        replay.step();
+        same = replay.model().hash() == hashes[replay.tick()];
+    }
+    check(same, test, "replay hashes differently from the session");
+
+    for (size_t tick : { 450, 130, 599, 0, 301 }) {
+        replay.seek(tick);
+        if (replay.tick() != tick || replay.model().hash() != hashes[tick]) {
+            check(false, test, "seeking to a tick hashes differently from the session");
+            break;
+        }
+    }
+    std::remove(path.c_str());
+}
+
+// frames drawn from snapshots by a view that drew other frames before, like
+// the threads of marbles_render do, have the pixels a fresh view draws of the
+// model itself
+static void test_render(const char *test, Model &model) {
+    static constexpr int SIZE = 240;
+
+    Model played(Snapshot::capture(model));
+    Model restored(1, 1);
+    View reused(0.0, 0.0, (double)SIZE / played.cols());
+    RasterCanvas canvas(SIZE, SIZE);
+    bool drawn = false;
+
+    for (int tick = 0; tick < 300; ++tick) {
+        play(played, tick);
+        played.progress(TICK);
+        if (tick % 30 != 0)
+            continue;
+
+        restored.restore(Snapshot::capture(played));
+        canvas.clear(rgb(0, 0, 0));
+        reused.draw(canvas, restored, restored, 1.0, restored.boardRevision());
+
+        View fresh(0.0, 0.0, (double)SIZE / played.cols());
+        RasterCanvas expected(SIZE, SIZE);
+        expected.clear(rgb(0, 0, 0));
+        fresh.draw(expected, played, played, 1.0, played.boardRevision());
+
+        if (canvas.bytes() != expected.bytes() || std::memcmp(canvas.pixels(), expected.pixels(), canvas.bytes()) != 0) {
+            check(false, test, "frame of a restored model differs");
+            return;
+        }
+        for (size_t i = 0; i < expected.bytes() && !drawn; i += 4) {
+            drawn = expected.pixels()[i] != 0 || expected.pixels()[i + 1] != 0 || expected.pixels()[i + 2] != 0;
+        }
+    }
+    check(drawn, test, "frames are black");
+}
+
+// advances the model until nothing moves, like the solver does between moves
+static bool settle(Model &model) {
+    for (int step = 0; step < 240; ++step) {
+        model.advanceTo(model.now() + 250.0);
+        if (model.idle())
+            return true;
+    }
+    return false;
+}
+
+// the puzzles have a known shortest solution or none at all, the same on any
+// number of threads, and the moves found sort the balls when played
+static void test_solver(const char *test) {
+    std::vector<Scenario> scenarios;
+    std::string error;
+    if (!load_scenarios("scenarios/puzzles.txt", scenarios, error)) {
+        check(false, test, error.c_str());
+        return;
+    }
+    check(scenarios.size() == 2 && scenarios[0].name == "swap" && scenarios[1].name == "stuck", test, "puzzles aren't the expected ones");
+    if (scenarios.size() != 2)
+        return;
+
+    std::vector<Command> moves[2];
+    for (int threads : { 1, 4 }) {
+        SolverOptions options;
+        options.threads = threads;
+
+        Model swap(1, 1);
+        setup_scenario(swap, scenarios[0]);
+        SolverResult solved = solve(swap, options);
+        check(solved.solved && solved.moves.size() == 12, test, "swap isn't solved in 12 moves");
+        moves[threads > 1] = solved.moves;
+
+        Model stuck(1, 1);
+        setup_scenario(stuck, scenarios[1]);
+        SolverResult unsolved = solve(stuck, options);
+        check(!unsolved.solved && unsolved.exhausted, test, "stuck has a solution");
+    }
+
+    bool same = moves[0].size() == moves[1].size();
+    for (size_t k = 0; same && k < moves[0].size(); ++k) {
+        same = moves[0][k].time == moves[1][k].time && moves[0][k].action == moves[1][k].action
+            && moves[0][k].row == moves[1][k].row && moves[0][k].col == moves[1][k].col;
+    }
+    check(same, test, "solutions on 1 and 4 threads differ");
+
+    // moves are timed from the moment the board first settled
+    Model played(1, 1);
+    setup_scenario(played, scenarios[0]);
+    settle(played);
+    double start = played.now();
+    for (const Command &move : moves[0]) {
+        played.advanceTo(start + move.time);
+        apply_command(played, move);
+    }
+    check(settle(played) && rotors_sorted(played), test, "playing the solution doesn't sort the balls");
+}
+
+int main() {
+    Model loops(1, 1);
+    if (!tiled_loops(40, loops))
+        return 1;
+    test_restored_hash("restored hash, loops", loops);
+    test_track_edits("track edits, loops", loops);
+
+    Model rotors(1, 1);
+    rotor_board(61, 61, rotors);
+    test_restored_hash("restored hash, rotors", rotors);
+
+    test_sparse_snapshot("sparse snapshot");
+    test_level_round_trip("level round trip");
+    test_restored_after_edit("restored after an edit");
+    test_step_sizes("step sizes");
+    test_huge_board("huge board");
+
+    Model loops_start(1, 1);
+    tiled_loops(40, loops_start);
+    Model rotors_start(1, 1);
+    rotor_board(121, 61, rotors_start);
+    test_threads("threads, loops", loops_start);
+    test_threads("threads, rotors", rotors_start);
+    test_rewind("rewind, loops", loops_start);
+    test_rewind("rewind, rotors", rotors_start);
+    test_advance_to("advanceTo, loops", loops_start);
+    test_advance_to("advanceTo, rotors", rotors_start);
+    Model runout(1, 1);
+    runout_board(40, 24, runout);
+    test_advance_to("advanceTo, runout", runout);
+    test_journal("journal, loops", loops_start);
+    test_journal("journal, rotors", rotors_start);
+    test_render("render, loops", loops_start);
+    test_render("render, rotors", rotors_start);
+
+    test_solver("solver");
+
+    if (g_failures > 0) {
+        std::printf("%d checks failed\n", g_failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
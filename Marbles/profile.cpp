@@ -0,0 +1,228 @@
+#include "profile.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+struct TraceEvent {
+    const char *name;
+    double begin;
+    double duration;
+    // counters have a value instead of a duration
+    uint64_t value;
+    bool counter;
+};
+
+// what a thread recorded, guarded by mutex against readers on other threads
+struct ThreadLog {
+    std::mutex mutex;
+    int id = 0;
+    std::string name;
+    // a ring once it is full, next is the oldest event then
+    std::vector<TraceEvent> events;
+    size_t next = 0;
+    std::vector<Profiler::Total> totals;
+};
+
+// logs of all threads that ever recorded anything, kept until the program
+// ends so that the logs of threads that are done still make it into traces
+static std::mutex g_logs_mutex;
+static std::vector<std::unique_ptr<ThreadLog>> g_logs;
+
+static std::atomic<uint64_t> g_counters[(int)Counter::Count];
+static std::atomic<uint64_t> g_sampled[(int)Counter::Count];
+
+static ThreadLog &thread_log() {
+    thread_local ThreadLog *log = nullptr;
+    if (!log) {
+        std::lock_guard<std::mutex> lock(g_logs_mutex);
+        g_logs.emplace_back(new ThreadLog);
+        log = g_logs.back().get();
+        log->id = (int)g_logs.size();
+    }
+    return *log;
+}
+
+static void push(ThreadLog &log, const TraceEvent &event) {
+    if (log.events.size() < Profiler::MAX_EVENTS) {
+        log.events.push_back(event);
+        return;
+    }
+    log.events[log.next] = event;
+    log.next = (log.next + 1) % Profiler::MAX_EVENTS;
+}
+
+// names are string literals, the same one may have several addresses
+static Profiler::Total &total_of(std::vector<Profiler::Total> &totals, const char *name) {
+    for (Profiler::Total &total : totals) {
+        if (total.name == name || std::strcmp(total.name, name) == 0)
+            return total;
+    }
+    totals.push_back(Profiler::Total{ name, 0.0, 0 });
+    return totals.back();
+}
+
+static void write_string(FILE *file, const char *text) {
+    std::fputc('"', file);
+    for (const char *c = text; *c; ++c) {
+        if (*c == '"' || *c == '\\')
+            std::fputc('\\', file);
+        if ((unsigned char)*c >= 0x20)
+            std::fputc(*c, file);
+    }
+    std::fputc('"', file);
+}
+
+const char *counter_name(Counter counter) {
+    switch (counter) {
+    case Counter::BallsAdvanced:
+        return "balls advanced";
+    case Counter::TileTransitions:
+        return "tile transitions";
+    case Counter::RotorCaptures:
+        return "rotor captures";
+    case Counter::Bounces:
+        return "bounces";
+    default:
+        return "?";
+    }
+}
+
+double Profiler::now() {
+    static const std::chrono::steady_clock::time_point START = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - START).count();
+}
+
+void Profiler::record(const char *name, double begin, double end) {
+    ThreadLog &log = thread_log();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    push(log, TraceEvent{ name, begin, end - begin, 0, false });
+
+    Total &total = total_of(log.totals, name);
+    total.microseconds += end - begin;
+    ++total.calls;
+}
+
+void Profiler::count(Counter counter, uint64_t n) {
+    g_counters[(int)counter].fetch_add(n, std::memory_order_relaxed);
+}
+
+void Profiler::sample() {
+    ThreadLog &log = thread_log();
+    double time = now();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    for (int c = 0; c < (int)Counter::Count; ++c) {
+        uint64_t total = g_counters[c].load(std::memory_order_relaxed);
+        uint64_t delta = total - g_sampled[c].exchange(total, std::memory_order_relaxed);
+        push(log, TraceEvent{ counter_name((Counter)c), time, 0.0, delta, true });
+    }
+}
+
+void Profiler::nameThread(const char *name) {
+    ThreadLog &log = thread_log();
+    std::lock_guard<std::mutex> lock(log.mutex);
+    log.name = name;
+}
+
+std::vector<Profiler::Total> Profiler::totals() {
+    std::vector<Total> totals;
+    std::lock_guard<std::mutex> logs_lock(g_logs_mutex);
+    for (const auto &log : g_logs) {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        for (const Total &total : log->totals) {
+            Total &sum = total_of(totals, total.name);
+            sum.microseconds += total.microseconds;
+            sum.calls += total.calls;
+        }
+    }
+    return totals;
+}
+
+uint64_t Profiler::counterTotal(Counter counter) {
+    return g_counters[(int)counter].load(std::memory_order_relaxed);
+}
+
+bool Profiler::writeTrace(const char *path, std::string &error) {
+    FILE *file = std::fopen(path, "wb");
+    if (!file) {
+        error = std::string(path) + ": cannot create file";
+        return false;
+    }
+
+    bool first = true;
+    auto separate = [&] {
+        std::fputs(first ? "\n" : ",\n", file);
+        first = false;
+    };
+
+    std::fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", file);
+    std::lock_guard<std::mutex> logs_lock(g_logs_mutex);
+    for (const auto &log : g_logs) {
+        std::lock_guard<std::mutex> lock(log->mutex);
+        if (!log->name.empty()) {
+            separate();
+            std::fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", log->id);
+            write_string(file, log->name.c_str());
+            std::fputs("}}", file);
+        }
+
+        // oldest first
+        for (size_t k = 0; k < log->events.size(); ++k) {
+            const TraceEvent &event = log->events[(log->next + k) % log->events.size()];
+            separate();
+            std::fputs("{\"name\":", file);
+            write_string(file, event.name);
+            if (event.counter) {
+                std::fprintf(file, ",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%llu}}",
+                    event.begin, log->id, (unsigned long long)event.value);
+            }
+            else {
+                std::fprintf(file, ",\"cat\":\"marbles\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%d}",
+                    event.begin, event.duration, log->id);
+            }
+        }
+    }
+    std::fputs("\n]}\n", file);
+
+    bool written = !std::ferror(file);
+    if (std::fclose(file) != 0 || !written) {
+        error = std::string(path) + ": cannot write file";
+        return false;
+    }
+    return true;
+}
+
+int FrameHistogram::bucketOf(double milliseconds) {
+    return std::min(BUCKETS - 1, std::max(0, (int)(milliseconds / BUCKET_MS)));
+}
+
+void FrameHistogram::add(double milliseconds) {
+    if (_size == FRAMES)
+        --_counts[bucketOf(_times[_next])];
+    else
+        ++_size;
+
+    _times[_next] = milliseconds;
+    ++_counts[bucketOf(milliseconds)];
+    _next = (_next + 1) % FRAMES;
+}
+
+double FrameHistogram::average() const {
+    double sum = 0.0;
+    for (int k = 0; k < _size; ++k) {
+        sum += _times[k];
+    }
+    return _size > 0 ? sum / _size : 0.0;
+}
+
+double FrameHistogram::worst() const {
+    double worst = 0.0;
+    for (int k = 0; k < _size; ++k) {
+        worst = std::max(worst, _times[k]);
+    }
+    return worst;
+}
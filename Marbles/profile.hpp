@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped timers and counters that show where the time of a tick or a frame
+// goes. They are only compiled in when MARBLES_PROFILE is defined, the CMake
+// option of the same name, and cost nothing otherwise:
+//
+//   void Model::simulate(...) {
+//       PROFILE_SCOPE("simulate");
+//       ...
+//       PROFILE_COUNT(RotorCaptures, 1);
+//
+// PROFILE_PHASES(timer) and PROFILE_PHASE(timer, name) time the parts of a
+// function without a block for each.
+//
+// Every thread keeps the most recent timings in a ring of its own, which
+// Profiler::writeTrace saves in the trace event format of Chrome's
+// about://tracing and Perfetto. Totals per scope and counter are kept as
+// well, for overlays that show the last second or so.
+
+enum class Counter : uint8_t {
+    // balls moved by a step, whether they passed a threshold or not
+    BallsAdvanced,
+    // balls that passed a threshold and moved on to their next state, or left
+    // a stretch of plain track, balls that go round a loop of track have none
+    TileTransitions,
+    // balls that entered a rotor
+    RotorCaptures,
+    // balls that bounced off a rotor that was turning or had their position
+    // taken
+    Bounces,
+    Count,
+};
+
+const char *counter_name(Counter counter);
+
+class Profiler {
+public:
+    static constexpr bool ENABLED =
+#ifdef MARBLES_PROFILE
+        true;
+#else
+        false;
+#endif
+
+    // timings each thread keeps, older ones are dropped
+    static constexpr size_t MAX_EVENTS = 1 << 18;
+
+    struct Total {
+        const char *name;
+        double microseconds;
+        uint64_t calls;
+    };
+
+    // microseconds since the program started
+    static double now();
+
+    // a scope of the calling thread that ran from begin to end
+    static void record(const char *name, double begin, double end);
+    static void count(Counter counter, uint64_t n);
+    // adds the counters, as much as they went up since the last sample, to
+    // the trace of the calling thread
+    static void sample();
+    // names the calling thread in the trace
+    static void nameThread(const char *name);
+
+    // time spent in every scope so far, summed over all threads
+    static std::vector<Total> totals();
+    static uint64_t counterTotal(Counter counter);
+
+    static bool writeTrace(const char *path, std::string &error);
+};
+
+class ScopedTimer {
+public:
+    explicit ScopedTimer(const char *name) : _name(name), _begin(Profiler::now()) { }
+    ~ScopedTimer() { Profiler::record(_name, _begin, Profiler::now()); }
+
+    ScopedTimer(const ScopedTimer &) = delete;
+    ScopedTimer &operator=(const ScopedTimer &) = delete;
+
+private:
+    const char *_name;
+    double _begin;
+};
+
+// Times the phases of a function one after the other, each one ends where
+// the next one begins and the last one with the function.
+class PhaseTimer {
+public:
+    PhaseTimer() = default;
+    ~PhaseTimer() { end(); }
+
+    PhaseTimer(const PhaseTimer &) = delete;
+    PhaseTimer &operator=(const PhaseTimer &) = delete;
+
+    void begin(const char *name) {
+        double now = Profiler::now();
+        if (_name)
+            Profiler::record(_name, _begin, now);
+        _name = name;
+        _begin = now;
+    }
+
+    void end() {
+        if (_name)
+            Profiler::record(_name, _begin, Profiler::now());
+        _name = nullptr;
+    }
+
+private:
+    const char *_name = nullptr;
+    double _begin = 0.0;
+};
+
+// Frame times of the last FRAMES frames, sorted into buckets of BUCKET_MS
+// milliseconds, the last bucket takes all longer ones.
+class FrameHistogram {
+public:
+    static constexpr int FRAMES = 240;
+    static constexpr int BUCKETS = 17;
+    static constexpr double BUCKET_MS = 2.0;
+
+    void add(double milliseconds);
+
+    int frames() const { return _size; }
+    int count(int bucket) const { return _counts[bucket]; }
+    double average() const;
+    double worst() const;
+
+private:
+    static int bucketOf(double milliseconds);
+
+    double _times[FRAMES] = {};
+    int _next = 0;
+    int _size = 0;
+    int _counts[BUCKETS] = {};
+};
+
+#ifdef MARBLES_PROFILE
+#define PROFILE_JOIN2(a, b) a##b
+#define PROFILE_JOIN(a, b) PROFILE_JOIN2(a, b)
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_JOIN(profile_scope_, __LINE__)(name)
+#define PROFILE_PHASES(timer) PhaseTimer timer
+#define PROFILE_PHASE(timer, name) timer.begin(name)
+#define PROFILE_COUNT(counter, n) Profiler::count(Counter::counter, (n))
+#define PROFILE_SAMPLE() Profiler::sample()
+#define PROFILE_THREAD(name) Profiler::nameThread(name)
+#else
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_PHASES(timer) ((void)0)
+#define PROFILE_PHASE(timer, name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_SAMPLE() ((void)0)
+#define PROFILE_THREAD(name) ((void)0)
+#endif
@@ -0,0 +1,302 @@
+#include "raster.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+static uint8_t channel(float value) {
+    return (uint8_t)std::lround(std::min(std::max(value, 0.0f), 1.0f) * 255.0f);
+}
+
+static uint32_t pack(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    uint8_t bytes[4] = { r, g, b, a };
+    uint32_t pixel;
+    std::memcpy(&pixel, bytes, sizeof(pixel));
+    return pixel;
+}
+
+static uint32_t pack(Color color) {
+    return pack(channel(color.r), channel(color.g), channel(color.b), channel(color.a));
+}
+
+static uint8_t alpha_of(uint32_t pixel) {
+    uint8_t bytes[4];
+    std::memcpy(bytes, &pixel, sizeof(pixel));
+    return bytes[3];
+}
+
+// src + dst * (1 - alpha of src), what Allegro's default blender does
+static uint32_t blend(uint32_t src, uint32_t dst) {
+    uint8_t s[4];
+    uint8_t d[4];
+    std::memcpy(s, &src, sizeof(src));
+    std::memcpy(d, &dst, sizeof(dst));
+    for (int k = 0; k < 4; ++k) {
+        d[k] = (uint8_t)std::min(255, s[k] + (d[k] * (255 - s[3]) + 127) / 255);
+    }
+    uint32_t pixel;
+    std::memcpy(&pixel, d, sizeof(pixel));
+    return pixel;
+}
+
+RasterCanvas::RasterCanvas(int width, int height) :
+    _width(width), _height(height),
+    _target((size_t)width * height, 0),
+    _pixels(&_target)
+{
+}
+
+void RasterCanvas::clear(Color color) {
+    std::fill(_pixels->begin(), _pixels->end(), pack(color));
+}
+
+void RasterCanvas::plot(int x, int y, uint32_t color, uint8_t alpha) {
+    uint32_t &pixel = (*_pixels)[x + (size_t)y * _width];
+    if (alpha == 255)
+        pixel = color;
+    else if (alpha != 0)
+        pixel = blend(color, pixel);
+}
+
+void RasterCanvas::drawTriangles(const Vertex *vertices, const int *indices, size_t count) {
+    for (size_t i = 0; i + 2 < count; i += 3) {
+        fillTriangle(vertices[indices[i]], vertices[indices[i + 1]], vertices[indices[i + 2]]);
+    }
+}
+
+void RasterCanvas::drawLines(const Vertex *vertices, const int *indices, size_t count) {
+    for (size_t i = 0; i + 1 < count; i += 2) {
+        drawLine(vertices[indices[i]], vertices[indices[i + 1]]);
+    }
+}
+
+// how far p is to the side of the edge from a to b, 0 on it
+static double edge(double ax, double ay, double bx, double by, double px, double py) {
+    return (bx - ax) * (py - ay) - (by - ay) * (px - ax);
+}
+
+// of the two triangles that share an edge the pixels on it go to the one
+// that has it in this direction, the other has it the other way round
+static bool owns_edge(double ax, double ay, double bx, double by) {
+    return by < ay || (by == ay && bx > ax);
+}
+
+void RasterCanvas::fillTriangle(const Vertex &a, const Vertex &b, const Vertex &c) {
+    double x[3] = { a.x, b.x, c.x };
+    double y[3] = { a.y, b.y, c.y };
+
+    double area = edge(x[0], y[0], x[1], y[1], x[2], y[2]);
+    if (area == 0.0)
+        return;
+    // the same winding for every triangle, inside is where all edges are
+    // positive
+    if (area < 0.0) {
+        std::swap(x[1], x[2]);
+        std::swap(y[1], y[2]);
+    }
+
+    int left = std::max(0, (int)std::floor(std::min({ x[0], x[1], x[2] })));
+    int top = std::max(0, (int)std::floor(std::min({ y[0], y[1], y[2] })));
+    int right = std::min(_width, (int)std::ceil(std::max({ x[0], x[1], x[2] })));
+    int bottom = std::min(_height, (int)std::ceil(std::max({ y[0], y[1], y[2] })));
+
+    bool owns[3];
+    for (int k = 0; k < 3; ++k) {
+        owns[k] = owns_edge(x[k], y[k], x[(k + 1) % 3], y[(k + 1) % 3]);
+    }
+
+    uint32_t color = pack(a.color);
+    uint8_t alpha = alpha_of(color);
+    for (int py = top; py < bottom; ++py) {
+        double cy = py + 0.5;
+        for (int px = left; px < right; ++px) {
+            double cx = px + 0.5;
+            bool inside = true;
+            for (int k = 0; k < 3 && inside; ++k) {
+                double e = edge(x[k], y[k], x[(k + 1) % 3], y[(k + 1) % 3], cx, cy);
+                inside = e > 0.0 || (e == 0.0 && owns[k]);
+            }
+            if (inside)
+                plot(px, py, color, alpha);
+        }
+    }
+}
+
+// the pixels the line passes through, one per step along its longer side
+void RasterCanvas::drawLine(const Vertex &a, const Vertex &b) {
+    double dx = b.x - a.x;
+    double dy = b.y - a.y;
+    int steps = (int)std::ceil(std::max(std::fabs(dx), std::fabs(dy)));
+
+    uint32_t color = pack(a.color);
+    uint8_t alpha = alpha_of(color);
+    for (int k = 0; k <= steps; ++k) {
+        double t = steps == 0 ? 0.0 : (double)k / steps;
+        int px = (int)std::floor(a.x + t * dx);
+        int py = (int)std::floor(a.y + t * dy);
+        if (px >= 0 && px < _width && py >= 0 && py < _height)
+            plot(px, py, color, alpha);
+    }
+}
+
+void RasterCanvas::beginLayer() {
+    _layer.assign((size_t)_width * _height, 0);
+    _pixels = &_layer;
+}
+
+void RasterCanvas::endLayer() {
+    _pixels = &_target;
+}
+
+void RasterCanvas::drawLayer() {
+    if (_layer.size() != _target.size())
+        return;
+
+    for (size_t i = 0; i < _target.size(); ++i) {
+        uint8_t alpha = alpha_of(_layer[i]);
+        if (alpha == 255)
+            _target[i] = _layer[i];
+        else if (alpha != 0)
+            _target[i] = blend(_layer[i], _target[i]);
+    }
+}
+
+static bool close_file(FILE *file, bool written, const char *path, std::string &error) {
+    if (std::fclose(file) != 0)
+        written = false;
+    if (!written) {
+        error = std::string(path) + ": cannot write file";
+        return false;
+    }
+    return true;
+}
+
+bool write_ppm(const char *path, const uint8_t *pixels, int width, int height, std::string &error) {
+    FILE *file = std::fopen(path, "wb");
+    if (!file) {
+        error = std::string(path) + ": cannot create file";
+        return false;
+    }
+
+    std::vector<uint8_t> row((size_t)width * 3);
+    bool written = std::fprintf(file, "P6\n%d %d\n255\n", width, height) > 0;
+    for (int y = 0; y < height && written; ++y) {
+        const uint8_t *line = pixels + (size_t)y * width * 4;
+        for (int x = 0; x < width; ++x) {
+            row[x * 3] = line[x * 4];
+            row[x * 3 + 1] = line[x * 4 + 1];
+            row[x * 3 + 2] = line[x * 4 + 2];
+        }
+        written = std::fwrite(row.data(), 1, row.size(), file) == row.size();
+    }
+    return close_file(file, written, path, error);
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t *data, size_t size) {
+    static const std::array<uint32_t, 256> TABLE = [] {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; ++k) {
+                c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            table[n] = c;
+        }
+        return table;
+    }();
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc = TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+static uint32_t adler32(const uint8_t *data, size_t size) {
+    // bytes that can be summed before the sums may overflow
+    static constexpr size_t RUN = 5552;
+
+    uint32_t a = 1, b = 0;
+    while (size > 0) {
+        size_t run = std::min(size, RUN);
+        for (size_t i = 0; i < run; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += run;
+        size -= run;
+    }
+    return b << 16 | a;
+}
+
+static void put_be32(std::vector<uint8_t> &out, uint32_t value) {
+    out.push_back((uint8_t)(value >> 24));
+    out.push_back((uint8_t)(value >> 16));
+    out.push_back((uint8_t)(value >> 8));
+    out.push_back((uint8_t)value);
+}
+
+// length, type, data and the CRC of type and data
+static void put_chunk(std::vector<uint8_t> &out, const char *type, const std::vector<uint8_t> &data) {
+    put_be32(out, (uint32_t)data.size());
+    size_t start = out.size();
+    out.insert(out.end(), type, type + 4);
+    out.insert(out.end(), data.begin(), data.end());
+    put_be32(out, crc32(0, &out[start], out.size() - start));
+}
+
+bool write_png(const char *path, const uint8_t *pixels, int width, int height, std::string &error) {
+    static constexpr uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    // the most a stored deflate block holds
+    static constexpr size_t BLOCK = 65535;
+
+    std::vector<uint8_t> header;
+    put_be32(header, (uint32_t)width);
+    put_be32(header, (uint32_t)height);
+    // 8 bits per channel, RGBA, deflate, filter method 0, not interlaced
+    header.insert(header.end(), { 8, 6, 0, 0, 0 });
+
+    // every row starts with filter type 0, none
+    size_t stride = (size_t)width * 4;
+    std::vector<uint8_t> raw;
+    raw.reserve((stride + 1) * height);
+    for (int y = 0; y < height; ++y) {
+        raw.push_back(0);
+        raw.insert(raw.end(), pixels + y * stride, pixels + (y + 1) * stride);
+    }
+
+    // a zlib stream of stored blocks and the Adler-32 of the rows
+    std::vector<uint8_t> data = { 0x78, 0x01 };
+    data.reserve(raw.size() + raw.size() / BLOCK * 5 + 16);
+    size_t offset = 0;
+    do {
+        size_t size = std::min(BLOCK, raw.size() - offset);
+        bool last = offset + size == raw.size();
+        data.insert(data.end(), { (uint8_t)last, (uint8_t)size, (uint8_t)(size >> 8), (uint8_t)~size, (uint8_t)(~size >> 8) });
+        data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + size);
+        offset += size;
+    } while (offset < raw.size());
+
+    put_be32(data, adler32(raw.data(), raw.size()));
+
+    std::vector<uint8_t> png(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+    put_chunk(png, "IHDR", header);
+    put_chunk(png, "IDAT", data);
+    put_chunk(png, "IEND", {});
+
+    FILE *file = std::fopen(path, "wb");
+    if (!file) {
+        error = std::string(path) + ": cannot create file";
+        return false;
+    }
+    bool written = std::fwrite(png.data(), 1, png.size(), file) == png.size();
+    return close_file(file, written, path, error);
+}
+
+bool write_raw(FILE *file, const uint8_t *pixels, int width, int height) {
+    size_t size = (size_t)width * height * 4;
+    return std::fwrite(pixels, 1, size, file) == size;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "canvas.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Canvas in memory, 8 bit RGBA row by row from the top, for drawing without
+// a display. Triangles cover the pixels whose centers are inside them, and
+// pixels on an edge two triangles share go to one of them, so that meshes
+// are drawn without gaps or overlaps. Colors are blended like Allegro's
+// default blender does, which leaves opaque colors as they are.
+class RasterCanvas : public Canvas {
+public:
+    RasterCanvas(int width, int height);
+
+    void clear(Color color);
+
+    // width * height * 4 bytes
+    const uint8_t *pixels() const { return reinterpret_cast<const uint8_t *>(_target.data()); }
+    size_t bytes() const { return _target.size() * 4; }
+
+    int width() const override { return _width; }
+    int height() const override { return _height; }
+
+    void drawTriangles(const Vertex *vertices, const int *indices, size_t count) override;
+    void drawLines(const Vertex *vertices, const int *indices, size_t count) override;
+
+    void beginLayer() override;
+    void endLayer() override;
+    void drawLayer() override;
+
+private:
+    void fillTriangle(const Vertex &a, const Vertex &b, const Vertex &c);
+    void drawLine(const Vertex &a, const Vertex &b);
+    void plot(int x, int y, uint32_t color, uint8_t alpha);
+
+    int _width;
+    int _height;
+    // pixels as their four bytes in memory, so that they read as RGBA
+    std::vector<uint32_t> _target;
+    std::vector<uint32_t> _layer;
+    std::vector<uint32_t> *_pixels;
+};
+
+// images of width * height RGBA pixels, row by row from the top
+
+// a binary PPM, which leaves out the alpha
+bool write_ppm(const char *path, const uint8_t *pixels, int width, int height, std::string &error);
+
+// a PNG with the pixels in stored deflate blocks, which needs no compression
+// library and writes about as fast as the disk does
+bool write_png(const char *path, const uint8_t *pixels, int width, int height, std::string &error);
+
+// appends the pixels to a stream of raw frames, which tools like ffmpeg read
+// with -f rawvideo -pixel_format rgba
+bool write_raw(FILE *file, const uint8_t *pixels, int width, int height);
@@ -0,0 +1,310 @@
+#include "hash.hpp"
+#include "journal.hpp"
+#include "level.hpp"
+#include "profile.hpp"
+#include "raster.hpp"
+#include "thread_pool.hpp"
+#include "view.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+static constexpr double TICK = 1000.0 / 60.0;
+
+static void usage(const char *name) {
+    std::fprintf(stderr,
+        "usage: %s [options] LEVEL|JOURNAL\n"
+        "  --size WxH      size of the frames in pixels (default 800x600)\n"
+        "  --tile W        pixels per tile (default: the board fills the frame)\n"
+        "  --frames N      number of frames (default 1, or the whole session of a journal)\n"
+        "  --every N       ticks from one frame to the next (default 1)\n"
+        "  --threads N     threads that draw frames (default: one per core)\n"
+        "  --out PATTERN   writes frame k to PATTERN with %%d for k, or %%04d for k padded with\n"
+        "                  zeros, as PNG or PPM by extension\n"
+        "  --raw FILE      writes the frames as one stream of raw RGBA, - for stdout\n"
+        "  --checksum      prints a hash of every frame\n"
+        "  --trace FILE    saves where the time went as a Chrome trace, in builds with MARBLES_PROFILE\n"
+        "draws a level as it plays, or a session recorded with marbles --record, without a display\n",
+        name);
+}
+
+// the board as of a frame
+struct Pending {
+    std::shared_ptr<const Snapshot> snapshot;
+    uint64_t board;
+    size_t tick;
+};
+
+// what a thread needs to draw frames
+struct Painter {
+    Painter(int width, int height, double x, double y, double w) :
+        model(1, 1), view(x, y, w), canvas(width, height)
+    {
+    }
+
+    Model model;
+    View view;
+    RasterCanvas canvas;
+};
+
+// an --out pattern split around its %d, which may have a width padded with
+// zeros like %05d. %% stands for a %.
+struct FramePattern {
+    std::string prefix;
+    std::string suffix;
+    int width = 0;
+};
+
+// false unless the pattern has exactly one %d and no other conversion
+static bool parse_pattern(const char *pattern, FramePattern &frame) {
+    bool number = false;
+    for (const char *c = pattern; *c; ++c) {
+        std::string &part = number ? frame.suffix : frame.prefix;
+        if (*c != '%') {
+            part += *c;
+            continue;
+        }
+        if (c[1] == '%') {
+            part += '%';
+            ++c;
+            continue;
+        }
+
+        const char *d = c + 1;
+        if (*d == '0') {
+            ++d;
+            while (*d >= '0' && *d <= '9' && frame.width < 100) {
+                frame.width = frame.width * 10 + (*d++ - '0');
+            }
+        }
+        if (number || *d != 'd')
+            return false;
+
+        number = true;
+        c = d;
+    }
+    return number;
+}
+
+static std::string frame_name(const FramePattern &frame, size_t k) {
+    char number[32];
+    std::snprintf(number, sizeof(number), "%0*zu", frame.width, k);
+    return frame.prefix + number + frame.suffix;
+}
+
+static bool is_journal(const char *path) {
+    FILE *file = std::fopen(path, "rb");
+    if (!file)
+        return false;
+
+    char magic[8] = {};
+    bool journal = std::fread(magic, 1, sizeof(magic), file) == sizeof(magic) && std::memcmp(magic, "MRBLJRNL", 8) == 0;
+    std::fclose(file);
+    return journal;
+}
+
+int main(int argc, char **argv) {
+    int width = 800;
+    int height = 600;
+    double tile = 0.0;
+    size_t frames = 0;
+    size_t every = 1;
+    int threads = (int)std::max(1u, std::thread::hardware_concurrency());
+    const char *pattern = nullptr;
+    FramePattern frame;
+    const char *raw_path = nullptr;
+    bool checksum = false;
+    const char *trace_path = nullptr;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (std::sscanf(argv[++i], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--tile") == 0 && i + 1 < argc) {
+            tile = std::atof(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = (size_t)std::atoll(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+            every = std::max<size_t>(1, (size_t)std::atoll(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::max(1, std::atoi(argv[++i]));
+        }
+        else if (std::strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            pattern = argv[++i];
+            if (!parse_pattern(pattern, frame)) {
+                std::fprintf(stderr, "--out needs a pattern with exactly one %%d\n");
+                return 1;
+            }
+        }
+        else if (std::strcmp(argv[i], "--raw") == 0 && i + 1 < argc) {
+            raw_path = argv[++i];
+        }
+        else if (std::strcmp(argv[i], "--checksum") == 0) {
+            checksum = true;
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else if (argv[i][0] == '-' || path) {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (trace_path && !Profiler::ENABLED) {
+        std::fprintf(stderr, "--trace needs a build with MARBLES_PROFILE\n");
+        return 1;
+    }
+    PROFILE_THREAD("render");
+
+    // a journal is replayed, a level simulated from its start
+    std::string error;
+    Replay replay;
+    std::unique_ptr<Model> level;
+    if (is_journal(path)) {
+        if (!replay.load(path, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        if (frames == 0)
+            frames = replay.length() / every + 1;
+    }
+    else {
+        level.reset(new Model(1, 1));
+        if (!load_level(path, *level, error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return 1;
+        }
+        if (frames == 0)
+            frames = 1;
+    }
+    Model &model = level ? *level : replay.model();
+
+    FILE *raw = nullptr;
+    if (raw_path) {
+        raw = std::strcmp(raw_path, "-") == 0 ? stdout : std::fopen(raw_path, "wb");
+        if (!raw) {
+            std::fprintf(stderr, "%s: cannot create file\n", raw_path);
+            return 1;
+        }
+    }
+
+    // the whole board in the middle of the frame unless the tile size is given
+    if (tile <= 0.0)
+        tile = std::min((double)width / model.cols(), (double)height / model.rows());
+    double x = (width - model.cols() * tile) / 2.0;
+    double y = (height - model.rows() * tile) / 2.0;
+
+    ThreadPool pool(threads);
+    std::vector<std::unique_ptr<Painter>> painters;
+    for (int k = 0; k < pool.size(); ++k) {
+        painters.emplace_back(new Painter(width, height, x, y, tile));
+    }
+
+    // the board is simulated one frame after the other, then a batch of
+    // frames is drawn at once, a few per thread
+    size_t batch_size = (size_t)pool.size() * 4;
+    std::vector<Pending> batch;
+    std::vector<std::vector<uint8_t>> images(batch_size);
+    std::vector<std::string> errors(batch_size);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t tick = 0;
+    size_t done = 0;
+    bool failed = false;
+    while (done < frames && !failed) {
+        batch.clear();
+        while (batch.size() < batch_size && done + batch.size() < frames) {
+            if (done + batch.size() > 0) {
+                if (level) {
+                    for (size_t k = 0; k < every; ++k) {
+                        level->progress(TICK);
+                    }
+                }
+                else {
+                    replay.step(every);
+                }
+                tick += every;
+            }
+            batch.push_back(Pending{ Snapshot::capture(model), model.boardRevision(), tick });
+        }
+
+        pool.run(batch.size(), [&](size_t k) {
+            Painter &painter = *painters[ThreadPool::worker()];
+            painter.model.restore(batch[k].snapshot);
+            painter.canvas.clear(rgb(0, 0, 0));
+            painter.view.draw(painter.canvas, painter.model, painter.model, 1.0, batch[k].board);
+
+            const uint8_t *pixels = painter.canvas.pixels();
+            images[k].assign(pixels, pixels + painter.canvas.bytes());
+            errors[k].clear();
+            if (pattern) {
+                std::string name = frame_name(frame, done + k);
+                bool ppm = name.size() >= 4 && name.compare(name.size() - 4, 4, ".ppm") == 0;
+                if (ppm)
+                    write_ppm(name.c_str(), pixels, width, height, errors[k]);
+                else
+                    write_png(name.c_str(), pixels, width, height, errors[k]);
+            }
+        });
+
+        for (size_t k = 0; k < batch.size(); ++k) {
+            if (!errors[k].empty()) {
+                std::fprintf(stderr, "%s\n", errors[k].c_str());
+                failed = true;
+                break;
+            }
+            if (raw && !write_raw(raw, images[k].data(), width, height)) {
+                std::fprintf(stderr, "%s: cannot write file\n", raw_path);
+                failed = true;
+                break;
+            }
+            if (checksum) {
+                uint64_t hash = 0;
+                for (size_t i = 0; i + 8 <= images[k].size(); i += 8) {
+                    uint64_t word;
+                    std::memcpy(&word, &images[k][i], sizeof(word));
+                    hash = mix_hash(hash ^ word);
+                }
+                std::fprintf(raw == stdout ? stderr : stdout, "frame %zu tick %zu image %016llx\n",
+                    done + k, batch[k].tick, (unsigned long long)hash);
+            }
+        }
+        done += batch.size();
+    }
+
+    if (raw && raw != stdout && std::fclose(raw) != 0) {
+        std::fprintf(stderr, "%s: cannot write file\n", raw_path);
+        failed = true;
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::fprintf(stderr, "%zu frames of %dx%d in %.3f s: %.1f frames/s\n", done, width, height, seconds, done / seconds);
+
+    if (trace_path && !Profiler::writeTrace(trace_path, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,113 @@
+#include "journal.hpp"
+#include "profile.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+static void usage(const char *name) {
+    std::fprintf(stderr,
+        "usage: %s [--threads N] [--from TICK] [--to TICK] [--every N] [--trace FILE] FILE\n"
+        "  --threads N  number of simulation threads (default 1)\n"
+        "  --from TICK  start at the tick, simulated from the nearest keyframe\n"
+        "  --to TICK    stop at the tick (default: the end of the session)\n"
+        "  --every N    print a hash of the board every N ticks, not only at the end\n"
+        "  --trace FILE save where the time went as a Chrome trace, in builds with MARBLES_PROFILE\n"
+        "replays a journal recorded with marbles --record as fast as possible\n",
+        name);
+}
+
+static void print_state(const Replay &replay) {
+    std::printf("tick %zu hash %016llx\n", replay.tick(), (unsigned long long)replay.model().hash());
+}
+
+int main(int argc, char **argv) {
+    int threads = 1;
+    size_t from = 0;
+    size_t to = (size_t)-1;
+    size_t every = 0;
+    const char *trace_path = nullptr;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--from") == 0 && i + 1 < argc) {
+            from = (size_t)std::atoll(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--to") == 0 && i + 1 < argc) {
+            to = (size_t)std::atoll(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--every") == 0 && i + 1 < argc) {
+            every = (size_t)std::atoll(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        }
+        else if (argv[i][0] == '-' || path) {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            path = argv[i];
+        }
+    }
+
+    if (!path) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (trace_path && !Profiler::ENABLED) {
+        std::fprintf(stderr, "--trace needs a build with MARBLES_PROFILE\n");
+        return 1;
+    }
+    PROFILE_THREAD("replay");
+    Replay replay;
+    std::string error;
+    if (!replay.load(path, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    replay.model().setThreads(threads);
+
+    if (to > replay.length())
+        to = replay.length();
+    if (from > to)
+        from = to;
+
+    auto start = std::chrono::steady_clock::now();
+    replay.seek(from);
+    auto seeked = std::chrono::steady_clock::now();
+
+    if (every > 0)
+        print_state(replay);
+    while (replay.tick() < to) {
+        size_t ticks = to - replay.tick();
+        if (every > 0)
+            ticks = std::min(ticks, every - replay.tick() % every);
+        replay.step(ticks);
+
+        if (every > 0)
+            print_state(replay);
+    }
+    if (every == 0)
+        print_state(replay);
+
+    auto end = std::chrono::steady_clock::now();
+    double seek_seconds = std::chrono::duration<double>(seeked - start).count();
+    double seconds = std::chrono::duration<double>(end - seeked).count();
+
+    std::fprintf(stderr, "seek to tick %zu in %.3f s, %zu ticks in %.3f s: %.1f ticks/s\n",
+        from, seek_seconds, to - from, seconds, (to - from) / seconds);
+
+    if (trace_path && !Profiler::writeTrace(trace_path, error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include "scenario.hpp"
+
+#include "transitions.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+static bool parse_direction(const std::string &token, int &direction) {
+    static const char *const NAMES[] = { "N", "E", "S", "W" };
+    for (int d = 0; d < 4; ++d) {
+        if (token == NAMES[d]) {
+            direction = d;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool parse_ball_type(const std::string &token, BallType &type) {
+    static const char *const NAMES[] = { "red", "green", "blue", "yellow" };
+    for (int i = 0; i < 4; ++i) {
+        if (token == NAMES[i]) {
+            type = (BallType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ball <row> <col> <type> inside <position>
+// ball <row> <col> <type> entering|exiting <direction> [<transition>]
+static bool parse_ball(std::istringstream &line, const Scenario &scenario, Ball &ball, std::string &error) {
+    std::string type, state, where;
+    if (!(line >> ball.row >> ball.col >> type >> state >> where)) {
+        error = "expected: ball <row> <col> <type> <state> <direction or position>";
+        return false;
+    }
+    if (ball.row < 0 || ball.row >= scenario.rows || ball.col < 0 || ball.col >= scenario.cols) {
+        error = "ball outside of the board";
+        return false;
+    }
+    if (!parse_ball_type(type, ball.type)) {
+        error = "unknown ball type '" + type + "'";
+        return false;
+    }
+
+    ball.transition = 0.0;
+    ball.rotor_position = 0;
+
+    int direction;
+    if (state == "inside") {
+        if (where.size() != 1 || where[0] < '0' || where[0] > '3') {
+            error = "rotor position has to be 0 to 3";
+            return false;
+        }
+        if (scenario.tiles[ball.col + ball.row * scenario.cols] != TileType::Rotor) {
+            error = "ball inside a rotor that is not there";
+            return false;
+        }
+        ball.state = BallState::InsideRotor;
+        ball.rotor_position = where[0] - '0';
+    }
+    else if ((state == "entering" || state == "exiting") && parse_direction(where, direction)) {
+        ball.state = state == "entering" ? entering_from(direction) : exiting_towards(direction);
+
+        double transition;
+        if (line >> transition) {
+            if (transition < 0.0 || transition >= 0.5) {
+                error = "transition has to be at least 0 and less than 0.5";
+                return false;
+            }
+            ball.transition = transition;
+        }
+    }
+    else {
+        error = "unknown ball state '" + state + " " + where + "'";
+        return false;
+    }
+    return true;
+}
+
+// at <time> cw|ccw <row> <col>
+// at <time> eject <direction> <row> <col>
+static bool parse_command(std::istringstream &line, const Scenario &scenario, Command &command, std::string &error) {
+    std::string action;
+    if (!(line >> command.time >> action)) {
+        error = "expected: at <time> <action> ...";
+        return false;
+    }
+
+    if (action == "cw") {
+        command.action = Action::TurnClockwise;
+    }
+    else if (action == "ccw") {
+        command.action = Action::TurnCounterClockwise;
+    }
+    else if (action == "eject") {
+        std::string token;
+        int direction;
+        if (!(line >> token) || !parse_direction(token, direction)) {
+            error = "eject needs a direction";
+            return false;
+        }
+        command.action = (Action)((int)Action::EjectNorth + direction);
+    }
+    else {
+        error = "unknown action '" + action + "'";
+        return false;
+    }
+
+    if (!(line >> command.row >> command.col)) {
+        error = "expected the row and column of a rotor";
+        return false;
+    }
+    if (command.row < 0 || command.row >= scenario.rows || command.col < 0 || command.col >= scenario.cols) {
+        error = "command outside of the board";
+        return false;
+    }
+    return true;
+}
+
+static void finish(Scenario &scenario) {
+    std::stable_sort(scenario.commands.begin(), scenario.commands.end(),
+        [](const Command &a, const Command &b) { return a.time < b.time; });
+
+    if (scenario.duration <= 0.0)
+        scenario.duration = (scenario.commands.empty() ? 0.0 : scenario.commands.back().time) + 10000.0;
+}
+
+bool parse_scenarios(const std::string &text, std::vector<Scenario> &scenarios, std::string &error) {
+    std::istringstream in(text);
+    std::string raw;
+    int number = 0;
+    Scenario *scenario = nullptr;
+
+    auto fail = [&](const std::string &message) {
+        error = "line " + std::to_string(number) + ": " + message;
+        return false;
+    };
+
+    while (std::getline(in, raw)) {
+        ++number;
+        if (!raw.empty() && raw.back() == '\r')
+            raw.pop_back();
+
+        std::istringstream line(raw);
+        std::string keyword;
+        if (!(line >> keyword) || keyword[0] == '#')
+            continue;
+
+        if (keyword == "scenario") {
+            if (scenario && scenario->tiles.empty())
+                return fail("the previous scenario has no board");
+            if (scenario)
+                finish(*scenario);
+            scenarios.emplace_back();
+            scenario = &scenarios.back();
+            line >> scenario->name;
+            continue;
+        }
+
+        if (!scenario)
+            return fail("expected: scenario <name>");
+
+        std::string message;
+        if (keyword == "board") {
+            if (!scenario->tiles.empty())
+                return fail("the scenario already has a board");
+            if (!(line >> scenario->rows >> scenario->cols) || scenario->rows <= 0 || scenario->cols <= 0)
+                return fail("expected: board <rows> <cols>");
+
+            scenario->tiles.assign((size_t)scenario->rows * scenario->cols, TileType::Empty);
+            for (int r = 0; r < scenario->rows; ++r) {
+                ++number;
+                if (!std::getline(in, raw))
+                    return fail("the board ends early");
+                if (!raw.empty() && raw.back() == '\r')
+                    raw.pop_back();
+                if ((int)raw.size() > scenario->cols)
+                    return fail("board row is longer than the board");
+
+                for (int c = 0; c < (int)raw.size(); ++c) {
+                    if (!tile_from_symbol(raw[c], scenario->tiles[c + r * scenario->cols]))
+                        return fail(std::string("unknown tile '") + raw[c] + "'");
+                }
+            }
+        }
+        else if (scenario->tiles.empty()) {
+            return fail("expected: board <rows> <cols>");
+        }
+        else if (keyword == "ball") {
+            Ball ball;
+            if (!parse_ball(line, *scenario, ball, message))
+                return fail(message);
+            scenario->balls.push_back(ball);
+        }
+        else if (keyword == "at") {
+            Command command;
+            if (!parse_command(line, *scenario, command, message))
+                return fail(message);
+            scenario->commands.push_back(command);
+        }
+        else if (keyword == "end") {
+            if (!(line >> scenario->duration) || scenario->duration <= 0.0)
+                return fail("expected: end <time>");
+        }
+        else {
+            return fail("unknown keyword '" + keyword + "'");
+        }
+    }
+
+    if (scenario && scenario->tiles.empty())
+        return fail("the scenario has no board");
+    if (scenario)
+        finish(*scenario);
+    return true;
+}
+
+bool load_scenarios(const char *path, std::vector<Scenario> &scenarios, std::string &error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        error = std::string(path) + ": cannot open file";
+        return false;
+    }
+
+    std::ostringstream text;
+    text << file.rdbuf();
+    if (!parse_scenarios(text.str(), scenarios, error)) {
+        error = std::string(path) + ": " + error;
+        return false;
+    }
+    return true;
+}
+
+void write_command(FILE *out, const Command &command) {
+    static const char *const ACTIONS[] = { "cw", "ccw", "eject N", "eject E", "eject S", "eject W" };
+    std::fprintf(out, "at %g %s %d %d\n", command.time, ACTIONS[(int)command.action], command.row, command.col);
+}
+
+void setup_scenario(Model &model, const Scenario &scenario) {
+    model.reset(scenario.rows, scenario.cols);
+
+    for (int r = 0; r < scenario.rows; ++r) {
+        for (int c = 0; c < scenario.cols; ++c) {
+            TileType type = scenario.tiles[c + r * scenario.cols];
+            if (type != TileType::Empty)
+                model.setTile(r, c, type);
+        }
+    }
+
+    for (const auto &ball : scenario.balls) {
+        model.addBall(ball);
+    }
+}
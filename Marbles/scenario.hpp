@@ -0,0 +1,85 @@
+#pragma once
+
+#include "command.hpp"
+#include "model.hpp"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// A board with its initial balls and a timed list of commands. Scenarios are
+// read from text like this, one or more per file:
+//
+//   scenario loop
+//   board 3 8
+//   r-7  o-o
+//   L-J  | |
+//        o-o
+//   ball 0 0 green exiting E
+//   ball 0 5 red inside 0
+//   at 500 cw 0 5
+//   at 1200 eject S 0 5
+//   end 20000
+//
+// Board symbols are '-', '|', '+' (crossing), 'o' (rotor), the corners 'r'
+// (south east), '7' (south west), 'L' (north east) and 'J' (north west), and
+// ' ' or '.' for empty tiles. Directions are N, E, S, W. Balls that are not
+// inside a rotor may give their transition after the direction. Lines
+// starting with '#' are comments.
+struct Scenario {
+    std::string name;
+    int rows = 0;
+    int cols = 0;
+    // rows * cols tile types
+    std::vector<TileType> tiles;
+    std::vector<Ball> balls;
+    // sorted by time
+    std::vector<Command> commands;
+    // simulated milliseconds, defaults to 10 seconds after the last command
+    double duration = 0.0;
+};
+
+static constexpr char TILE_SYMBOLS[] = {
+    /* Empty           */ ' ',
+    /* CornerNorthEast */ 'L',
+    /* CornerNorthWest */ 'J',
+    /* CornerSouthEast */ 'r',
+    /* CornerSouthWest */ '7',
+    /* Horizontal      */ '-',
+    /* Vertical        */ '|',
+    /* Crossing        */ '+',
+    /* Rotor           */ 'o',
+};
+
+static_assert(sizeof(TILE_SYMBOLS) == (int)TileType::Rotor + 1, "every tile type needs a symbol");
+
+// board symbol of a tile type and back, unknown symbols return false
+constexpr char tile_symbol(TileType type) {
+    return TILE_SYMBOLS[(int)type];
+}
+
+constexpr bool tile_from_symbol(char symbol, TileType &type) {
+    if (symbol == '.') {
+        type = TileType::Empty;
+        return true;
+    }
+
+    for (int i = 0; i < (int)sizeof(TILE_SYMBOLS); ++i) {
+        if (TILE_SYMBOLS[i] == symbol) {
+            type = (TileType)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// appends the scenarios in text to scenarios, returns false and a message
+// with the line number if the text is malformed
+bool parse_scenarios(const std::string &text, std::vector<Scenario> &scenarios, std::string &error);
+bool load_scenarios(const char *path, std::vector<Scenario> &scenarios, std::string &error);
+
+// writes the command as an "at" line of the scenario format
+void write_command(FILE *out, const Command &command);
+
+// resets the model to the scenario's board and balls
+void setup_scenario(Model &model, const Scenario &scenario);
@@ -0,0 +1,140 @@
+#include "simulation.hpp"
+
+#include "profile.hpp"
+
+#include <chrono>
+
+// ticks the simulation may fall behind the clock before it gives up on
+// catching up and carries on from the current time
+static constexpr int MAX_BEHIND = 8;
+
+using SteadyClock = std::chrono::steady_clock;
+
+static double seconds(SteadyClock::time_point time) {
+    return std::chrono::duration<double>(time.time_since_epoch()).count();
+}
+
+Simulation::Simulation(Model &model, double tick, JournalWriter &journal) :
+    _model(model), _tick(tick), _journal(journal)
+{
+}
+
+Simulation::~Simulation() {
+    stop();
+}
+
+void Simulation::start() {
+    if (_thread.joinable())
+        return;
+
+    _stop = false;
+    _thread = std::thread([this] { run(); });
+}
+
+void Simulation::stop() {
+    if (!_thread.joinable())
+        return;
+
+    _stop = true;
+    _thread.join();
+}
+
+bool Simulation::send(const Command &command) {
+    return _commands.push(command);
+}
+
+void Simulation::setRewinding(bool rewinding) {
+    _rewinding = rewinding;
+}
+
+bool Simulation::poll(Frame &frame) {
+    if (!_frames.update())
+        return false;
+    frame = _frames.front();
+    return true;
+}
+
+double Simulation::clock() {
+    return seconds(SteadyClock::now());
+}
+
+void Simulation::publish(double clock) {
+    Frame &frame = _frames.back();
+    frame.snapshot = Snapshot::capture(_model);
+    frame.board = _model.boardRevision();
+    frame.clock = clock;
+    _frames.publish();
+}
+
+void Simulation::run() {
+    PROFILE_THREAD("simulation");
+    auto tick = std::chrono::duration_cast<SteadyClock::duration>(std::chrono::duration<double, std::milli>(_tick));
+    SteadyClock::time_point due = SteadyClock::now();
+    publish(seconds(due));
+
+    while (!_stop) {
+        due += tick;
+        std::this_thread::sleep_until(due);
+
+        PROFILE_PHASES(phase);
+        PROFILE_PHASE(phase, "commands");
+        Command command;
+        while (_commands.pop(command)) {
+            command.time = _model.now();
+            apply_command(_model, command);
+            _journal.record(command);
+        }
+
+        // time runs backwards while rewinding
+        PROFILE_PHASE(phase, "tick");
+        if (_rewinding) {
+            _model.stepBack();
+        }
+        else {
+            _model.progress(_tick);
+            _journal.tick(_model);
+        }
+
+        PROFILE_PHASE(phase, "publish");
+        SteadyClock::time_point now = SteadyClock::now();
+        if (now - due > MAX_BEHIND * tick)
+            due = now;
+        publish(seconds(due));
+    }
+}
+
+FramePair::FramePair() {
+    _models[0].reset(new Model(1, 1));
+    _models[1].reset(new Model(1, 1));
+}
+
+bool FramePair::update(Simulation &simulation) {
+    Frame frame;
+    if (!simulation.poll(frame))
+        return false;
+
+    // a new board has nothing to move from
+    if (!_frames[_current].snapshot || frame.board != _frames[_current].board) {
+        _models[0]->restore(frame.snapshot);
+        _models[1]->restore(frame.snapshot);
+        _frames[0] = frame;
+        _frames[1] = frame;
+        return true;
+    }
+
+    _current ^= 1;
+    _models[_current]->restore(frame.snapshot);
+    _frames[_current] = std::move(frame);
+    return true;
+}
+
+double FramePair::alpha(double clock, double tick) const {
+    const Frame &previous = _frames[_current ^ 1];
+    const Frame &current = _frames[_current];
+    if (current.clock <= previous.clock)
+        return 1.0;
+
+    double shown = clock - tick / 1000.0;
+    double alpha = (shown - previous.clock) / (current.clock - previous.clock);
+    return alpha < 0.0 ? 0.0 : alpha > 1.0 ? 1.0 : alpha;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "command.hpp"
+#include "journal.hpp"
+#include "model.hpp"
+#include "snapshot.hpp"
+#include "spsc_queue.hpp"
+#include "triple_buffer.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+// A model as it was after a tick.
+struct Frame {
+    std::shared_ptr<const Snapshot> snapshot;
+    // boardRevision of the simulated model, which models restored from the
+    // snapshot don't keep
+    uint64_t board = 0;
+    // Simulation::clock time the tick was due
+    double clock = 0.0;
+};
+
+// Runs a model on a thread of its own, one tick of a fixed number of
+// milliseconds at a time and in step with the clock, so that neither slow
+// frames slow the simulation down nor the other way round. After every tick
+// it publishes a snapshot of the model.
+//
+// The thread that draws sends the commands of the player, which are applied
+// before the next tick like the journal has it, and takes the newest frame
+// whenever it draws. Neither side ever waits for the other.
+class Simulation {
+public:
+    // nothing but the simulation may touch model and journal until it is
+    // stopped. the journal records the session if it is open.
+    Simulation(Model &model, double tick, JournalWriter &journal);
+    ~Simulation();
+
+    Simulation(const Simulation &) = delete;
+    Simulation &operator=(const Simulation &) = delete;
+
+    void start();
+    // returns once the tick that is being simulated is done
+    void stop();
+
+    double tick() const { return _tick; }
+
+    // false if the queue of commands is full. the time of the command is
+    // set to that of the tick it is applied before.
+    bool send(const Command &command);
+
+    // while set, ticks step back through the history of the model instead
+    void setRewinding(bool rewinding);
+
+    // the newest frame, false if the last call already returned it
+    bool poll(Frame &frame);
+
+    // seconds on a steady clock
+    static double clock();
+
+private:
+    void run();
+    void publish(double clock);
+
+    Model &_model;
+    double _tick;
+    JournalWriter &_journal;
+
+    SpscQueue<Command, 256> _commands;
+    TripleBuffer<Frame> _frames;
+    std::atomic<bool> _rewinding{ false };
+    std::atomic<bool> _stop{ false };
+    std::thread _thread;
+};
+
+// The last two frames of a simulation, restored into models of their own to
+// draw the board between them with View.
+class FramePair {
+public:
+    FramePair();
+
+    // takes the newest frame of the simulation, false if there is none
+    bool update(Simulation &simulation);
+
+    const Model &previous() const { return *_models[_current ^ 1]; }
+    const Model &current() const { return *_models[_current]; }
+    uint64_t board() const { return _frames[_current].board; }
+
+    // how far from previous to current the board is at the given clock
+    // time, from 0 to 1. the board is shown a tick late, so that there is
+    // a frame to move towards between ticks.
+    double alpha(double clock, double tick) const;
+
+private:
+    std::unique_ptr<Model> _models[2];
+    Frame _frames[2];
+    int _current = 0;
+};
@@ -0,0 +1,457 @@
+#include "snapshot.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+static constexpr char MAGIC[8] = { 'M', 'R', 'B', 'L', 'S', 'N', 'A', 'P' };
+static constexpr uint32_t HEADER_SIZE = 80;
+
+static bool little_endian() {
+    const uint16_t one = 1;
+    uint8_t first;
+    std::memcpy(&first, &one, 1);
+    return first == 1;
+}
+
+template <typename T>
+static T read_le(const uint8_t *bytes) {
+    uint8_t buffer[sizeof(T)];
+    std::memcpy(buffer, bytes, sizeof(T));
+    if (!little_endian())
+        std::reverse(buffer, buffer + sizeof(T));
+
+    T value;
+    std::memcpy(&value, buffer, sizeof(T));
+    return value;
+}
+
+template <typename T>
+static void write_le(uint8_t *bytes, T value) {
+    std::memcpy(bytes, &value, sizeof(T));
+    if (!little_endian())
+        std::reverse(bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+static void read_array(const uint8_t *bytes, T *values, size_t count) {
+    if (count == 0)
+        return;
+
+    if (little_endian()) {
+        std::memcpy(values, bytes, count * sizeof(T));
+        return;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = read_le<T>(bytes + i * sizeof(T));
+    }
+}
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+
+Snapshot::Layout Snapshot::layout(uint64_t header, int rows, int cols, uint32_t chunk, uint64_t chunks, uint64_t turning, uint64_t balls) {
+    uint64_t directory = 0;
+    uint64_t tiles = (uint64_t)rows * cols;
+    if (chunk) {
+        directory = (uint64_t)((rows + chunk - 1) / chunk) * ((cols + chunk - 1) / chunk);
+        tiles = chunks * chunk * chunk;
+    }
+
+    Layout layout;
+    layout.directory = align8(header);
+    layout.tiles = align8(layout.directory + directory * 4);
+    layout.turning_index = align8(layout.tiles + tiles * 4);
+    layout.turning_transition = layout.turning_index + turning * 8;
+    layout.transition = layout.turning_transition + turning * 8;
+    layout.row = layout.transition + balls * 8;
+    layout.col = layout.row + balls * 4;
+    layout.state = layout.col + balls * 4;
+    layout.type = layout.state + balls;
+    layout.position = layout.type + balls;
+    layout.size = align8(layout.position + balls);
+    return layout;
+}
+
+std::shared_ptr<const Snapshot> Snapshot::capture(const Model &model) {
+    const TileGrid &tiles = model.packedTiles();
+
+    // turning rotors in the order of their tiles, so that equal boards give
+    // equal snapshots
+    std::vector<size_t> turning;
+    tiles.forEachTile([&](int row, int col, const PackedTile &tile) {
+        if (tile.type() == TileType::Rotor && tile.state() != RotorState::Resting)
+            turning.push_back(col + (size_t)row * tiles.cols());
+    });
+    std::sort(turning.begin(), turning.end());
+
+    // sparse boards keep the chunks with any tiles, numbered in the order of
+    // the directory for the same reason
+    uint32_t chunk = 0;
+    uint32_t chunk_cols = 0;
+    std::vector<uint32_t> directory;
+    uint32_t chunks = 0;
+    if (tiles.storage() == TileStorage::Sparse) {
+        chunk = TileGrid::CHUNK_SIZE;
+        chunk_cols = (uint32_t)(tiles.cols() + chunk - 1) / chunk;
+        directory.assign((size_t)((tiles.rows() + chunk - 1) / chunk) * chunk_cols, 0);
+        tiles.forEachTile([&](int row, int col, const PackedTile &tile) {
+            if (tile.bits != 0)
+                directory[col / chunk + row / chunk * chunk_cols] = 1;
+        });
+        for (uint32_t &number : directory) {
+            if (number)
+                number = ++chunks;
+        }
+    }
+
+    size_t balls = model.ballCount();
+    Layout layout = Snapshot::layout(HEADER_SIZE, tiles.rows(), tiles.cols(), chunk, chunks, turning.size(), balls);
+
+    std::shared_ptr<Snapshot> snapshot(new Snapshot);
+    std::vector<uint8_t> &bytes = snapshot->_bytes;
+    bytes.assign((size_t)layout.size, 0);
+
+    std::memcpy(bytes.data(), MAGIC, sizeof(MAGIC));
+    write_le<uint32_t>(&bytes[8], VERSION);
+    write_le<uint32_t>(&bytes[12], HEADER_SIZE);
+    write_le<int32_t>(&bytes[16], model.rows());
+    write_le<int32_t>(&bytes[20], model.cols());
+    write_le<uint64_t>(&bytes[24], turning.size());
+    write_le<uint64_t>(&bytes[32], balls);
+    write_le<double>(&bytes[40], model.now());
+    uint64_t tile_hash = model.tileHash();
+    write_le<uint64_t>(&bytes[48], tile_hash);
+    write_le<uint64_t>(&bytes[56], model.hash() - tile_hash);
+    write_le<uint64_t>(&bytes[64], layout.size);
+    write_le<uint32_t>(&bytes[72], chunk);
+    write_le<uint32_t>(&bytes[76], chunks);
+
+    for (size_t k = 0; k < directory.size(); ++k) {
+        write_le<uint32_t>(&bytes[layout.directory + k * 4], directory[k]);
+    }
+
+    // empty tiles are the zeros the bytes start out with
+    tiles.forEachTile([&](int row, int col, const PackedTile &packed) {
+        if (packed.bits == 0)
+            return;
+
+        size_t index = col + (size_t)row * tiles.cols();
+        PackedTile tile = packed;
+        tile.bits &= 0xffff;
+        if (tile.type() == TileType::Rotor && tile.state() != RotorState::Resting)
+            tile.setSlot(std::lower_bound(turning.begin(), turning.end(), index) - turning.begin());
+
+        uint64_t offset = layout.tiles + index * 4;
+        if (chunk) {
+            uint32_t number = directory[col / chunk + row / chunk * chunk_cols];
+            offset = layout.tiles + ((number - 1) * (uint64_t)chunk * chunk + (uint64_t)(row % chunk) * chunk + col % chunk) * 4;
+        }
+        write_le<uint32_t>(&bytes[offset], tile.bits);
+    });
+
+    for (size_t k = 0; k < turning.size(); ++k) {
+        Tile tile = model.tile((int)(turning[k] / model.cols()), (int)(turning[k] % model.cols()));
+        write_le<uint64_t>(&bytes[layout.turning_index + k * 8], turning[k]);
+        write_le<double>(&bytes[layout.turning_transition + k * 8], tile.rotor.transition);
+    }
+
+    for (size_t i = 0; i < balls; ++i) {
+        Ball ball = model.ball(i);
+        write_le<double>(&bytes[layout.transition + i * 8], ball.transition);
+        write_le<int32_t>(&bytes[layout.row + i * 4], ball.row);
+        write_le<int32_t>(&bytes[layout.col + i * 4], ball.col);
+        bytes[layout.state + i] = (uint8_t)ball.state;
+        bytes[layout.type + i] = (uint8_t)ball.type;
+        bytes[layout.position + i] = (uint8_t)ball.rotor_position;
+    }
+
+    // the model's own state needs no checking, only snapshots from elsewhere
+    snapshot->_data = bytes.data();
+    snapshot->_size = bytes.size();
+    snapshot->_layout = layout;
+    snapshot->_rows = model.rows();
+    snapshot->_cols = model.cols();
+    snapshot->_chunk = chunk;
+    snapshot->_chunk_cols = chunk_cols;
+    snapshot->_now = model.now();
+    snapshot->_tile_hash = tile_hash;
+    snapshot->_ball_hash = model.hash() - tile_hash;
+    snapshot->_turning_count = turning.size();
+    snapshot->_ball_count = balls;
+    return snapshot;
+}
+
+std::shared_ptr<const Snapshot> Snapshot::load(const char *path, std::string &error) {
+    std::shared_ptr<Snapshot> snapshot(new Snapshot);
+
+    if (!snapshot->_file.open(path, error))
+        return nullptr;
+    snapshot->_data = snapshot->_file.data();
+    snapshot->_size = snapshot->_file.size();
+
+    if (!snapshot->parse(error)) {
+        error = std::string(path) + ": " + error;
+        return nullptr;
+    }
+    return snapshot;
+}
+
+std::shared_ptr<const Snapshot> Snapshot::fromBytes(std::vector<uint8_t> bytes, std::string &error) {
+    std::shared_ptr<Snapshot> snapshot(new Snapshot);
+    snapshot->_bytes = std::move(bytes);
+    snapshot->_data = snapshot->_bytes.data();
+    snapshot->_size = snapshot->_bytes.size();
+
+    if (!snapshot->parse(error))
+        return nullptr;
+    return snapshot;
+}
+
+bool Snapshot::save(const char *path, std::string &error) const {
+    FILE *file = std::fopen(path, "wb");
+    if (!file) {
+        error = std::string(path) + ": cannot create file";
+        return false;
+    }
+
+    bool written = std::fwrite(_data, 1, _size, file) == _size;
+    if (std::fclose(file) != 0)
+        written = false;
+
+    if (!written) {
+        error = std::string(path) + ": cannot write file";
+        return false;
+    }
+    return true;
+}
+
+bool Snapshot::parse(std::string &error) {
+    if (_size < HEADER_SIZE || std::memcmp(_data, MAGIC, sizeof(MAGIC)) != 0) {
+        error = "not a snapshot";
+        return false;
+    }
+
+    uint32_t version = read_le<uint32_t>(_data + 8);
+    if (version != VERSION) {
+        error = "snapshot version " + std::to_string(version) + " is not supported";
+        return false;
+    }
+
+    uint32_t header = read_le<uint32_t>(_data + 12);
+    int32_t rows = read_le<int32_t>(_data + 16);
+    int32_t cols = read_le<int32_t>(_data + 20);
+    uint64_t turning = read_le<uint64_t>(_data + 24);
+    uint64_t balls = read_le<uint64_t>(_data + 32);
+    uint64_t size = read_le<uint64_t>(_data + 64);
+    uint32_t chunk = read_le<uint32_t>(_data + 72);
+    uint32_t chunks = read_le<uint32_t>(_data + 76);
+
+    // counts beyond the size of the data can't be right, and checking them
+    // first keeps the layout from overflowing. sparse boards come in the
+    // chunks of the tile grid, which restores them chunk by chunk.
+    if (header < HEADER_SIZE || rows <= 0 || cols <= 0
+        || (chunk != 0 && chunk != (uint32_t)TileGrid::CHUNK_SIZE) || (chunk == 0 && chunks != 0)
+        || (chunk == 0 && (uint64_t)rows * cols > _size) || chunks > _size || turning > _size || balls > _size)
+    {
+        error = "corrupt snapshot header";
+        return false;
+    }
+
+    Layout layout = Snapshot::layout(header, rows, cols, chunk, chunks, turning, balls);
+    if (size != layout.size) {
+        error = "corrupt snapshot header";
+        return false;
+    }
+    if (layout.size > _size) {
+        error = "snapshot is truncated";
+        return false;
+    }
+
+    _layout = layout;
+    _rows = rows;
+    _cols = cols;
+    _chunk = chunk;
+    _chunk_cols = chunk ? (cols + chunk - 1) / chunk : 0;
+
+    // chunks are numbered in the order of the directory, and the tiles they
+    // have beyond the edge of the board are empty
+    uint32_t numbered = 0;
+    for (uint32_t y = 0; chunk && y < (rows + chunk - 1) / chunk; ++y) {
+        for (uint32_t x = 0; x < _chunk_cols; ++x) {
+            uint32_t number = read_le<uint32_t>(_data + layout.directory + (x + (uint64_t)y * _chunk_cols) * 4);
+            if (number == 0)
+                continue;
+            if (number != ++numbered || number > chunks) {
+                error = "corrupt chunk directory in snapshot";
+                return false;
+            }
+
+            const uint8_t *tiles = _data + layout.tiles + (number - 1) * (uint64_t)chunk * chunk * 4;
+            for (uint32_t r = 0; r < chunk; ++r) {
+                for (uint32_t c = 0; c < chunk; ++c) {
+                    bool inside = y * chunk + r < (uint32_t)rows && x * chunk + c < (uint32_t)cols;
+                    if (!inside && read_le<uint32_t>(tiles + (c + r * chunk) * 4) != 0) {
+                        error = "corrupt tile in snapshot";
+                        return false;
+                    }
+                }
+            }
+        }
+    }
+    if (numbered != chunks) {
+        error = "corrupt chunk directory in snapshot";
+        return false;
+    }
+
+    // everything the model indexes tables with or relies on has to be in range
+    size_t count = (size_t)rows * cols;
+    size_t stored = chunk ? (size_t)chunks * chunk * chunk : count;
+    size_t turning_tiles = 0;
+    for (size_t i = 0; i < stored; ++i) {
+        PackedTile tile{ read_le<uint32_t>(_data + layout.tiles + i * 4) };
+        if (tile.type() > TileType::Rotor || (tile.type() == TileType::Rotor && tile.state() > RotorState::TurningCounterClockwise)) {
+            error = "corrupt tile in snapshot";
+            return false;
+        }
+        if (tile.type() == TileType::Rotor && tile.state() != RotorState::Resting)
+            ++turning_tiles;
+    }
+
+    if (turning_tiles != turning) {
+        error = "corrupt turning rotors in snapshot";
+        return false;
+    }
+    for (size_t k = 0; k < turning; ++k) {
+        uint64_t index = read_le<uint64_t>(_data + layout.turning_index + k * 8);
+        double transition = read_le<double>(_data + layout.turning_transition + k * 8);
+        uint64_t offset = index < count ? tileOffset(index) : 0;
+        if (offset == 0 || !std::isfinite(transition)) {
+            error = "corrupt turning rotors in snapshot";
+            return false;
+        }
+
+        PackedTile tile{ read_le<uint32_t>(_data + offset) };
+        if (tile.type() != TileType::Rotor || tile.state() == RotorState::Resting
+            || tile.slot() != std::min<size_t>(k, PackedTile::NO_SLOT))
+        {
+            error = "corrupt turning rotors in snapshot";
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < balls; ++i) {
+        double transition = read_le<double>(_data + layout.transition + i * 8);
+        uint8_t state = _data[layout.state + i];
+        uint8_t type = _data[layout.type + i];
+        uint8_t position = _data[layout.position + i];
+        if (!std::isfinite(transition) || state > (uint8_t)BallState::InsideRotor || type > (uint8_t)BallType::Yellow || position > 3) {
+            error = "corrupt ball in snapshot";
+            return false;
+        }
+    }
+
+    _now = read_le<double>(_data + 40);
+    _tile_hash = read_le<uint64_t>(_data + 48);
+    _ball_hash = read_le<uint64_t>(_data + 56);
+    _turning_count = (size_t)turning;
+    _ball_count = (size_t)balls;
+    return true;
+}
+
+uint64_t Snapshot::tileOffset(size_t index) const {
+    if (!_chunk)
+        return _layout.tiles + index * 4;
+
+    size_t row = index / _cols;
+    size_t col = index % _cols;
+    uint32_t number = read_le<uint32_t>(_data + _layout.directory + (col / _chunk + row / _chunk * _chunk_cols) * 4);
+    if (number == 0)
+        return 0;
+    return _layout.tiles + ((number - 1) * (uint64_t)_chunk * _chunk + (row % _chunk) * _chunk + col % _chunk) * 4;
+}
+
+const PackedTile *Snapshot::tiles() const {
+    if (!little_endian() || _chunk)
+        return nullptr;
+    return reinterpret_cast<const PackedTile *>(_data + _layout.tiles);
+}
+
+void Snapshot::copyTiles(PackedTile *tiles) const {
+    if (!_chunk) {
+        read_array(_data + _layout.tiles, &tiles[0].bits, (size_t)_rows * _cols);
+        return;
+    }
+
+    std::fill(tiles, tiles + (size_t)_rows * _cols, PackedTile{});
+    for (int top = 0; top < _rows; top += _chunk) {
+        for (int left = 0; left < _cols; left += _chunk) {
+            size_t index = left + (size_t)top * _cols;
+            uint64_t offset = tileOffset(index);
+            if (offset == 0)
+                continue;
+
+            // rows of the chunk up to the edge of the board
+            int height = std::min<int>(_chunk, _rows - top);
+            int width = std::min<int>(_chunk, _cols - left);
+            for (int r = 0; r < height; ++r) {
+                read_array(_data + offset + (size_t)r * _chunk * 4, &tiles[index + (size_t)r * _cols].bits, width);
+            }
+        }
+    }
+}
+
+void Snapshot::copyTiles(TileGrid &tiles) const {
+    if (!_chunk) {
+        for (size_t i = 0; i < (size_t)_rows * _cols; ++i) {
+            uint32_t bits = read_le<uint32_t>(_data + _layout.tiles + i * 4);
+            if (bits != 0)
+                tiles[i] = PackedTile{ bits };
+        }
+        return;
+    }
+
+    for (int top = 0; top < _rows; top += _chunk) {
+        for (int left = 0; left < _cols; left += _chunk) {
+            uint64_t offset = tileOffset(left + (size_t)top * _cols);
+            if (offset == 0)
+                continue;
+
+            int height = std::min<int>(_chunk, _rows - top);
+            int width = std::min<int>(_chunk, _cols - left);
+            for (int r = 0; r < height; ++r) {
+                for (int c = 0; c < width; ++c) {
+                    uint32_t bits = read_le<uint32_t>(_data + offset + ((size_t)c + (size_t)r * _chunk) * 4);
+                    if (bits != 0)
+                        tiles.at(top + r, left + c) = PackedTile{ bits };
+                }
+            }
+        }
+    }
+}
+
+TurningRotor Snapshot::turning(size_t i) const {
+    return TurningRotor{
+        (size_t)read_le<uint64_t>(_data + _layout.turning_index + i * 8),
+        read_le<double>(_data + _layout.turning_transition + i * 8),
+    };
+}
+
+void Snapshot::copyBalls(BallArrays &balls) const {
+    size_t count = _ball_count;
+    balls.resize(count);
+
+    read_array(_data + _layout.transition, balls.transition.data(), count);
+    read_array(_data + _layout.row, balls.row.data(), count);
+    read_array(_data + _layout.col, balls.col.data(), count);
+    read_array(_data + _layout.state, (uint8_t *)balls.state.data(), count);
+    read_array(_data + _layout.type, (uint8_t *)balls.type.data(), count);
+    read_array(_data + _layout.position, balls.rotor_position.data(), count);
+
+    std::fill(balls.limit.begin(), balls.limit.end(), std::numeric_limits<double>::infinity());
+    std::fill(balls.segment.begin(), balls.segment.end(), -1);
+}
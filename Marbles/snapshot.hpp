@@ -0,0 +1,128 @@
+#pragma once
+
+#include "mapped_file.hpp"
+#include "model.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Frozen state of a model: its tiles, turning rotors and balls. Snapshots
+// are stored in a versioned little-endian format that models can restore
+// from without decoding the tiles, so that any number of models can be
+// forked from one snapshot. Files are mapped into memory rather than read
+// where the system allows it.
+//
+// All numbers are little-endian and every section starts at a multiple of 8
+// bytes from the start of the snapshot:
+//
+//   header     magic "MRBLSNAP", u32 version, u32 header size, i32 rows,
+//              i32 cols, u64 turning rotors, u64 balls, f64 time,
+//              u64 tile hash, u64 ball hash, u64 snapshot size, u32 chunk
+//              size and u32 chunks, both 0 for dense boards
+//   directory  sparse boards only, u32 per chunk of the board, row by row of
+//              chunks, its number from 1 in the order of the directory or 0
+//              for chunks without any tiles
+//   tiles      rows * cols u32 in the PackedTile layout, or for sparse boards
+//              chunk size * chunk size per chunk in the order of their
+//              numbers, row by row with the tiles beyond the edge of the
+//              board empty. the slots of turning rotors are their index in
+//              the turning section.
+//   turning    u64 tile index per rotor, then f64 transition per rotor
+//   balls      f64 transition, i32 row, i32 col, u8 state, u8 type and
+//              u8 rotor position, each as one array over all balls
+//
+// Balls on plain track are stored with the tile they are on, like
+// Model::ball returns them. The two hashes add up to Model::hash, which
+// models restored from the snapshot start out with. Sparse boards are
+// taken and restored chunk by chunk, so that their empty chunks cost 4
+// bytes and no time.
+class Snapshot {
+public:
+    static constexpr uint32_t VERSION = 4;
+
+    static std::shared_ptr<const Snapshot> capture(const Model &model);
+
+    // returns null and a message if the file can't be read or is not a
+    // snapshot of this version
+    static std::shared_ptr<const Snapshot> load(const char *path, std::string &error);
+    static std::shared_ptr<const Snapshot> fromBytes(std::vector<uint8_t> bytes, std::string &error);
+
+    Snapshot(const Snapshot &) = delete;
+    Snapshot &operator=(const Snapshot &) = delete;
+
+    bool save(const char *path, std::string &error) const;
+
+    const uint8_t *data() const { return _data; }
+    size_t size() const { return _size; }
+
+    int rows() const { return _rows; }
+    int cols() const { return _cols; }
+    double now() const { return _now; }
+    uint64_t tileHash() const { return _tile_hash; }
+    uint64_t ballHash() const { return _ball_hash; }
+    // the storage of the board the snapshot was taken of
+    TileStorage storage() const { return _chunk ? TileStorage::Sparse : TileStorage::Dense; }
+    size_t turningCount() const { return _turning_count; }
+    size_t ballCount() const { return _ball_count; }
+
+    // the tiles in place, null for sparse boards and on big-endian
+    // machines, where they have to be copied
+    const PackedTile *tiles() const;
+    // all rows * cols tiles
+    void copyTiles(PackedTile *tiles) const;
+    // the tiles that aren't empty into a grid of the snapshot's size
+    void copyTiles(TileGrid &tiles) const;
+
+    TurningRotor turning(size_t i) const;
+
+    // replaces the balls, with infinite limits and off any track segment
+    void copyBalls(BallArrays &balls) const;
+
+private:
+    // offsets of the sections and arrays, and the size of the snapshot
+    struct Layout {
+        uint64_t directory;
+        uint64_t tiles;
+        uint64_t turning_index;
+        uint64_t turning_transition;
+        uint64_t transition;
+        uint64_t row;
+        uint64_t col;
+        uint64_t state;
+        uint64_t type;
+        uint64_t position;
+        uint64_t size;
+    };
+
+    // chunk is 0 for dense boards
+    static Layout layout(uint64_t header, int rows, int cols, uint32_t chunk, uint64_t chunks, uint64_t turning, uint64_t balls);
+
+    Snapshot() = default;
+
+    // reads the header and checks the contents of snapshots that don't come
+    // from capture
+    bool parse(std::string &error);
+
+    // offset of the tile with the given index, 0 for tiles of chunks that
+    // aren't stored
+    uint64_t tileOffset(size_t index) const;
+
+    const uint8_t *_data = nullptr;
+    size_t _size = 0;
+    std::vector<uint8_t> _bytes;
+    MappedFile _file;
+
+    Layout _layout{};
+    int _rows = 0;
+    int _cols = 0;
+    uint32_t _chunk = 0;
+    uint32_t _chunk_cols = 0;
+    double _now = 0.0;
+    uint64_t _tile_hash = 0;
+    uint64_t _ball_hash = 0;
+    size_t _turning_count = 0;
+    size_t _ball_count = 0;
+};
@@ -0,0 +1,80 @@
+#include "scenario.hpp"
+#include "solver.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+
+static void usage(const char *name) {
+    std::fprintf(stderr,
+        "usage: %s [--threads N] [--max-states N] [--max-moves N] FILE...\n"
+        "  --threads N     number of search threads (default: all cores)\n"
+        "  --max-states N  give up after N distinct states (default 1048576)\n"
+        "  --max-moves N   give up after N moves (default 32)\n"
+        "solves the boards of the scenarios in the files, their commands are ignored\n",
+        name);
+}
+
+int main(int argc, char **argv) {
+    SolverOptions options;
+    options.threads = (int)std::thread::hardware_concurrency();
+    std::vector<Scenario> scenarios;
+
+    for (int i = 1; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            options.threads = std::atoi(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--max-states") == 0 && i + 1 < argc) {
+            options.max_states = (size_t)std::atoll(argv[++i]);
+        }
+        else if (std::strcmp(argv[i], "--max-moves") == 0 && i + 1 < argc) {
+            options.max_moves = std::atoi(argv[++i]);
+        }
+        else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        }
+        else {
+            std::string error;
+            if (!load_scenarios(argv[i], scenarios, error)) {
+                std::fprintf(stderr, "%s\n", error.c_str());
+                return 1;
+            }
+        }
+    }
+
+    if (scenarios.empty()) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int solved = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (const auto &scenario : scenarios) {
+        Model model(scenario.rows, scenario.cols);
+        setup_scenario(model, scenario);
+
+        SolverResult result = solve(model, options);
+        if (result.solved) {
+            std::printf("%s: solved in %zu moves, %zu states\n", scenario.name.c_str(), result.moves.size(), result.states);
+            for (const auto &move : result.moves) {
+                write_command(stdout, move);
+            }
+            ++solved;
+        }
+        else if (result.exhausted) {
+            std::printf("%s: no solution, %zu states\n", scenario.name.c_str(), result.states);
+        }
+        else {
+            std::printf("%s: gave up after %zu states\n", scenario.name.c_str(), result.states);
+        }
+        std::fflush(stdout);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::fprintf(stderr, "%d of %zu boards solved in %.3f s\n", solved, scenarios.size(), seconds);
+    return 0;
+}
@@ -0,0 +1,415 @@
+#include "solver.hpp"
+
+#include "hash.hpp"
+#include "snapshot.hpp"
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+// everything about the board that moves don't change
+struct Board {
+    int rows;
+    int cols;
+    std::vector<TileType> tiles;
+    // tile index of every rotor, and rotor of every tile or -1
+    std::vector<int> rotors;
+    std::vector<int> rotor_of;
+    std::vector<uint8_t> connected;
+    // the tiles with every rotor in position 0 and no balls, that all the
+    // states are forked from
+    std::shared_ptr<const Snapshot> empty;
+};
+
+// A settled board is stored as one word per rotor: the rotor position in bits
+// 0-1 and the ball type + 1 of slot k in bits 2 + 3k, 0 for an empty slot.
+using Word = uint16_t;
+
+// a state seen by the search, how it was reached first and the order of that
+// move within its level, so that parallel runs pick the same parent
+struct Entry {
+    uint64_t parent;
+    Command move;
+    int depth;
+    uint64_t order;
+};
+
+// States are kept in the shard of their hash, and told apart by their words
+// rather than by the hash alone. Entry i of shard s is state i * SHARDS + s.
+static constexpr size_t SHARDS = 64;
+
+struct Shard {
+    std::mutex mutex;
+    // entries by the hash of their state
+    std::unordered_multimap<uint64_t, size_t> index;
+    std::vector<Entry> entries;
+    // the words of the states, one after the other
+    std::vector<Word> states;
+};
+
+// states found by one thread during a level
+struct Found {
+    std::vector<uint64_t> hashes;
+    std::vector<uint64_t> ids;
+    std::vector<Word> states;
+    uint64_t goal_order = UINT64_MAX;
+    uint64_t goal = 0;
+};
+
+// a state of the next level
+struct Next {
+    uint64_t hash;
+    uint64_t id;
+    const Word *state;
+};
+
+}
+
+static int slot_type(Word word, int slot) {
+    return (word >> (2 + 3 * slot)) & 7;
+}
+
+static uint64_t hash_state(const Word *state, size_t rotors) {
+    uint64_t hash = 0;
+    for (size_t r = 0; r < rotors; ++r) {
+        // features of a rotor: 4 positions, then 4 types for each slot
+        uint64_t base = r * 20;
+        hash ^= mix_hash(base + (state[r] & 3));
+        for (int k = 0; k < 4; ++k) {
+            int type = slot_type(state[r], k);
+            if (type)
+                hash ^= mix_hash(base + 4 + k * 4 + type - 1);
+        }
+    }
+    return hash;
+}
+
+static void build(Model &model, const Board &board, const Word *state) {
+    model.restore(board.empty);
+
+    for (size_t r = 0; r < board.rotors.size(); ++r) {
+        int index = board.rotors[r];
+        if (state[r] & 3)
+            model.setTile(index / board.cols, index % board.cols, TileType::Rotor, state[r] & 3);
+    }
+
+    for (size_t r = 0; r < board.rotors.size(); ++r) {
+        for (int k = 0; k < 4; ++k) {
+            int type = slot_type(state[r], k);
+            if (type) {
+                int index = board.rotors[r];
+                model.addBall(Ball{ BallState::InsideRotor, (BallType)(type - 1), 0, index / board.cols, index % board.cols, k });
+            }
+        }
+    }
+}
+
+// advances the model until nothing moves, false if it doesn't settle in time
+static bool settle(Model &model, double limit) {
+    static constexpr double STEP = 250.0;
+
+    double end = model.now() + limit;
+    for (;;) {
+        model.advanceTo(std::min(model.now() + STEP, end));
+        if (model.idle())
+            return true;
+        if (model.now() >= end)
+            return false;
+    }
+}
+
+// false if a ball ended up outside of the rotors
+static bool extract(const Model &model, const Board &board, Word *state) {
+    for (size_t r = 0; r < board.rotors.size(); ++r) {
+        state[r] = (Word)model.packedTiles()[board.rotors[r]].position();
+    }
+
+    for (const Ball &ball : model.balls()) {
+        if (ball.state != BallState::InsideRotor)
+            return false;
+
+        int rotor = board.rotor_of[ball.col + ball.row * board.cols];
+        state[rotor] |= (Word)(((int)ball.type + 1) << (2 + 3 * ball.rotor_position));
+    }
+    return true;
+}
+
+// the moves worth trying in a state, ejecting only where there is a ball and
+// track to eject it onto
+static void moves_of(const Board &board, const Word *state, std::vector<Command> &moves) {
+    moves.clear();
+    for (size_t r = 0; r < board.rotors.size(); ++r) {
+        int row = board.rotors[r] / board.cols;
+        int col = board.rotors[r] % board.cols;
+
+        moves.push_back(Command{ 0.0, Action::TurnClockwise, row, col });
+        moves.push_back(Command{ 0.0, Action::TurnCounterClockwise, row, col });
+
+        int position = state[r] & 3;
+        for (int d = 0; d < 4; ++d) {
+            if ((board.connected[r] >> d & 1) && slot_type(state[r], (d - position + 4) % 4))
+                moves.push_back(Command{ 0.0, (Action)((int)Action::EjectNorth + d), row, col });
+        }
+    }
+}
+
+bool rotors_sorted(const Model &model) {
+    // ball count and type by rotor
+    std::unordered_map<int, std::pair<int, int>> rotors;
+
+    for (const Ball &ball : model.balls()) {
+        if (ball.state != BallState::InsideRotor)
+            return false;
+
+        auto &rotor = rotors[ball.col + ball.row * model.cols()];
+        if (rotor.first > 0 && rotor.second != (int)ball.type)
+            return false;
+        rotor.first++;
+        rotor.second = (int)ball.type;
+    }
+
+    for (const auto &rotor : rotors) {
+        if (rotor.second.first != 4)
+            return false;
+    }
+    return true;
+}
+
+SolverResult solve(Model &model, const SolverOptions &options) {
+    SolverResult result;
+
+    Board board;
+    board.rows = model.rows();
+    board.cols = model.cols();
+    board.rotor_of.assign((size_t)board.rows * board.cols, -1);
+    for (int i = 0; i < board.rows * board.cols; ++i) {
+        const PackedTile &tile = model.packedTiles()[i];
+        board.tiles.push_back(tile.type());
+        if (tile.type() == TileType::Rotor) {
+            board.rotor_of[i] = (int)board.rotors.size();
+            board.rotors.push_back(i);
+
+            uint8_t connected = 0;
+            for (int d = 0; d < 4; ++d) {
+                connected |= (uint8_t)(tile.connected(d) << d);
+            }
+            board.connected.push_back(connected);
+        }
+    }
+
+    Model empty(board.rows, board.cols);
+    for (int i = 0; i < board.rows * board.cols; ++i) {
+        if (board.tiles[i] != TileType::Empty)
+            empty.setTile(i / board.cols, i % board.cols, board.tiles[i]);
+    }
+    board.empty = Snapshot::capture(empty);
+
+    size_t stride = board.rotors.size();
+    // turning both ways and ejecting in four directions
+    size_t max_moves = 6 * stride;
+
+    std::vector<Word> start(stride);
+    if (!settle(model, options.settle_time) || !extract(model, board, start.data())) {
+        result.exhausted = true;
+        return result;
+    }
+    if (options.goal(model)) {
+        result.solved = true;
+        return result;
+    }
+
+    // enough for every tick of a move as a rule
+    static constexpr size_t HISTORY_BYTES = 1 << 20;
+    std::unique_ptr<Shard[]> shards(new Shard[SHARDS]);
+    std::atomic<size_t> states{ 1 };
+
+    uint64_t root_hash = hash_state(start.data(), stride);
+    uint64_t root = root_hash % SHARDS;
+    Shard &root_shard = shards[root];
+    root_shard.index.emplace(root_hash, 0);
+    root_shard.entries.push_back(Entry{ root, Command{}, 0, 0 });
+    root_shard.states = start;
+
+    std::vector<uint64_t> frontier_ids{ root };
+    std::vector<Word> frontier = start;
+
+    ThreadPool pool(options.threads);
+    std::vector<std::unique_ptr<Model>> models(pool.size());
+    std::vector<Found> found(pool.size());
+
+    uint64_t goal = 0;
+    bool solved = false;
+
+    for (int depth = 1; depth <= options.max_moves && !frontier_ids.empty() && !solved; ++depth) {
+        for (auto &f : found) {
+            f.hashes.clear();
+            f.ids.clear();
+            f.states.clear();
+            f.goal_order = UINT64_MAX;
+        }
+
+        // a move order is the index of the parent in the frontier and the
+        // index of the move, which does not depend on the threads
+        static constexpr size_t CHUNK = 16;
+        size_t count = frontier_ids.size();
+        pool.run((count + CHUNK - 1) / CHUNK, [&](size_t chunk) {
+            int worker = ThreadPool::worker();
+            if (!models[worker]) {
+                models[worker].reset(new Model(board.empty));
+                models[worker]->setHistory(HISTORY_BYTES);
+            }
+            Model &m = *models[worker];
+            Found &mine = found[worker];
+
+            std::vector<Command> moves;
+            std::vector<Word> child(stride);
+
+            for (size_t p = chunk * CHUNK; p < std::min(count, (chunk + 1) * CHUNK); ++p) {
+                // the parent is built once, and the model stepped back to it
+                // after every move rather than built again, which would copy
+                // the tiles and invalidate the track. a history that lost some
+                // of the ticks or actions of a move doesn't get all the way
+                // back, which leaves the model at another time or hash.
+                const Word *parent = frontier.data() + p * stride;
+                moves_of(board, parent, moves);
+                build(m, board, parent);
+                uint64_t built = m.hash();
+
+                for (size_t k = 0; k < moves.size(); ++k) {
+                    if (m.now() != 0.0 || m.hash() != built)
+                        build(m, board, parent);
+
+                    apply_command(m, moves[k]);
+                    bool settled = settle(m, options.settle_time) && extract(m, board, child.data());
+                    bool goal = settled && options.goal(m);
+                    m.rewind(SIZE_MAX);
+                    if (!settled)
+                        continue;
+
+                    uint64_t hash = hash_state(child.data(), stride);
+                    uint64_t order = p * max_moves + k;
+
+                    bool added = false;
+                    uint64_t id = 0;
+                    Shard &shard = shards[hash % SHARDS];
+                    {
+                        std::lock_guard<std::mutex> lock(shard.mutex);
+                        Entry *entry = nullptr;
+                        auto range = shard.index.equal_range(hash);
+                        for (auto it = range.first; it != range.second; ++it) {
+                            if (std::equal(child.begin(), child.end(), shard.states.begin() + it->second * stride)) {
+                                entry = &shard.entries[it->second];
+                                id = it->second * SHARDS + hash % SHARDS;
+                                break;
+                            }
+                        }
+
+                        if (!entry) {
+                            id = shard.entries.size() * SHARDS + hash % SHARDS;
+                            shard.index.emplace(hash, shard.entries.size());
+                            shard.entries.push_back(Entry{ frontier_ids[p], moves[k], depth, order });
+                            shard.states.insert(shard.states.end(), child.begin(), child.end());
+                            added = true;
+                        }
+                        else if (entry->depth != depth) {
+                            continue;
+                        }
+                        else if (order < entry->order) {
+                            entry->parent = frontier_ids[p];
+                            entry->move = moves[k];
+                            entry->order = order;
+                        }
+                    }
+
+                    if (added)
+                        ++states;
+
+                    if (goal) {
+                        if (order < mine.goal_order) {
+                            mine.goal_order = order;
+                            mine.goal = id;
+                        }
+                        continue;
+                    }
+                    if (!added)
+                        continue;
+
+                    mine.hashes.push_back(hash);
+                    mine.ids.push_back(id);
+                    mine.states.insert(mine.states.end(), child.begin(), child.end());
+                }
+            }
+        });
+
+        uint64_t goal_order = UINT64_MAX;
+        for (const auto &f : found) {
+            if (f.goal_order < goal_order) {
+                goal_order = f.goal_order;
+                goal = f.goal;
+                solved = true;
+            }
+        }
+        // the limit is only checked between levels, where the states seen
+        // don't depend on which thread got how far
+        if (solved || states >= options.max_states)
+            break;
+
+        // the next level in the order of the hashes and then the words of the
+        // states, so that it is the same for any number of threads
+        std::vector<Next> next;
+        for (const auto &f : found) {
+            for (size_t i = 0; i < f.hashes.size(); ++i) {
+                next.push_back(Next{ f.hashes[i], f.ids[i], f.states.data() + i * stride });
+            }
+        }
+        std::sort(next.begin(), next.end(), [stride](const Next &a, const Next &b) {
+            if (a.hash != b.hash)
+                return a.hash < b.hash;
+            return std::lexicographical_compare(a.state, a.state + stride, b.state, b.state + stride);
+        });
+
+        std::vector<uint64_t> next_ids;
+        std::vector<Word> next_states;
+        next_ids.reserve(next.size());
+        next_states.reserve(next.size() * stride);
+        for (const auto &n : next) {
+            next_ids.push_back(n.id);
+            next_states.insert(next_states.end(), n.state, n.state + stride);
+        }
+        frontier_ids.swap(next_ids);
+        frontier.swap(next_states);
+
+        if (frontier_ids.empty())
+            result.exhausted = true;
+    }
+
+    result.states = states;
+    if (!solved)
+        return result;
+
+    for (uint64_t id = goal; id != root;) {
+        const Entry &entry = shards[id % SHARDS].entries[id / SHARDS];
+        result.moves.push_back(entry.move);
+        id = entry.parent;
+    }
+    std::reverse(result.moves.begin(), result.moves.end());
+
+    // replay the moves to time them
+    Model replay(board.empty);
+    build(replay, board, start.data());
+    for (auto &move : result.moves) {
+        move.time = replay.now();
+        apply_command(replay, move);
+        settle(replay, options.settle_time);
+    }
+
+    result.solved = true;
+    return result;
+}
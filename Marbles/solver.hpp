@@ -0,0 +1,47 @@
+#pragma once
+
+#include "command.hpp"
+#include "model.hpp"
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+// true for the boards the solver is looking for
+using Goal = std::function<bool(const Model &)>;
+
+// every ball is inside a rotor, and every rotor is either empty or holds four
+// balls of one type
+bool rotors_sorted(const Model &model);
+
+struct SolverOptions {
+    int threads = 1;
+    // distinct states the search may visit before it gives up, checked
+    // after every level of moves, so the last level may go over it
+    size_t max_states = 1 << 20;
+    int max_moves = 32;
+    // simulated milliseconds a move may take until nothing moves any more
+    double settle_time = 60000.0;
+    Goal goal = rotors_sorted;
+};
+
+struct SolverResult {
+    bool solved = false;
+    // there is no solution: the search ran out of moves to try rather than
+    // giving up at one of the limits, or the start state never settled or
+    // already lost a ball
+    bool exhausted = false;
+    // a shortest solution, timed from the moment the start state settled
+    std::vector<Command> moves;
+    size_t states = 0;
+};
+
+// Breadth first search over the actions a player can take: turning a rotor
+// either way and ejecting a ball. A move is an action followed by simulating
+// until nothing moves. Moves that lose a ball outside of a rotor or never
+// settle are dead ends. States are the rotor positions and the balls in every
+// rotor slot, looked up by a Zobrist hash of them.
+//
+// The model is first advanced until it settles, which is where the search
+// starts.
+SolverResult solve(Model &model, const SolverOptions &options = SolverOptions());
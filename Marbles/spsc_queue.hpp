@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+// Queue of at most Capacity values from one thread to another, without
+// locks. Either side only writes its own end, and the counters only grow,
+// so a full queue can be told from an empty one.
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "the capacity has to be a power of two");
+
+public:
+    // from the producer, false if the queue is full
+    bool push(const T &value) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == Capacity)
+            return false;
+        _items[tail & (Capacity - 1)] = value;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // from the consumer, false if the queue is empty
+    bool pop(T &value) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire))
+            return false;
+        value = _items[head & (Capacity - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    T _items[Capacity];
+    // on lines of their own, so that the two threads don't contend for them
+    alignas(64) std::atomic<size_t> _head{ 0 };
+    alignas(64) std::atomic<size_t> _tail{ 0 };
+};
@@ -0,0 +1,442 @@
+#pragma once
+
+#include "level.hpp"
+#include "scenario.hpp"
+#include "transitions.hpp"
+
+#include <cstddef>
+#include <cstdint>
+
+// The grammar of the text form of level.hpp, written so that the compiler can
+// run it. parse_level reads level files with it, and levels can be built into
+// the program as tables that are parsed by the compiler and ready to be
+// copied into a model:
+//
+//   static constexpr char LOOPS[] =
+//       "board 3 8\n"
+//       "r-7  o-o\n"
+//       ...;
+//   MARBLES_LEVEL(LOOPS_LEVEL, LOOPS);
+//
+//   load_level(LOOPS_LEVEL.table(), model);
+//
+// A malformed level doesn't compile, the static_assert that fails says what
+// is wrong with it and error_line of the level has the line. Transitions
+// have to be plain decimals like 0.125 there.
+
+enum class LevelError : uint8_t {
+    None,
+    NoBoard,
+    SecondBoard,
+    BadBoard,
+    LargeBoard,
+    BoardEndsEarly,
+    LongRow,
+    UnknownTile,
+    NoRotor,
+    RotorPosition,
+    BadBall,
+    UnknownDirection,
+    BadTransition,
+    BallOutside,
+    NoRotorForBall,
+    PositionTaken,
+    UnknownKeyword,
+};
+
+// the lines and tokens of a level, read in place
+class LevelScanner {
+public:
+    constexpr explicit LevelScanner(const char *text) :
+        LevelScanner(text, length(text))
+    {
+    }
+
+    constexpr LevelScanner(const char *text, size_t size) :
+        _pos(text), _end(text + size)
+    {
+    }
+
+    constexpr int lineNumber() const { return _number; }
+
+    // moves on to the next line, false at the end of the text
+    constexpr bool nextLine() {
+        if (_pos == _end)
+            return false;
+
+        _line = _pos;
+        while (_pos != _end && *_pos != '\n')
+            ++_pos;
+        _line_end = _pos;
+        if (_pos != _end)
+            ++_pos;
+        if (_line_end > _line && _line_end[-1] == '\r')
+            --_line_end;
+        ++_number;
+        return true;
+    }
+
+    // the rest of the current line
+    constexpr const char *line() const { return _line; }
+    constexpr size_t lineSize() const { return _line_end - _line; }
+
+    // true if the line has another token
+    constexpr bool more() {
+        while (_line < _line_end && (*_line == ' ' || *_line == '\t'))
+            ++_line;
+        return _line < _line_end;
+    }
+
+    // next token of the line, false if there is none
+    constexpr bool token(const char *&token, size_t &size) {
+        if (!more())
+            return false;
+
+        token = _line;
+        while (_line < _line_end && *_line != ' ' && *_line != '\t')
+            ++_line;
+        size = _line - token;
+        return true;
+    }
+
+    constexpr bool number(int &value) {
+        const char *text = nullptr;
+        size_t size = 0;
+        if (!token(text, size))
+            return false;
+
+        bool negative = text[0] == '-';
+        size_t i = negative ? 1 : 0;
+        if (i == size)
+            return false;
+
+        int64_t result = 0;
+        for (; i < size; ++i) {
+            if (text[i] < '0' || text[i] > '9' || result > INT32_MAX)
+                return false;
+            result = result * 10 + (text[i] - '0');
+        }
+        if (result > INT32_MAX)
+            return false;
+        value = (int)(negative ? -result : result);
+        return true;
+    }
+
+    // digits with an optional fraction. the digits are divided by a power
+    // of ten that doubles hold exactly, which rounds like from_chars does.
+    static constexpr bool decimal(const char *text, size_t size, double &value) {
+        uint64_t digits = 0;
+        int fraction = -1;
+        for (size_t i = 0; i < size; ++i) {
+            if (text[i] == '.' && fraction < 0) {
+                fraction = 0;
+                continue;
+            }
+            if (text[i] < '0' || text[i] > '9' || digits >= (uint64_t)1 << 49)
+                return false;
+            digits = digits * 10 + (text[i] - '0');
+            if (fraction >= 0)
+                ++fraction;
+        }
+        if (size == 0 || (size == 1 && fraction == 0))
+            return false;
+
+        double scale = 1.0;
+        for (int i = 0; i < fraction; ++i) {
+            scale *= 10.0;
+        }
+        value = (double)digits / scale;
+        return true;
+    }
+
+    // index of the next token in names, -1 if it is none of them
+    template <size_t N>
+    constexpr int choice(const char *const (&names)[N]) {
+        const char *text = nullptr;
+        size_t size = 0;
+        if (!token(text, size))
+            return -1;
+        for (size_t i = 0; i < N; ++i) {
+            if (same(text, size, names[i]))
+                return (int)i;
+        }
+        return -1;
+    }
+
+    static constexpr bool same(const char *text, size_t size, const char *word) {
+        for (size_t i = 0; i < size; ++i) {
+            if (word[i] != text[i])
+                return false;
+        }
+        return word[size] == '\0';
+    }
+
+private:
+    static constexpr size_t length(const char *text) {
+        size_t size = 0;
+        while (text[size] != '\0')
+            ++size;
+        return size;
+    }
+
+    const char *_pos;
+    const char *_end;
+    const char *_line = nullptr;
+    const char *_line_end = nullptr;
+    int _number = 0;
+};
+
+// tile types by symbol, -1 for unknown symbols
+struct SymbolTypes {
+    int8_t types[256];
+};
+
+constexpr SymbolTypes symbol_types() {
+    SymbolTypes table{};
+    for (int symbol = 0; symbol < 256; ++symbol) {
+        TileType type = TileType::Empty;
+        table.types[symbol] = tile_from_symbol((char)symbol, type) ? (int8_t)type : (int8_t)-1;
+    }
+    return table;
+}
+
+inline constexpr SymbolTypes SYMBOL_TYPES = symbol_types();
+
+// where and why parse_level_text stopped
+struct LevelResult {
+    LevelError error = LevelError::None;
+    int line = 0;
+    // the unknown tile symbol or keyword
+    const char *token = nullptr;
+    size_t token_size = 0;
+};
+
+// Reads a level and hands what it reads to the builder, which has
+//
+//   LevelError board(int rows, int cols)    None for a board it can hold
+//   TileType type(int row, int col)         only reads the tile
+//   PackedTile &tile(int row, int col)      for writing, not for empty tiles
+//   bool ball(const Ball &ball)             false if there is no room
+//   bool transition(const char *text, size_t size, double &value)
+//
+// and gets tiles, rotor positions and the taken flags of rotors with balls.
+template <typename Builder>
+constexpr LevelResult parse_level_text(LevelScanner &reader, Builder &builder) {
+    constexpr const char *TYPES[] = { "red", "green", "blue", "yellow" };
+    constexpr const char *STATES[] = { "inside", "entering", "exiting" };
+    constexpr const char *DIRECTIONS[] = { "N", "E", "S", "W" };
+
+    int rows = 0;
+    int cols = 0;
+
+    auto fail = [&](LevelError error, const char *token = nullptr, size_t token_size = 0) {
+        return LevelResult{ error, reader.lineNumber(), token, token_size };
+    };
+
+    while (reader.nextLine()) {
+        const char *keyword = nullptr;
+        size_t length = 0;
+        if (!reader.token(keyword, length) || keyword[0] == '#')
+            continue;
+
+        if (LevelScanner::same(keyword, length, "board")) {
+            int height = 0, width = 0;
+            if (rows > 0)
+                return fail(LevelError::SecondBoard);
+            if (!reader.number(height) || !reader.number(width) || height <= 0 || width <= 0)
+                return fail(LevelError::BadBoard);
+            LevelError error = builder.board(height, width);
+            if (error != LevelError::None)
+                return fail(error);
+            rows = height;
+            cols = width;
+
+            for (int r = 0; r < rows; ++r) {
+                if (!reader.nextLine())
+                    return fail(LevelError::BoardEndsEarly);
+
+                const char *line = reader.line();
+                size_t count = reader.lineSize();
+                if (count > (size_t)cols)
+                    return fail(LevelError::LongRow);
+
+                for (size_t c = 0; c < count; ++c) {
+                    int type = SYMBOL_TYPES.types[(uint8_t)line[c]];
+                    if (type < 0)
+                        return fail(LevelError::UnknownTile, line + c, 1);
+                    if (type != 0)
+                        builder.tile(r, (int)c).setType((TileType)type);
+                }
+            }
+        }
+        else if (rows == 0) {
+            return fail(LevelError::NoBoard);
+        }
+        else if (LevelScanner::same(keyword, length, "rotor")) {
+            int row = 0, col = 0, position = 0;
+            if (!reader.number(row) || !reader.number(col) || !reader.number(position))
+                return fail(LevelError::NoRotor);
+            if (row < 0 || row >= rows || col < 0 || col >= cols || builder.type(row, col) != TileType::Rotor)
+                return fail(LevelError::NoRotor);
+            if (position < 0 || position > 3)
+                return fail(LevelError::RotorPosition);
+            builder.tile(row, col).setPosition(position);
+        }
+        else if (LevelScanner::same(keyword, length, "ball")) {
+            Ball ball{};
+            int type = -1, state = -1, where = -1;
+            if (!reader.number(ball.row) || !reader.number(ball.col)
+                || (type = reader.choice(TYPES)) < 0 || (state = reader.choice(STATES)) < 0)
+            {
+                return fail(LevelError::BadBall);
+            }
+            ball.type = (BallType)type;
+
+            if (state == 0) {
+                if (!reader.number(where) || where < 0 || where > 3)
+                    return fail(LevelError::RotorPosition);
+                ball.state = BallState::InsideRotor;
+                ball.rotor_position = where;
+            }
+            else {
+                if ((where = reader.choice(DIRECTIONS)) < 0)
+                    return fail(LevelError::UnknownDirection);
+                ball.state = state == 1 ? entering_from(where) : exiting_towards(where);
+
+                const char *text = nullptr;
+                size_t size = 0;
+                if (reader.token(text, size) && !builder.transition(text, size, ball.transition))
+                    return fail(LevelError::BadTransition);
+                if (!(ball.transition >= 0.0 && ball.transition < 0.5))
+                    return fail(LevelError::BadTransition);
+            }
+
+            if (ball.row < 0 || ball.row >= rows || ball.col < 0 || ball.col >= cols)
+                return fail(LevelError::BallOutside);
+            if (ball.state == BallState::InsideRotor) {
+                if (builder.type(ball.row, ball.col) != TileType::Rotor)
+                    return fail(LevelError::NoRotorForBall);
+                PackedTile &tile = builder.tile(ball.row, ball.col);
+                if (tile.taken(where))
+                    return fail(LevelError::PositionTaken);
+                tile.setTaken(where, true);
+            }
+            if (!builder.ball(ball))
+                return fail(LevelError::BadBall);
+        }
+        else {
+            return fail(LevelError::UnknownKeyword, keyword, length);
+        }
+    }
+
+    if (rows == 0)
+        return fail(LevelError::NoBoard);
+    return LevelResult{};
+}
+
+// what the tables of a level need room for, read before it is parsed
+struct LevelShape {
+    int rows = 0;
+    int cols = 0;
+    size_t balls = 0;
+};
+
+constexpr LevelShape level_shape(const char *text) {
+    LevelShape shape;
+    LevelScanner reader(text);
+    while (reader.nextLine()) {
+        const char *keyword = nullptr;
+        size_t length = 0;
+        if (!reader.token(keyword, length))
+            continue;
+
+        int rows = 0, cols = 0;
+        if (LevelScanner::same(keyword, length, "board") && shape.rows == 0
+            && reader.number(rows) && reader.number(cols) && rows > 0 && cols > 0)
+        {
+            shape.rows = rows;
+            shape.cols = cols;
+        }
+        else if (LevelScanner::same(keyword, length, "ball")) {
+            ++shape.balls;
+        }
+    }
+    return shape;
+}
+
+template <int Rows, int Cols, size_t Balls>
+struct StaticLevel {
+    PackedTile tiles[Rows * Cols > 0 ? Rows * Cols : 1]{};
+    Ball balls[Balls > 0 ? Balls : 1]{};
+    size_t ball_count = 0;
+    LevelError error = LevelError::None;
+    int error_line = 0;
+
+    constexpr LevelTable table() const {
+        return LevelTable{ Rows, Cols, tiles, balls, ball_count };
+    }
+};
+
+// builds a StaticLevel for parse_level_text
+template <int Rows, int Cols, size_t Balls>
+struct StaticLevelBuilder {
+    StaticLevel<Rows, Cols, Balls> &level;
+
+    constexpr LevelError board(int rows, int cols) const {
+        return rows == Rows && cols == Cols ? LevelError::None : LevelError::BadBoard;
+    }
+
+    constexpr TileType type(int row, int col) const { return level.tiles[col + (size_t)row * Cols].type(); }
+    constexpr PackedTile &tile(int row, int col) const { return level.tiles[col + (size_t)row * Cols]; }
+
+    constexpr bool ball(const Ball &ball) const {
+        if (level.ball_count == Balls)
+            return false;
+        level.balls[level.ball_count++] = ball;
+        return true;
+    }
+
+    static constexpr bool transition(const char *text, size_t size, double &value) {
+        return LevelScanner::decimal(text, size, value);
+    }
+};
+
+template <int Rows, int Cols, size_t Balls>
+constexpr StaticLevel<Rows, Cols, Balls> parse_static_level(const char *text) {
+    StaticLevel<Rows, Cols, Balls> level{};
+    LevelScanner reader(text);
+    StaticLevelBuilder<Rows, Cols, Balls> builder{ level };
+
+    LevelResult result = parse_level_text(reader, builder);
+    if (result.error != LevelError::None) {
+        level.error = result.error;
+        level.error_line = result.line;
+        return level;
+    }
+
+    // the taken flags were only needed to find positions taken twice
+    for (PackedTile &tile : level.tiles) {
+        tile.bits &= 0x3f;
+    }
+    return level;
+}
+
+// defines the level name parsed from the level string text, both constexpr
+#define MARBLES_LEVEL(name, text) \
+    static constexpr auto name = parse_static_level<level_shape(text).rows, level_shape(text).cols, level_shape(text).balls>(text); \
+    static_assert(name.error != LevelError::NoBoard, #name ": expected: board <rows> <cols>"); \
+    static_assert(name.error != LevelError::SecondBoard, #name ": the level already has a board"); \
+    static_assert(name.error != LevelError::BadBoard, #name ": expected: board <rows> <cols>"); \
+    static_assert(name.error != LevelError::LargeBoard, #name ": the board is too large"); \
+    static_assert(name.error != LevelError::BoardEndsEarly, #name ": the board ends early"); \
+    static_assert(name.error != LevelError::LongRow, #name ": board row is longer than the board"); \
+    static_assert(name.error != LevelError::UnknownTile, #name ": unknown tile"); \
+    static_assert(name.error != LevelError::NoRotor, #name ": expected: rotor <row> <col> <position> of a rotor"); \
+    static_assert(name.error != LevelError::RotorPosition, #name ": rotor position has to be 0 to 3"); \
+    static_assert(name.error != LevelError::BadBall, #name ": expected: ball <row> <col> <type> <state> <direction or position>"); \
+    static_assert(name.error != LevelError::UnknownDirection, #name ": unknown direction"); \
+    static_assert(name.error != LevelError::BadTransition, #name ": transition has to be a decimal of at least 0 and less than 0.5"); \
+    static_assert(name.error != LevelError::BallOutside, #name ": ball outside of the board"); \
+    static_assert(name.error != LevelError::NoRotorForBall, #name ": ball inside a rotor that is not there"); \
+    static_assert(name.error != LevelError::PositionTaken, #name ": rotor position taken twice"); \
+    static_assert(name.error != LevelError::UnknownKeyword, #name ": unknown keyword")
@@ -0,0 +1,80 @@
+#include "thread_pool.hpp"
+
+#include "profile.hpp"
+
+static thread_local int t_worker = 0;
+
+ThreadPool::ThreadPool(int threads) {
+    for (int i = 1; i < threads; ++i) {
+        _workers.emplace_back([this, i] { work(i); });
+    }
+}
+
+int ThreadPool::worker() {
+    return t_worker;
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stop = true;
+    }
+    _wake.notify_all();
+
+    for (auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t count, const std::function<void(size_t)> &task) {
+    if (_workers.empty() || count <= 1) {
+        for (size_t k = 0; k < count; ++k) {
+            task(k);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _task = &task;
+        _count = count;
+        _next = 0;
+        _busy = _workers.size();
+        ++_generation;
+    }
+    _wake.notify_all();
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done.wait(lock, [this] { return _busy == 0; });
+    _task = nullptr;
+}
+
+void ThreadPool::drain() {
+    for (size_t k = _next++; k < _count; k = _next++) {
+        (*_task)(k);
+    }
+}
+
+void ThreadPool::work(int index) {
+    t_worker = index;
+    PROFILE_THREAD(("worker " + std::to_string(index)).c_str());
+
+    uint64_t generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _wake.wait(lock, [&] { return _stop || _generation != generation; });
+            if (_stop)
+                return;
+            generation = _generation;
+        }
+
+        drain();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (--_busy == 0)
+            _done.notify_one();
+    }
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run batches of tasks. The calling thread
+// works on a batch too, and tasks are claimed one at a time, so threads that
+// finish early pick up the remaining ones.
+class ThreadPool {
+public:
+    // threads counts the calling thread, a pool of one runs everything inline
+    explicit ThreadPool(int threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    int size() const { return (int)_workers.size() + 1; }
+
+    // index of the calling thread in its pool, 0 for threads that are not
+    // workers of a pool
+    static int worker();
+
+    // calls task(k) for every k in [0, count) and returns once all calls
+    // have finished
+    void run(size_t count, const std::function<void(size_t)> &task);
+
+private:
+    void work(int index);
+    void drain();
+
+    std::vector<std::thread> _workers;
+
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+
+    const std::function<void(size_t)> *_task = nullptr;
+    size_t _count = 0;
+    std::atomic<size_t> _next{ 0 };
+    size_t _busy = 0;
+    uint64_t _generation = 0;
+    bool _stop = false;
+};
@@ -0,0 +1,242 @@
+#include "track.hpp"
+
+#include "model.hpp"
+#include "transitions.hpp"
+
+static constexpr int DROW[4] = { -1, 0, 1, 0 };
+static constexpr int DCOL[4] = { 0, 1, 0, -1 };
+
+static uint64_t key_of(TrackNode node) {
+    return (uint64_t)node.index * 4 + node.direction;
+}
+
+static bool same(TrackNode a, TrackNode b) {
+    return a.index == b.index && a.direction == b.direction;
+}
+
+static const TileSpec &spec_at(const Model &model, size_t index) {
+    return TILE_SPECS[(int)model.packedTiles()[index].type()];
+}
+
+// true if a ball entering the tile at row, col from the given direction
+// travels on plain track
+static bool is_node(const Model &model, int row, int col, int direction) {
+    if (row < 0 || row >= model.rows() || col < 0 || col >= model.cols())
+        return false;
+
+    const TileSpec &spec = spec_at(model, col + (size_t)row * model.cols());
+    return !spec.rotor && spec.exits[direction] >= 0;
+}
+
+// node a ball reaches after crossing the given node, false if it leaves
+// plain track
+static bool successor(const Model &model, TrackNode node, TrackNode &next) {
+    int row = (int)(node.index / model.cols());
+    int col = (int)(node.index % model.cols());
+    int exit = spec_at(model, node.index).exits[node.direction];
+
+    row += DROW[exit];
+    col += DCOL[exit];
+    if (!is_node(model, row, col, (exit + 2) % 4))
+        return false;
+
+    next = TrackNode{ col + (size_t)row * model.cols(), (exit + 2) % 4 };
+    return true;
+}
+
+// node a ball crossed before entering the given node, false if it came from
+// anything but plain track or if several tracks merge into the node
+static bool predecessor(const Model &model, TrackNode node, TrackNode &prev) {
+    int row = (int)(node.index / model.cols()) + DROW[node.direction];
+    int col = (int)(node.index % model.cols()) + DCOL[node.direction];
+    if (row < 0 || row >= model.rows() || col < 0 || col >= model.cols())
+        return false;
+
+    size_t index = col + (size_t)row * model.cols();
+    const TileSpec &spec = spec_at(model, index);
+    if (spec.rotor)
+        return false;
+
+    int towards = (node.direction + 2) % 4;
+    int count = 0;
+    for (int d = 0; d < 4; ++d) {
+        if (spec.exits[d] == towards) {
+            prev = TrackNode{ index, d };
+            ++count;
+        }
+    }
+    return count == 1;
+}
+
+// finds the key of the first node of the segment that contains the given
+// node by walking back to it, returns true if the segment is a cycle. cycles start at the node with
+// the smallest key.
+bool TrackGraph::startKey(const Model &model, TrackNode node, uint64_t &key, int &offset) const {
+    TrackNode current = node;
+    TrackNode prev;
+    int steps = 0;
+
+    uint64_t min_key = key_of(node);
+    int min_steps = 0;
+
+    while (predecessor(model, current, prev)) {
+        current = prev;
+        ++steps;
+
+        if (same(current, node)) {
+            key = min_key;
+            offset = min_steps;
+            return true;
+        }
+
+        if (key_of(current) < min_key) {
+            min_key = key_of(current);
+            min_steps = steps;
+        }
+    }
+
+    key = key_of(current);
+    offset = steps;
+    return false;
+}
+
+int TrackGraph::build(const Model &model, TrackNode start, bool cycle) {
+    int id;
+    if (!_free.empty()) {
+        id = _free.back();
+        _free.pop_back();
+    }
+    else {
+        id = (int)_segments.size();
+        _segments.emplace_back();
+    }
+
+    Segment &segment = _segments[id];
+    segment.nodes.clear();
+    segment.cycle = cycle;
+    segment.stale = false;
+    segment.nodes.push_back(start);
+
+    TrackNode current = start;
+    TrackNode next;
+    TrackNode prev;
+    while (successor(model, current, next)) {
+        // back at the start of a loop, or at a node where tracks merge
+        if (same(next, start) || !predecessor(model, next, prev))
+            break;
+
+        segment.nodes.push_back(next);
+        current = next;
+    }
+
+    for (size_t k = 0; k < segment.nodes.size(); ++k) {
+        _by_node[key_of(segment.nodes[k])] = Place{ id, (int)k };
+    }
+    return id;
+}
+
+void TrackGraph::markStale(int id) {
+    Segment &segment = _segments[id];
+    for (const TrackNode &node : segment.nodes) {
+        _by_node.erase(key_of(node));
+    }
+    segment.stale = true;
+    _stale.push_back(id);
+}
+
+int TrackGraph::find(const Model &model, TrackNode node, int &offset) {
+    if (!is_node(model, (int)(node.index / model.cols()), (int)(node.index % model.cols()), node.direction))
+        return -1;
+
+    auto it = _by_node.find(key_of(node));
+    if (it != _by_node.end()) {
+        offset = it->second.offset;
+        return it->second.segment;
+    }
+
+    uint64_t key;
+    bool cycle = startKey(model, node, key, offset);
+    return build(model, TrackNode{ (size_t)(key / 4), (int)(key % 4) }, cycle);
+}
+
+Ball TrackGraph::position(const Model &model, int id, double distance, BallType type) const {
+    const Segment &segment = _segments[id];
+
+    int k = (int)distance;
+    if (k < 0)
+        k = 0;
+    if (k >= (int)segment.nodes.size())
+        k = (int)segment.nodes.size() - 1;
+
+    TrackNode node = segment.nodes[k];
+    double within = distance - k;
+
+    Ball ball{};
+    ball.type = type;
+    ball.row = (int)(node.index / model.cols());
+    ball.col = (int)(node.index % model.cols());
+    if (within < 0.5) {
+        ball.state = entering_from(node.direction);
+        ball.transition = within;
+    }
+    else {
+        ball.state = exiting_towards(spec_at(model, node.index).exits[node.direction]);
+        ball.transition = within - 0.5;
+    }
+    return ball;
+}
+
+Ball TrackGraph::exit(const Model &model, int id, double overshoot, BallType type) const {
+    TrackNode last = _segments[id].nodes.back();
+    int exit = spec_at(model, last.index).exits[last.direction];
+
+    Ball ball{};
+    ball.type = type;
+    ball.state = entering_from((exit + 2) % 4);
+    ball.transition = overshoot;
+    ball.row = (int)(last.index / model.cols()) + DROW[exit];
+    ball.col = (int)(last.index % model.cols()) + DCOL[exit];
+    return ball;
+}
+
+void TrackGraph::invalidate(const Model &model, int row, int col) {
+    if (_by_node.empty())
+        return;
+
+    static constexpr int AREA_ROW[5] = { 0, -1, 0, 1, 0 };
+    static constexpr int AREA_COL[5] = { 0, 0, 1, 0, -1 };
+
+    for (int i = 0; i < 5; ++i) {
+        int r = row + AREA_ROW[i];
+        int c = col + AREA_COL[i];
+
+        for (int d = 0; d < 4; ++d) {
+            if (!is_node(model, r, c, d))
+                continue;
+
+            auto it = _by_node.find(key_of(TrackNode{ c + (size_t)r * model.cols(), d }));
+            if (it != _by_node.end())
+                markStale(it->second.segment);
+        }
+    }
+}
+
+void TrackGraph::invalidateAll() {
+    // free segments have no nodes
+    for (size_t id = 0; id < _segments.size(); ++id) {
+        if (!_segments[id].stale && !_segments[id].nodes.empty()) {
+            _segments[id].stale = true;
+            _stale.push_back((int)id);
+        }
+    }
+    _by_node.clear();
+}
+
+void TrackGraph::dropStale() {
+    for (int id : _stale) {
+        _segments[id].nodes.clear();
+        _segments[id].stale = false;
+        _free.push_back(id);
+    }
+    _stale.clear();
+}
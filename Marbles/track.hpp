@@ -0,0 +1,73 @@
+#pragma once
+
+#include "balls.hpp"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class Model;
+
+// A tile a ball travels across and the direction it enters the tile from.
+struct TrackNode {
+    size_t index;
+    int direction;
+};
+
+// A maximal run of plain track, i.e. anything but empty tiles and rotors.
+// A ball on a segment is described by its distance from the start of the
+// first node, and crossing one node takes one unit of distance. Segments end
+// in front of rotors, empty tiles, dead ends and the board edge, or wrap
+// around for closed loops.
+struct Segment {
+    std::vector<TrackNode> nodes;
+    bool cycle = false;
+    bool stale = false;
+
+    double length() const { return (double)nodes.size(); }
+};
+
+// Segments are compiled from the tiles of a model on demand, when a ball
+// enters plain track for the first time, and every node of a segment is
+// indexed so that finding it again takes one lookup. Editing a tile marks the
+// segments through it and its neighbours as stale, they are dropped once the
+// model has moved its balls off them.
+class TrackGraph {
+public:
+    // segment that contains the given node and the node's offset in it,
+    // returns -1 if the node is not on plain track
+    int find(const Model &model, TrackNode node, int &offset);
+
+    const Segment &segment(int id) const { return _segments[id]; }
+
+    // ball at the given distance along a segment
+    Ball position(const Model &model, int id, double distance, BallType type) const;
+
+    // ball that just left the end of a segment that is not a cycle
+    Ball exit(const Model &model, int id, double overshoot, BallType type) const;
+
+    // has to be called before the tile at row, col changes
+    void invalidate(const Model &model, int row, int col);
+    void invalidateAll();
+
+    bool hasStale() const { return !_stale.empty(); }
+    void dropStale();
+
+private:
+    // segment of a node and the node's offset in it
+    struct Place {
+        int segment;
+        int offset;
+    };
+
+    bool startKey(const Model &model, TrackNode node, uint64_t &key, int &offset) const;
+    int build(const Model &model, TrackNode start, bool cycle);
+    void markStale(int id);
+
+    std::vector<Segment> _segments;
+    std::vector<int> _free;
+    std::vector<int> _stale;
+
+    // the segments that aren't stale, by the keys of all their nodes
+    std::unordered_map<uint64_t, Place> _by_node;
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "model.hpp"
+
+#include <cstdint>
+#include <limits>
+
+// Directions are numbered north, east, south, west, like the ports of a rotor.
+
+// How balls travel across a tile type. exits[d] is the direction in which a
+// ball that entered from direction d leaves the tile, or -1 if the tile has no
+// track coming from that direction. Rotors decide at runtime whether they
+// capture a ball or send it back.
+struct TileSpec {
+    bool rotor;
+    int8_t exits[4];
+};
+
+static constexpr TileSpec TILE_SPECS[] = {
+    /* Empty           */ { false, { -1, -1, -1, -1 } },
+    /* CornerNorthEast */ { false, {  1,  0, -1, -1 } },
+    /* CornerNorthWest */ { false, {  3, -1, -1,  0 } },
+    /* CornerSouthEast */ { false, { -1,  2,  1, -1 } },
+    /* CornerSouthWest */ { false, { -1, -1,  3,  2 } },
+    /* Horizontal      */ { false, { -1,  3, -1,  1 } },
+    /* Vertical        */ { false, {  2, -1,  0, -1 } },
+    /* Crossing        */ { false, {  2,  3,  0,  1 } },
+    /* Rotor           */ { true,  { -1, -1, -1, -1 } },
+};
+
+static constexpr int TILE_TYPE_COUNT = sizeof(TILE_SPECS) / sizeof(TILE_SPECS[0]);
+static constexpr int BALL_STATE_COUNT = (int)BallState::InsideRotor + 1;
+
+static_assert((int)TileType::Rotor + 1 == TILE_TYPE_COUNT, "every tile type needs a TileSpec");
+
+// true if the tile has track leading towards the given direction
+constexpr bool has_port(TileType type, int direction) {
+    const TileSpec &spec = TILE_SPECS[(int)type];
+    for (int d = 0; d < 4; ++d) {
+        if (d == direction && spec.exits[d] >= 0)
+            return true;
+        if (spec.exits[d] == direction)
+            return true;
+    }
+    return false;
+}
+
+constexpr BallState entering_from(int direction) {
+    return (BallState)((int)BallState::EnteringFromNorth + direction);
+}
+
+constexpr BallState exiting_towards(int direction) {
+    return (BallState)((int)BallState::ExitingTowardsNorth + direction);
+}
+
+// What happens to a ball in a given state on a given tile type once its
+// transition reaches threshold. Regular transitions subtract the threshold
+// from the ball's transition, switch to next and move the ball by drow/dcol.
+// Rotor transitions either capture the ball or bounce it back as next.
+struct Transition {
+    double threshold;
+    BallState next;
+    int8_t drow;
+    int8_t dcol;
+    bool rotor;
+};
+
+struct TransitionTable {
+    Transition entries[TILE_TYPE_COUNT][BALL_STATE_COUNT];
+
+    constexpr const Transition &operator()(TileType type, BallState state) const {
+        return entries[(int)type][(int)state];
+    }
+};
+
+constexpr TransitionTable make_transitions() {
+    constexpr double INF = std::numeric_limits<double>::infinity();
+    constexpr int8_t DROW[4] = { -1, 0, 1, 0 };
+    constexpr int8_t DCOL[4] = { 0, 1, 0, -1 };
+
+    TransitionTable table{};
+    for (int type = 0; type < TILE_TYPE_COUNT; ++type) {
+        const TileSpec &spec = TILE_SPECS[type];
+
+        for (int state = 0; state < BALL_STATE_COUNT; ++state) {
+            table.entries[type][state] = Transition{ INF, (BallState)state, 0, 0, false };
+        }
+
+        for (int d = 0; d < 4; ++d) {
+            // exiting balls move on to the neighbour, whatever the tile
+            table.entries[type][(int)exiting_towards(d)] = Transition{ 0.5, entering_from((d + 2) % 4), DROW[d], DCOL[d], false };
+
+            Transition &entering = table.entries[type][(int)entering_from(d)];
+            if (spec.rotor) {
+                entering = Transition{ 0.25, exiting_towards(d), 0, 0, true };
+            }
+            else if (spec.exits[d] >= 0) {
+                entering = Transition{ 0.5, exiting_towards(spec.exits[d]), 0, 0, false };
+            }
+            else if (type != (int)TileType::Empty) {
+                // dead end, the ball keeps trying to enter
+                entering = Transition{ 0.5, entering_from(d), 0, 0, false };
+            }
+        }
+    }
+    return table;
+}
+
+static constexpr TransitionTable TRANSITIONS = make_transitions();
+
+static_assert(TRANSITIONS(TileType::Horizontal, BallState::EnteringFromWest).next == BallState::ExitingTowardsEast, "");
+static_assert(TRANSITIONS(TileType::CornerNorthEast, BallState::EnteringFromNorth).next == BallState::ExitingTowardsEast, "");
+static_assert(TRANSITIONS(TileType::Rotor, BallState::EnteringFromSouth).threshold == 0.25, "");
+static_assert(TRANSITIONS(TileType::Empty, BallState::ExitingTowardsSouth).drow == 1, "");
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the newest of a stream of values from one thread to another without
+// locks and without either of them waiting. The writer fills a slot of its
+// own and swaps it with the one in the middle, the reader swaps the middle
+// one with its own when it holds a value it didn't take yet. Values the
+// reader doesn't get to in time are skipped.
+template <typename T>
+class TripleBuffer {
+public:
+    // the slot the writer fills
+    T &back() { return _slots[_back]; }
+
+    // makes the back slot the newest value and hands the writer another one
+    void publish() {
+        _back = _middle.exchange((uint8_t)(_back | FRESH), std::memory_order_acq_rel) & INDEX;
+    }
+
+    // takes the newest value, false if the reader already has it
+    bool update() {
+        if (!(_middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        _front = _middle.exchange(_front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    // the value the reader took last
+    const T &front() const { return _slots[_front]; }
+
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    // set while the middle slot holds a value the reader didn't take
+    static constexpr uint8_t FRESH = 0x4;
+
+    T _slots[3];
+    uint8_t _back = 0;
+    std::atomic<uint8_t> _middle{ 1 };
+    uint8_t _front = 2;
+};
@@ -1,227 +1,541 @@
 #include "view.hpp"
 
 #include "model.hpp"
+#include "profile.hpp"
+#include "transitions.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// vertices per call to the canvas, frames with more take several
+static constexpr size_t BATCH_VERTICES = 1 << 16;
+
+// tiles narrower than this many pixels are shown as an overview
+static constexpr double DETAIL_TILE = 12.0;
+
+// how far the camera zooms, in pixels per tile
+static constexpr double MIN_TILE = 1.0 / 64.0;
+static constexpr double MAX_TILE = 512.0;
+
+// side of the cells of the ball index, in tiles
+static constexpr int CELL = 16;
+// tiles balls may have moved since the index was built before it is built
+// again
+static constexpr double REINDEX_TILES = CELL / 2;
+
+// the overview shows up to this many balls one by one, more by cell
+static constexpr size_t OVERVIEW_BALLS = 1 << 16;
+
+static Color ball_color(BallType type) {
+    switch (type) {
+    case BallType::Red:
+        return rgb(255, 0, 0);
+    case BallType::Green:
+        return rgb(0, 255, 0);
+    case BallType::Blue:
+        return rgb(0, 0, 255);
+    case BallType::Yellow:
+        return rgb(255, 255, 0);
+    default:
+        throw 1;
+    }
+}
 
-#include <allegro5/allegro.h>
-#include <allegro5/allegro_primitives.h>
+// how far a rotor turned, in quarter turns clockwise from north
+static double quarter_turns(const Tile &tile) {
+    double quarter_turns = tile.rotor.position;
+    if (tile.rotor.state == RotorState::TurningClockwise) {
+        quarter_turns += tile.rotor.transition;
+    }
+    else if (tile.rotor.state == RotorState::TurningCounterClockwise) {
+        quarter_turns += 4;
+        quarter_turns -= tile.rotor.transition;
+    }
+    return quarter_turns;
+}
+
+// quarter turns alpha of the way from the rotor of previous to that of tile,
+// the short way round
+static double quarter_turns(const Tile &previous, const Tile &tile, double alpha) {
+    double from = quarter_turns(previous);
+    double delta = std::fmod(quarter_turns(tile) - from, 4.0);
+    if (delta > 2.0)
+        delta -= 4.0;
+    else if (delta < -2.0)
+        delta += 4.0;
+    return from + alpha * delta;
+}
+
+// where the ball is within its tile, from 0 to 1
+static void ball_offset(const Model &m, const Ball &ball, double &offset_x, double &offset_y) {
+    double transition = ball.transition;
+    switch (ball.state) {
+    case BallState::ExitingTowardsNorth:
+        transition += 0.5;
+    case BallState::EnteringFromSouth:
+        offset_x = 0.5;
+        offset_y = 1.0 - transition;
+        break;
+
+    case BallState::ExitingTowardsEast:
+        transition += 0.5;
+    case BallState::EnteringFromWest:
+        offset_x = transition;
+        offset_y = 0.5;
+        break;
+
+    case BallState::ExitingTowardsSouth:
+        transition += 0.5;
+    case BallState::EnteringFromNorth:
+        offset_x = 0.5;
+        offset_y = transition;
+        break;
+
+    case BallState::ExitingTowardsWest:
+        transition += 0.5;
+    case BallState::EnteringFromEast:
+        offset_x = 1.0 - transition;
+        offset_y = 0.5;
+        break;
+
+    case BallState::InsideRotor:
+    {
+        double pi_half = 1.5707963267948966;
+        double angle = (quarter_turns(m.tile(ball.row, ball.col)) + ball.rotor_position) * pi_half;
+        offset_x = 0.5 + 0.25 * sin(angle);
+        offset_y = 0.5 + 0.25 * -cos(angle);
+        break;
+    }
 
-void View::draw(const Model &m) const {
-    ALLEGRO_COLOR line_color = al_map_rgb(127, 127, 127);
+    default:
+        throw 1;
+    }
+}
+
+// a circle of the given radius around the origin, with as many segments as
+// al_draw_filled_circle would use
+static std::vector<float> make_rim(double radius) {
+    int segments = std::max(8, (int)(10.0 * std::sqrt(radius)));
+    std::vector<float> rim;
+    for (int k = 0; k < segments; ++k) {
+        double angle = 2.0 * 3.14159265358979323846 * k / segments;
+        rim.push_back((float)(radius * std::cos(angle)));
+        rim.push_back((float)(radius * std::sin(angle)));
+    }
+    return rim;
+}
+
+void View::Batch::reserve(size_t count) {
+    if (vertices.size() + count > BATCH_VERTICES)
+        flush();
+}
+
+void View::Batch::flush() {
+    if (!indices.empty()) {
+        if (lines)
+            canvas->drawLines(vertices.data(), indices.data(), indices.size());
+        else
+            canvas->drawTriangles(vertices.data(), indices.data(), indices.size());
+    }
+    vertices.clear();
+    indices.clear();
+}
+
+View::View(double x, double y, double w) :
+    _x(x), _y(y), _w(w)
+{
+}
+
+void View::setCamera(double x, double y, double w) {
+    _x = x;
+    _y = y;
+    _w = std::min(std::max(w, MIN_TILE), MAX_TILE);
+}
+
+void View::pan(double dx, double dy) {
+    _x += dx;
+    _y += dy;
+}
+
+void View::zoom(double factor, double x, double y) {
+    double w = std::min(std::max(_w * factor, MIN_TILE), MAX_TILE);
+    _x = x - (x - _x) * w / _w;
+    _y = y - (y - _y) * w / _w;
+    _w = w;
+}
+
+void View::toBoard(double x, double y, double &col, double &row) const {
+    col = (x - _x) / _w;
+    row = (y - _y) / _w;
+}
+
+bool View::overview() const {
+    return _w < DETAIL_TILE;
+}
+
+// tiles that are at least partly on a target of the given size
+void View::visibleTiles(const Model &m, int width, int height, int &first_row, int &first_col, int &end_row, int &end_col) const {
+    first_row = (int)std::min<double>(m.rows(), std::max(0.0, std::floor(-_y / _w)));
+    first_col = (int)std::min<double>(m.cols(), std::max(0.0, std::floor(-_x / _w)));
+    end_row = (int)std::min<double>(m.rows(), std::max(0.0, std::ceil((height - _y) / _w)));
+    end_col = (int)std::min<double>(m.cols(), std::max(0.0, std::ceil((width - _x) / _w)));
+}
+
+void View::addLine(double x1, double y1, double x2, double y2, Color color) {
+    _lines.reserve(2);
+    int first = (int)_lines.vertices.size();
+    _lines.vertices.push_back(Vertex{ (float)x1, (float)y1, color });
+    _lines.vertices.push_back(Vertex{ (float)x2, (float)y2, color });
+    _lines.indices.push_back(first);
+    _lines.indices.push_back(first + 1);
+}
+
+void View::addQuad(double x1, double y1, double x2, double y2, Color color) {
+    _triangles.reserve(4);
+    int first = (int)_triangles.vertices.size();
+    _triangles.vertices.push_back(Vertex{ (float)x1, (float)y1, color });
+    _triangles.vertices.push_back(Vertex{ (float)x2, (float)y1, color });
+    _triangles.vertices.push_back(Vertex{ (float)x2, (float)y2, color });
+    _triangles.vertices.push_back(Vertex{ (float)x1, (float)y2, color });
+    for (int k : { 0, 1, 2, 0, 2, 3 }) {
+        _triangles.indices.push_back(first + k);
+    }
+}
+
+// track 1.5 pixels wide from the center of the tile towards x, y, in half tiles
+void View::addTrack(int row, int col, double x, double y) {
+    double cx = _x + (col + 0.5) * _w;
+    double cy = _y + (row + 0.5) * _w;
+    double tx = cx + x * 0.5 * _w;
+    double ty = cy + y * 0.5 * _w;
+
+    addQuad(std::min(cx, tx) - 0.75, std::min(cy, ty) - 0.75, std::max(cx, tx) + 0.75, std::max(cy, ty) + 0.75, rgb(255, 255, 255));
+}
+
+void View::addCircle(double x, double y, const std::vector<float> &rim, Color color) {
+    int segments = (int)(rim.size() / 2);
+    _triangles.reserve(segments + 1);
+
+    int center = (int)_triangles.vertices.size();
+    _triangles.vertices.push_back(Vertex{ (float)x, (float)y, color });
+    for (int k = 0; k < segments; ++k) {
+        _triangles.vertices.push_back(Vertex{ (float)x + rim[2 * k], (float)y + rim[2 * k + 1], color });
+        _triangles.indices.push_back(center);
+        _triangles.indices.push_back(center + 1 + k);
+        _triangles.indices.push_back(center + 1 + (k + 1) % segments);
+    }
+}
+
+void View::drawLayer(Canvas &canvas, const Model &m) {
+    PROFILE_SCOPE("draw layer");
+    int width = canvas.width();
+    int height = canvas.height();
+    _layer_canvas = &canvas;
+    _layer_width = width;
+    _layer_height = height;
+    _layer_x = _x;
+    _layer_y = _y;
+    _layer_w = _w;
+    _rotors.clear();
+
+    canvas.beginLayer();
+
+    int first_row, first_col, end_row, end_col;
+    visibleTiles(m, width, height, first_row, first_col, end_row, end_col);
+    const TileGrid &tiles = m.packedTiles();
+
+    if (overview()) {
+        // a square per tile, or per pixel once tiles are smaller than that
+        int step = _w >= 1.0 ? 1 : (int)std::ceil(1.0 / _w);
+        double size = std::max(1.0, step * _w);
+        Color track_color = rgb(0x99, 0x99, 0x99);
+        Color rotor_color = rgb(0x66, 0x66, 0x66);
+
+        for (int r = first_row; r < end_row; r += step) {
+            for (int c = first_col; c < end_col; c += step) {
+                TileType type = tiles.at(r, c).type();
+                if (type == TileType::Empty)
+                    continue;
+
+                double x = _x + c * _w;
+                double y = _y + r * _w;
+                addQuad(x, y, x + size, y + size, type == TileType::Rotor ? rotor_color : track_color);
+            }
+        }
+        _triangles.flush();
+        canvas.endLayer();
+        return;
+    }
 
     // draw grid
-    for (int r = 0; r <= m.rows(); ++r) {
-        al_draw_line(_x + 0.5, _y + r * _w + 0.5, _x + 8 * _w + 0.5, _y + r * _w + 0.5, line_color, 0.0);
+    Color line_color = rgb(127, 127, 127);
+    for (int r = first_row; r <= end_row; ++r) {
+        addLine(_x + first_col * _w + 0.5, _y + r * _w + 0.5, _x + end_col * _w + 0.5, _y + r * _w + 0.5, line_color);
     }
-    for (int c = 0; c <= m.cols(); ++c) {
-        al_draw_line(_x + c * _w + 0.5, _y + 0.5, _x + c * _w + 0.5, _y + 5 * _w + 0.5, line_color, 0.0);
+    for (int c = first_col; c <= end_col; ++c) {
+        addLine(_x + c * _w + 0.5, _y + first_row * _w + 0.5, _x + c * _w + 0.5, _y + end_row * _w + 0.5, line_color);
     }
+    _lines.flush();
 
     // draw tiles
-    static const auto draw_track = [=](int r, int c, double x1, double y1, double x2, double y2) {
-        x1 *= 0.5;
-        y1 *= 0.5;
-        x2 *= 0.5;
-        y2 *= 0.5;
-
-        x1 += 0.5;
-        y1 += 0.5;
-        x2 += 0.5;
-        y2 += 0.5;
-
-        x1 += c;
-        y1 += r;
-        x2 += c;
-        y2 += r;
-
-        x1 *= _w;
-        y1 *= _w;
-        x2 *= _w;
-        y2 *= _w;
-
-        x1 += _x;
-        y1 += _y;
-        x2 += _x;
-        y2 += _y;
-
-        const ALLEGRO_COLOR color = al_map_rgb(255, 255, 255);
-
-        al_draw_line(x1, y1, x2, y2, color, 1.5);
-    };
-
-    static const auto draw_circle = [=](int row, int col, double x1, double y1, double r, ALLEGRO_COLOR color) {
-        x1 *= 0.5;
-        y1 *= 0.5;
-        r *= 0.5;
+    static constexpr int DX[4] = { 0, 1, 0, -1 };
+    static constexpr int DY[4] = { -1, 0, 1, 0 };
+    Color body_color = rgb(0x66, 0x66, 0x66);
+    for (int r = first_row; r < end_row; ++r) {
+        for (int c = first_col; c < end_col; ++c) {
+            const PackedTile &tile = tiles.at(r, c);
+            if (tile.type() == TileType::Rotor) {
+                for (int d = 0; d < 4; ++d) {
+                    if (tile.connected(d))
+                        addTrack(r, c, DX[d], DY[d]);
+                }
+                addCircle(_x + (c + 0.5) * _w, _y + (r + 0.5) * _w, _body_rim, body_color);
+                _rotors.push_back(Cell{ r, c });
+            }
+            else if (tile.type() != TileType::Empty) {
+                // track from the center to every port of the tile
+                for (int d = 0; d < 4; ++d) {
+                    if (has_port(tile.type(), d))
+                        addTrack(r, c, DX[d], DY[d]);
+                }
+            }
+        }
+    }
+    _triangles.flush();
+
+    canvas.endLayer();
+}
+
+// balls keep their numbers from one snapshot to the next, so an index of
+// one model holds for the models restored from the same board a little
+// earlier or later
+void View::indexBalls(const Model &m, const void *source, uint64_t revision) {
+    if (_indexed && source == _index_source && revision == _index_revision && m.ballCount() == _index_count
+        && std::fabs(m.now() - _index_now) * Model::BALL_VELOCITY < REINDEX_TILES)
+    {
+        return;
+    }
 
-        x1 += 0.5;
-        y1 += 0.5;
+    _indexed = true;
+    _index_source = source;
+    _index_revision = revision;
+    _index_count = m.ballCount();
+    _index_now = m.now();
 
-        x1 += col;
-        y1 += row;
+    _cell_cols = (m.cols() + CELL - 1) / CELL;
+    size_t cells = (size_t)((m.rows() + CELL - 1) / CELL) * _cell_cols;
+    _cell_start.assign(cells + 1, 0);
+    _cell_types.assign(cells, 0);
+    _outside.clear();
 
-        r *= _w;
-        x1 *= _w;
-        y1 *= _w;
+    auto cell_of = [&](int64_t tile) {
+        return (size_t)(tile / m.cols() / CELL) * _cell_cols + tile % m.cols() / CELL;
+    };
 
-        x1 += _x;
-        y1 += _y;
+    // count the balls per cell, then sort them into place
+    for (size_t i = 0; i < m.ballCount(); ++i) {
+        int64_t tile = m.ballTile(i);
+        if (tile < 0) {
+            if (m.ball(i).state != BallState::None)
+                _outside.push_back((uint32_t)i);
+            continue;
+        }
+        size_t cell = cell_of(tile);
+        ++_cell_start[cell + 1];
+        _cell_types[cell] |= 1 << (int)m.ballType(i);
+    }
+    for (size_t k = 0; k < cells; ++k) {
+        _cell_start[k + 1] += _cell_start[k];
+    }
 
-        al_draw_filled_circle(x1, y1, r, color);
+    // _cell_start[k] moves from the start to the end of cell k, which is
+    // the start of cell k + 1
+    _cell_balls.resize(_cell_start[cells]);
+    for (size_t i = 0; i < m.ballCount(); ++i) {
+        int64_t tile = m.ballTile(i);
+        if (tile >= 0)
+            _cell_balls[_cell_start[cell_of(tile)]++] = (uint32_t)i;
+    }
+    for (size_t k = cells; k > 0; --k) {
+        _cell_start[k] = _cell_start[k - 1];
+    }
+    _cell_start[0] = 0;
+}
+
+void View::drawBalls(const Model &previous, const Model &m, double alpha, int width, int height) {
+    PROFILE_SCOPE("draw balls");
+
+    // balls on screen were in the index as far off as they could move since
+    // it was built, and a tile further for the way from previous and for
+    // the part of a tile they were on already
+    int first_row, first_col, end_row, end_col;
+    visibleTiles(m, width, height, first_row, first_col, end_row, end_col);
+    if (first_row >= end_row || first_col >= end_col) {
+        first_row = end_row = 0;
+        first_col = end_col = 0;
+    }
+    else {
+        int margin = (int)std::ceil(std::fabs(m.now() - _index_now) * Model::BALL_VELOCITY) + 2;
+        first_row = std::max(0, first_row - margin);
+        first_col = std::max(0, first_col - margin);
+        end_row = std::min(m.rows(), end_row + margin);
+        end_col = std::min(m.cols(), end_col + margin);
+    }
+    int first_cell_row = first_row / CELL;
+    int first_cell_col = first_col / CELL;
+    int end_cell_row = (end_row + CELL - 1) / CELL;
+    int end_cell_col = (end_col + CELL - 1) / CELL;
+
+    auto ball_at = [&](size_t i, double &x, double &y) {
+        Ball ball = m.ball(i);
+        double offset_x, offset_y;
+        ball_offset(m, ball, offset_x, offset_y);
+        x = _x + _w * (ball.col + offset_x);
+        y = _y + _w * (ball.row + offset_y);
+        if (&previous == &m || i >= previous.ballCount())
+            return ball;
+
+        Ball before = previous.ball(i);
+        if (before.state == BallState::None)
+            return ball;
+        ball_offset(previous, before, offset_x, offset_y);
+        double before_x = _x + _w * (before.col + offset_x);
+        double before_y = _y + _w * (before.row + offset_y);
+        x = before_x + alpha * (x - before_x);
+        y = before_y + alpha * (y - before_y);
+        return ball;
     };
 
-    for (int r = 0; r < m.rows(); ++r) {
-        for (int c = 0; c < m.cols(); ++c) {
-            Tile tile = m.tile(r, c);
-            switch (tile.type) {
-            case TileType::CornerNorthEast:
-                draw_track(r, c, 0, 0, 0, -1);
-                draw_track(r, c, 0, 0, 1, 0);
-                break;
-
-            case TileType::CornerNorthWest:
-                draw_track(r, c, 0, 0, 0, -1);
-                draw_track(r, c, 0, 0, -1, 0);
-                break;
-
-            case TileType::CornerSouthEast:
-                draw_track(r, c, 0, 0, 0, 1);
-                draw_track(r, c, 0, 0, 1, 0);
-                break;
-
-            case TileType::CornerSouthWest:
-                draw_track(r, c, 0, 0, 0, 1);
-                draw_track(r, c, 0, 0, -1, 0);
-                break;
-
-            case TileType::Horizontal:
-                draw_track(r, c, -1, 0, 1, 0);
-                break;
-
-            case TileType::Vertical:
-                draw_track(r, c, 0, -1, 0, 1);
-                break;
-
-            case TileType::Crossing:
-                draw_track(r, c, -1, 0, 1, 0);
-                draw_track(r, c, 0, -1, 0, 1);
-                break;
-
-            case TileType::Rotor:
-            {
-                if (m.tile(r, c).rotor.connected[0])
-                    draw_track(r, c, 0, 0, 0, -1);
-                if (m.tile(r, c).rotor.connected[1])
-                    draw_track(r, c, 0, 0, 1, 0);
-                if (m.tile(r, c).rotor.connected[2])
-                    draw_track(r, c, 0, 0, 0, 1);
-                if (m.tile(r, c).rotor.connected[3])
-                    draw_track(r, c, 0, 0, -1, 0);
-
-                draw_circle(r, c, 0, 0, 0.8, al_map_rgb(0x66, 0x66, 0x66));
-                double pi_half = 1.5707963267948966;
-                double quarter_turns = tile.rotor.position;
-                if (tile.rotor.state == RotorState::TurningClockwise) {
-                    quarter_turns += tile.rotor.transition;
-                }
-                else if (tile.rotor.state == RotorState::TurningCounterClockwise) {
-                    quarter_turns += 4;
-                    quarter_turns -= tile.rotor.transition;
+    if (!overview()) {
+        double radius = _w / 10.0;
+        auto draw_ball = [&](size_t i) {
+            double x, y;
+            Ball ball = ball_at(i, x, y);
+            if (x >= -radius && x <= width + radius && y >= -radius && y <= height + radius)
+                addCircle(x, y, _dot_rim, ball_color(ball.type));
+        };
+
+        for (int cr = first_cell_row; cr < end_cell_row; ++cr) {
+            for (int cc = first_cell_col; cc < end_cell_col; ++cc) {
+                size_t cell = (size_t)cr * _cell_cols + cc;
+                for (uint32_t k = _cell_start[cell]; k < _cell_start[cell + 1]; ++k) {
+                    draw_ball(_cell_balls[k]);
                 }
-                double angle = quarter_turns * pi_half;
-                draw_circle(r, c, 0.5 * sin(angle), 0.5 * -cos(angle), 0.2, al_map_rgb(0x33, 0x33, 0x33));
-                draw_circle(r, c, 0.5 * -cos(angle), 0.5 * -sin(angle), 0.2, al_map_rgb(0x33, 0x33, 0x33));
-                draw_circle(r, c, 0.5 * -sin(angle), 0.5 * cos(angle), 0.2, al_map_rgb(0x33, 0x33, 0x33));
-                draw_circle(r, c, 0.5 * cos(angle), 0.5 * sin(angle), 0.2, al_map_rgb(0x33, 0x33, 0x33));
-                break;
             }
+        }
+        for (uint32_t i : _outside) {
+            draw_ball(i);
+        }
+        return;
+    }
 
-            default:
-                break;
+    // cells smaller than a pixel are sampled
+    double cell_size = CELL * _w;
+    int step = cell_size >= 1.0 ? 1 : (int)std::ceil(1.0 / cell_size);
 
-            }
+    size_t visible = 0;
+    if (step == 1) {
+        for (int cr = first_cell_row; cr < end_cell_row; ++cr) {
+            size_t row = (size_t)cr * _cell_cols;
+            visible += _cell_start[row + end_cell_col] - _cell_start[row + first_cell_col];
         }
     }
 
-    // draw balls
-    for (auto &ball : m.balls()) {
-        if (ball.state == BallState::None)
-            continue;
-
-        double offset_x;
-        double offset_y;
-        double transition = ball.transition;
-        switch (ball.state) {
-        case BallState::ExitingTowardsNorth:
-            transition += 0.5;
-        case BallState::EnteringFromSouth:
-            offset_x = 0.5;
-            offset_y = 1.0 - transition;
-            break;
-
-        case BallState::ExitingTowardsEast:
-            transition += 0.5;
-        case BallState::EnteringFromWest:
-            offset_x = transition;
-            offset_y = 0.5;
-            break;
-
-        case BallState::ExitingTowardsSouth:
-            transition += 0.5;
-        case BallState::EnteringFromNorth:
-            offset_x = 0.5;
-            offset_y = transition;
-            break;
-
-        case BallState::ExitingTowardsWest:
-            transition += 0.5;
-        case BallState::EnteringFromEast:
-            offset_x = 1.0 - transition;
-            offset_y = 0.5;
-            break;
-
-        case BallState::InsideRotor:
-        {
-            double pi_half = 1.5707963267948966;
-            double quarter_turns = m.tile(ball.row, ball.col).rotor.position + ball.rotor_position;
-            if (m.tile(ball.row, ball.col).rotor.state == RotorState::TurningClockwise) {
-                quarter_turns += m.tile(ball.row, ball.col).rotor.transition;
-            }
-            else if (m.tile(ball.row, ball.col).rotor.state == RotorState::TurningCounterClockwise) {
-                quarter_turns += 4;
-                quarter_turns -= m.tile(ball.row, ball.col).rotor.transition;
+    if (step == 1 && visible <= OVERVIEW_BALLS) {
+        double half = std::max(0.5, _w / 10.0);
+        for (int cr = first_cell_row; cr < end_cell_row; ++cr) {
+            for (int cc = first_cell_col; cc < end_cell_col; ++cc) {
+                size_t cell = (size_t)cr * _cell_cols + cc;
+                for (uint32_t k = _cell_start[cell]; k < _cell_start[cell + 1]; ++k) {
+                    double x, y;
+                    Ball ball = ball_at(_cell_balls[k], x, y);
+                    if (x >= -half && x <= width + half && y >= -half && y <= height + half)
+                        addQuad(x - half, y - half, x + half, y + half, ball_color(ball.type));
+                }
             }
-            double angle = quarter_turns * pi_half;
-            offset_x = 0.5 + 0.25 * sin(angle);
-            offset_y = 0.5 + 0.25 * -cos(angle);
-            break;
         }
+        return;
+    }
 
-        default:
-            throw 1;
-        }
+    // one square per cell in the colors of its balls mixed
+    double size = std::max(1.0, step * cell_size);
+    for (int cr = first_cell_row; cr < end_cell_row; cr += step) {
+        for (int cc = first_cell_col; cc < end_cell_col; cc += step) {
+            uint8_t types = _cell_types[(size_t)cr * _cell_cols + cc];
+            if (types == 0)
+                continue;
+
+            float r = 0.0f, g = 0.0f, b = 0.0f;
+            int count = 0;
+            for (int t = 0; t < 4; ++t) {
+                if (types & (1 << t)) {
+                    Color color = ball_color((BallType)t);
+                    r += color.r;
+                    g += color.g;
+                    b += color.b;
+                    ++count;
+                }
+            }
+            Color color = { r / count, g / count, b / count, 1.0f };
 
-        double x = _x + _w * (ball.col + offset_x);
-        double y = _y + _w * (ball.row + offset_y);
-
-        ALLEGRO_COLOR color = al_map_rgb(0, 0, 0);
-
-        switch (ball.type) {
-        case BallType::Red:
-            color = al_map_rgb(255u, 0u, 0u);
-            break;
-        case BallType::Green:
-            color = al_map_rgb(0u, 255u, 0u);
-            break;
-        case BallType::Blue:
-            color = al_map_rgb(0u, 0u, 255u);
-            break;
-        case BallType::Yellow:
-            color = al_map_rgb(255u, 255u, 0u);
-            break;
-        default:
-            throw 1;
+            double x = _x + cc * cell_size;
+            double y = _y + cr * cell_size;
+            addQuad(x, y, x + size, y + size, color);
         }
+    }
+}
+
+void View::draw(Canvas &canvas, const Model &m) {
+    drawFrame(canvas, m, m, 1.0, &m, m.boardRevision());
+}
+
+void View::draw(Canvas &canvas, const Model &previous, const Model &m, double alpha, uint64_t board) {
+    // a tick of another board can't be blended with
+    if (previous.rows() != m.rows() || previous.cols() != m.cols())
+        drawFrame(canvas, m, m, 1.0, nullptr, board);
+    else
+        drawFrame(canvas, previous, m, std::min(std::max(alpha, 0.0), 1.0), nullptr, board);
+}
+
+void View::drawFrame(Canvas &canvas, const Model &previous, const Model &m, double alpha, const void *source, uint64_t revision) {
+    int width = canvas.width();
+    int height = canvas.height();
+    _lines.canvas = &canvas;
+    _triangles.canvas = &canvas;
+
+    if (_rim_w != _w) {
+        _rim_w = _w;
+        _dot_rim = make_rim(_w / 10.0);
+        _body_rim = make_rim(0.4 * _w);
+    }
 
-        al_draw_filled_circle(x, y, (_w / 10.0), color);
+    if (&canvas != _layer_canvas || width != _layer_width || height != _layer_height
+        || source != _layer_source || revision != _layer_revision
+        || _x != _layer_x || _y != _layer_y || _w != _layer_w)
+    {
+        drawLayer(canvas, m);
+        _layer_source = source;
+        _layer_revision = revision;
     }
-}
\ No newline at end of file
+    canvas.drawLayer();
+
+    // draw rotor dots
+    const double pi_half = 1.5707963267948966;
+    Color dot_color = rgb(0x33, 0x33, 0x33);
+    for (const Cell &rotor : _rotors) {
+        double angle = quarter_turns(previous.tile(rotor.row, rotor.col), m.tile(rotor.row, rotor.col), alpha) * pi_half;
+        double x = _x + (rotor.col + 0.5) * _w;
+        double y = _y + (rotor.row + 0.5) * _w;
+        double s = 0.25 * _w * std::sin(angle);
+        double c = 0.25 * _w * std::cos(angle);
+        addCircle(x + s, y - c, _dot_rim, dot_color);
+        addCircle(x - c, y - s, _dot_rim, dot_color);
+        addCircle(x - s, y + c, _dot_rim, dot_color);
+        addCircle(x + c, y + s, _dot_rim, dot_color);
+    }
+
+    // draw balls
+    indexBalls(m, source, revision);
+    drawBalls(previous, m, alpha, width, height);
+    _triangles.flush();
+}
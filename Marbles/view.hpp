@@ -1,15 +1,126 @@
 #pragma once
 
+#include "canvas.hpp"
+
+#include <cstdint>
+#include <vector>
+
 class Model;
 
+// Draws a model onto a canvas through a camera that pans and zooms.
+// Only the tiles and balls on screen are drawn, so that the cost of a frame
+// depends on the size of the screen rather than of the board.
+//
+// The grid, the track and the bodies of the rotors are drawn into a layer of
+// their own that is only drawn again when the board or the camera changes.
+// The dots of the rotors and the balls, which move, go into one batch of
+// triangles per frame. Balls are found through an index of the cells of
+// the board they were in when it was built. Balls only move so fast, so the
+// index holds for a few seconds of the same board, in which the cells
+// around the screen are searched by as far as balls got since.
+//
+// Below a few pixels per tile the view shows an overview instead: tiles are
+// squares, rotors lose their dots and balls become squares too, or one
+// square per cell of the index once there are too many of them.
+//
+// Drawn from two models a tick apart, balls and rotors are shown part of the
+// way between them, so that boards simulated at a fixed tick move smoothly
+// at any refresh rate.
 class View {
 public:
-    View(double x, double y, double w) : _x(x), _y(y), _w(w) { }
+    // x, y is where the top left corner of the board starts out on screen,
+    // w the width of a tile in pixels
+    View(double x, double y, double w);
+
+    void draw(Canvas &canvas, const Model &m);
+    // draws the board alpha of the way from previous to m, a tick later.
+    // board stands for the board of both, whose boardRevision changes every
+    // time models are restored from snapshots.
+    void draw(Canvas &canvas, const Model &previous, const Model &m, double alpha, uint64_t board);
+
+    // x, y and w as for the constructor
+    void setCamera(double x, double y, double w);
+    // moves the board by dx, dy pixels
+    void pan(double dx, double dy);
+    // scales the board by factor, keeping the point at pixel x, y in place
+    void zoom(double factor, double x, double y);
 
-    void draw(const Model &) const;
+    // the point of the board at pixel x, y, in tiles from its top left corner
+    void toBoard(double x, double y, double &col, double &row) const;
 
 private:
+    struct Cell {
+        int row;
+        int col;
+    };
+
+    // vertices that are drawn with as few calls as possible
+    struct Batch {
+        explicit Batch(bool lines) : lines(lines) { }
+
+        bool lines;
+        Canvas *canvas = nullptr;
+        std::vector<Vertex> vertices;
+        std::vector<int> indices;
+
+        // makes room for count more vertices
+        void reserve(size_t count);
+        void flush();
+    };
+
+    bool overview() const;
+    void visibleTiles(const Model &m, int width, int height, int &first_row, int &first_col, int &end_row, int &end_col) const;
+    void indexBalls(const Model &m, const void *source, uint64_t revision);
+
+    void drawFrame(Canvas &canvas, const Model &previous, const Model &m, double alpha, const void *source, uint64_t revision);
+    void drawLayer(Canvas &canvas, const Model &m);
+    void drawBalls(const Model &previous, const Model &m, double alpha, int width, int height);
+
+    void addLine(double x1, double y1, double x2, double y2, Color color);
+    void addQuad(double x1, double y1, double x2, double y2, Color color);
+    void addTrack(int row, int col, double x, double y);
+    void addCircle(double x, double y, const std::vector<float> &rim, Color color);
+
     double _x;
     double _y;
     double _w;
+
+    // rims of a dot or ball and of a rotor body around their center, for
+    // the tile width _rim_w
+    double _rim_w = 0.0;
+    std::vector<float> _dot_rim;
+    std::vector<float> _body_rim;
+
+    // the layer of _layer_canvas is drawn again when its size, source or
+    // revision change, that is the model and its boardRevision or what draw
+    // was given instead, or when the camera moves
+    Canvas *_layer_canvas = nullptr;
+    int _layer_width = 0;
+    int _layer_height = 0;
+    const void *_layer_source = nullptr;
+    uint64_t _layer_revision = 0;
+    double _layer_x = 0.0;
+    double _layer_y = 0.0;
+    double _layer_w = 0.0;
+    // rotors on the layer, whose dots are drawn every frame
+    std::vector<Cell> _rotors;
+
+    Batch _lines{ true };
+    Batch _triangles{ false };
+
+    // balls by cell of CELL * CELL tiles as of _index_now, row by row of
+    // cells. the balls of cell k are _cell_balls[_cell_start[k]] up to
+    // _cell_start[k + 1], which have the types in the bits of _cell_types[k].
+    // the index is kept for the same source and revision as the layer.
+    bool _indexed = false;
+    const void *_index_source = nullptr;
+    uint64_t _index_revision = 0;
+    size_t _index_count = 0;
+    double _index_now = 0.0;
+    int _cell_cols = 0;
+    std::vector<uint32_t> _cell_start;
+    std::vector<uint32_t> _cell_balls;
+    std::vector<uint8_t> _cell_types;
+    // balls that left the board
+    std::vector<uint32_t> _outside;
 };